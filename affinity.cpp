@@ -0,0 +1,103 @@
+#include "affinity.hpp"
+#include <cstring>
+#include <fstream>
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+std::vector<int> parse_cpulist (const std::string& str)
+{
+    // Returns an empty vector on a syntax error or a core beyond
+    // CPU_SETSIZE, as well as for "".
+    std::vector<int> ret;
+    size_t pos = 0;
+    while (pos < str.size ()) {
+	size_t cp = str.find (',', pos);
+	if (cp == std::string::npos)	cp = str.size ();
+	auto tok = str.substr (pos, cp - pos);
+	pos = cp + 1;
+	if (tok.empty ())	continue;
+
+	char *ep;
+	long lb = strtol (tok.c_str (), &ep, 10), ub = lb;
+	if (*ep == '-')		ub = strtol (ep + 1, &ep, 10);
+	if (*ep || (lb < 0) || (ub < lb) || (ub >= CPU_SETSIZE))	return {};
+	for (auto ii = lb; ii <= ub; ii++)	ret.push_back ((int)ii);
+    }
+    return ret;
+}
+
+static std::string read_line (const std::string& path)
+{
+    std::ifstream ifs (path);
+    std::string ret;
+    std::getline (ifs, ret);
+    return ret;
+}
+
+std::vector<int> online_cpus (void)
+{
+    auto ret = parse_cpulist (read_line ("/sys/devices/system/cpu/online"));
+    if (ret.empty ())
+	for (auto ii = 0; ii < (int)sysconf (_SC_NPROCESSORS_ONLN); ii++)	ret.push_back (ii);
+    return ret;
+}
+
+int cpu_node (int cpu)
+{
+    // cpuN contains a nodeM link on NUMA kernels.
+    auto path = "/sys/devices/system/cpu/cpu" + std::to_string (cpu);
+    DIR *dp = opendir (path.c_str ());
+    if (!dp)	return -1;
+    int ret = 0;
+    for (auto de = readdir (dp); de; de = readdir (dp))
+	if (!strncmp (de->d_name, "node", 4) && isdigit (de->d_name[4])) {
+	    ret = atoi (de->d_name + 4);
+	    break;
+	}
+    closedir (dp);
+    return ret;
+}
+
+bool pin_thread (int cpu)
+{
+    if ((cpu < 0) || (cpu >= CPU_SETSIZE))
+	return false;
+    cpu_set_t cs;
+    CPU_ZERO (&cs);
+    CPU_SET (cpu, &cs);
+    return pthread_setaffinity_np (pthread_self (), sizeof(cs), &cs) == 0;
+}
+
+void* numa_local_alloc (size_t sz)
+{
+    // MPOL_LOCAL then fault every page in from the calling thread.  mbind
+    // fails harmlessly on non-NUMA kernels; first touch still applies.
+    void *ret = mmap (nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED)	return nullptr;
+    syscall (SYS_mbind, ret, sz, MPOL_LOCAL, nullptr, 0, 0);
+    memset (ret, 0, sz);
+    return ret;
+}
+
+void numa_local_free (void *ptr, size_t sz)
+{
+    if (ptr)	munmap (ptr, sz);
+}
+
+json topology_json (void)
+{
+    json ret = { { "cpus", json::array () }, { "nodes", json::object () } };
+    for (auto cpu : online_cpus ()) {
+	auto node = cpu_node (cpu);
+	ret["cpus"].push_back (cpu);
+	ret["nodes"][std::to_string (node)].push_back (cpu);
+    }
+    return ret;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// CPU/NUMA placement helpers.  Core lists use the kernel's cpulist syntax,
+// e.g. "0-3,8,10-11".  Placement is best left to the caller: pin first, then
+// allocate, so first-touch puts the pages on the thread's own node.
+
+std::vector<int> parse_cpulist (const std::string& str);
+std::vector<int> online_cpus (void);
+int cpu_node (int cpu);
+bool pin_thread (int cpu);
+void* numa_local_alloc (size_t sz);
+void numa_local_free (void *ptr, size_t sz);
+nlohmann::json topology_json (void);
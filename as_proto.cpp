@@ -1,10 +1,19 @@
 #include "as_proto.hpp"
+#include "info_parse.hpp"
+#include "tsc_clock.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <time.h>
-#include <chrono>
 
 void as_header::size (size_t sz) {
     this->be_sz_extra = 0;
@@ -186,15 +195,8 @@ size_t write (int fd, const as_msg* msg)
     return write (fd, hdr, msg);
 }
 
-size_t read (int fd, void **obuf)
+static size_t read_body (int fd, const as_header *hdr, void **obuf)
 {
-    uint64_t hb;
-    as_header* hdr = (as_header *)&hb;
-
-    if (read (fd, hdr, 8) != 8) {
-	return 0;
-    }
-
     size_t sz = hdr->size ();
     if (*obuf == nullptr) {
 	*obuf = (char *)malloc (sz + 1);
@@ -203,12 +205,25 @@ size_t read (int fd, void **obuf)
     uint8_t *op = (uint8_t *) *obuf;
     while (sz) {
 	auto gsz = read (fd, op, sz);
+	if (gsz <= 0)
+	    return 0;
 	op += gsz;
 	sz -= gsz;
     }
     return op - (uint8_t *) *obuf;
 }
 
+size_t read (int fd, void **obuf)
+{
+    uint64_t hb;
+    as_header* hdr = (as_header *)&hb;
+
+    if (read (fd, hdr, 8) != 8) {
+	return 0;
+    }
+    return read_body (fd, hdr, obuf);
+}
+
 size_t read (int fd, std::string& str)
 {
     uint64_t hb;
@@ -223,62 +238,278 @@ size_t read (int fd, std::string& str)
     char *op = &str[0];
     while (sz) {
 	auto gsz = read (fd, op, sz);
+	if (gsz <= 0) {
+	    str.clear ();
+	    return 0;
+	}
 	op += gsz;
 	sz -= gsz;
     }
     return str.size ();
 }
 
-size_t call (int fd, void **obuf, const as_msg* msg, uint32_t *dur)
+bool g_call_trace = false;
+thread_local uint64_t t_call_trace_encode = 0, t_call_trace_encoded = 0;
+
+// One writer (the owning thread), one reader (the reporter).
+struct trace_ring
+{
+    static const size_t cap = 4096;
+    call_trace buf[cap];
+    std::atomic<uint64_t> head{0}, tail{0}, lost{0};
+    std::atomic<bool> gone{false};	// owner exited; reaped once drained
+};
+
+static std::mutex trace_mtx;
+static std::vector<std::shared_ptr<trace_ring>> trace_rings;
+static uint64_t trace_slow_ns = 0;
+
+static const size_t trace_slow_max = 1024;
+static std::mutex slow_mtx;
+static std::vector<call_trace_slow> slow_q;	// dropped beyond trace_slow_max
+
+struct trace_owner
 {
-    auto tp0 = std::chrono::high_resolution_clock::now ();
+    std::shared_ptr<trace_ring> r;
+    ~trace_owner ()			{ if (r) r->gone.store (true); }
+};
+static thread_local trace_owner t_trace;
+
+static void trace_push (const call_trace& t)
+{
+    auto& r = t_trace.r;
+    if (__builtin_expect (!r, 0)) {
+	r = std::make_shared<trace_ring> ();
+	std::lock_guard<std::mutex> lg (trace_mtx);
+	trace_rings.push_back (r);
+    }
+    auto h = r->head.load (std::memory_order_relaxed);
+    if (h - r->tail.load (std::memory_order_acquire) >= trace_ring::cap) {
+	r->lost.fetch_add (1, std::memory_order_relaxed);
+	return;
+    }
+    r->buf[h % trace_ring::cap] = t;
+    r->head.store (h + 1, std::memory_order_release);
+}
+
+static void trace_slow (const call_trace& t, const as_msg *req, const as_header *hdr, void *res)
+{
+    call_trace_slow s;
+    s.t = t;
+    s.req.assign ((const char *)req, as_header (req).size ());
+    s.res.assign ((const char *)res, hdr->size ());
+    std::lock_guard<std::mutex> lg (slow_mtx);
+    if (slow_q.size () < trace_slow_max)
+	slow_q.push_back (std::move (s));
+}
+
+static size_t call_traced (int fd, void **obuf, const as_msg* msg, uint64_t *dur)
+{
+    call_trace t;
+    t.encode = t_call_trace_encode;
+    t.encoded = t_call_trace_encoded;
+    t_call_trace_encode = t_call_trace_encoded = 0;
+    t.send = now_ns ();
+    write (fd, msg);
+    t.sent = now_ns ();
+    uint64_t hb;
+    if (read (fd, &hb, 8) != 8)
+	return 0;
+    t.first = now_ns ();
+    size_t sz = read_body (fd, (as_header *)&hb, obuf);
+    t.done = now_ns ();
+    if (dur)
+	*dur = t.done - t.send;
+    trace_push (t);
+    if (trace_slow_ns && sz && (t.done - t.send > trace_slow_ns))
+	trace_slow (t, msg, (as_header *)&hb, *obuf);
+    return sz;
+}
+
+void call_trace_start (uint64_t slow_ns)
+{
+    trace_slow_ns = slow_ns;
+    g_call_trace = true;
+}
+
+uint64_t call_trace_drain (const std::function<void (const call_trace&)>& f)
+{
+    std::lock_guard<std::mutex> lg (trace_mtx);
+    uint64_t lost = 0;
+    for (auto it = trace_rings.begin (); it != trace_rings.end (); ) {
+	auto& r = **it;
+	bool gone = r.gone.load ();
+	auto t = r.tail.load (std::memory_order_relaxed);
+	auto h = r.head.load (std::memory_order_acquire);
+	for (; t != h; t++)
+	    f (r.buf[t % trace_ring::cap]);
+	r.tail.store (t, std::memory_order_release);
+	lost += r.lost.exchange (0);
+	it = gone ? trace_rings.erase (it) : it + 1;
+    }
+    return lost;
+}
+
+std::vector<call_trace_slow> call_trace_slow_drain (void)
+{
+    std::vector<call_trace_slow> ret;
+    std::lock_guard<std::mutex> lg (slow_mtx);
+    ret.swap (slow_q);
+    return ret;
+}
+
+size_t call (int fd, void **obuf, const as_msg* msg, uint64_t *dur)
+{
+    if (call_trace_on ())
+	return call_traced (fd, obuf, msg, dur);
+    uint64_t t0 = dur ? now_ns () : 0;
     write (fd, msg);
     if (dur) {
 	size_t sz{read (fd, obuf)};
-	auto tp1 = std::chrono::high_resolution_clock::now ();
-	*dur = (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(tp1 - tp0).count();
+	*dur = now_ns () - t0;
 	return sz;
     } else
 	return read (fd, obuf);
 }
 
-size_t call (int fd, as_msg **obuf, const as_msg* msg, uint32_t *dur)
+size_t call (int fd, as_msg **obuf, const as_msg* msg, uint64_t *dur)
 {
     return call (fd, (void **) obuf, msg, dur);
 }
 
-size_t call (int fd, void **obuf, const std::string& str, uint32_t *dur)
+bool timestamping_enable (int fd, bool hardware)
+{
+    // OPT_TSONLY: TX stamps come back without a copy of the packet.
+    unsigned flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+	SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (hardware)
+	flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    return setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+}
+
+// Software stamps (ts[0]) and raw hardware ones (ts[2]), as they come.
+static void stamps_from (msghdr& mh, uint64_t& sw, uint64_t& hw, bool& snd)
+{
+    for (auto cm = CMSG_FIRSTHDR (&mh); cm; cm = CMSG_NXTHDR (&mh, cm)) {
+	if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SCM_TIMESTAMPING)) {
+	    scm_timestamping st;
+	    memcpy (&st, CMSG_DATA (cm), sizeof(st));
+	    uint64_t s = st.ts[0].tv_sec * 1000000000ull + st.ts[0].tv_nsec;
+	    uint64_t h = st.ts[2].tv_sec * 1000000000ull + st.ts[2].tv_nsec;
+	    if (s)	sw = s;
+	    if (h)	hw = h;
+	} else if (((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) ||
+		   ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))) {
+	    sock_extended_err ee;
+	    memcpy (&ee, CMSG_DATA (cm), sizeof(ee));
+	    snd = (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) && (ee.ee_info == SCM_TSTAMP_SND);
+	}
+    }
+}
+
+// TX stamps queue on the error queue, one per send; drain it, keeping the
+// latest, which is the request's last byte.
+static void drain_tx (int fd, call_stamps& st)
+{
+    alignas(cmsghdr) char ctl[256];
+    for (;;) {
+	msghdr mh = {};
+	mh.msg_control = ctl;
+	mh.msg_controllen = sizeof(ctl);
+	if (recvmsg (fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+	    break;
+	uint64_t sw = 0, hw = 0;
+	bool snd = false;
+	stamps_from (mh, sw, hw, snd);
+	if (!snd)
+	    continue;
+	st.tx = std::max (st.tx, sw);
+	st.hw_tx = std::max (st.hw_tx, hw);
+    }
+}
+
+size_t call (int fd, void **obuf, const as_msg* msg, call_stamps& st)
+{
+    st = {};
+    st.send = realtime_ns ();
+    write (fd, msg);
+
+    // The header's recvmsg carries the RX stamp of its packet.
+    uint64_t hb;
+    alignas(cmsghdr) char ctl[256];
+    iovec iov = { &hb, 8 };
+    msghdr mh = {};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl;
+    mh.msg_controllen = sizeof(ctl);
+    auto n = recvmsg (fd, &mh, MSG_WAITALL);
+    st.recv = realtime_ns ();
+    if (n != 8)
+	return 0;
+    bool snd;
+    stamps_from (mh, st.rx, st.hw_rx, snd);
+    size_t sz = read_body (fd, (as_header *)&hb, obuf);
+    st.done = realtime_ns ();
+    drain_tx (fd, st);
+    return sz;
+}
+
+size_t call (int fd, as_msg **obuf, const as_msg* msg, call_stamps& st)
+{
+    return call (fd, (void **) obuf, msg, st);
+}
+
+size_t call (int fd, void **obuf, const std::string& str, uint64_t *dur)
 {
-    auto tp0 = std::chrono::high_resolution_clock::now ();
+    uint64_t t0 = dur ? now_ns () : 0;
     write (fd, str);
     if (dur) {
 	size_t sz{read (fd, obuf)};
-	auto tp1 = std::chrono::high_resolution_clock::now ();
-	*dur = (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(tp1 - tp0).count();
+	*dur = now_ns () - t0;
 	return sz;
     } else
 	return read (fd, obuf);
 }
 
-size_t call_info (int fd, std::string& obuf, const std::string& ibuf, uint32_t *dur)
+size_t call_info (int fd, std::string& obuf, const std::string& ibuf, uint64_t *dur)
 {
-    auto tp0 = std::chrono::high_resolution_clock::now ();
+    uint64_t t0 = dur ? now_ns () : 0;
     write (fd, ibuf);
     if (dur) {
 	size_t sz{read (fd, obuf)};
-	auto tp1 = std::chrono::high_resolution_clock::now ();
-	*dur = (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(tp1 - tp0).count();
+	*dur = now_ns () - t0;
 	return sz;
     } else
 	return read (fd, obuf);
 }
 
-std::string call_info (int fd, const std::string& str, uint32_t *dur)
+std::string call_info (int fd, const std::string& str, uint64_t *dur)
 {
     std::string ret;
     call_info (fd, ret, str, dur);
     // remove the trailing newline
-    ret.resize (ret.size () - 1);
+    if (!ret.empty ())
+	ret.pop_back ();
+    return ret;
+}
+
+std::map<std::string,std::string> call_info_batch (int fd, const std::vector<std::string>& names, uint64_t *dur)
+{
+    std::string req, resp;
+    for (const auto& n : names) {
+	req += n;
+	req += '\n';
+    }
+    std::map<std::string,std::string> ret;
+    if (!call_info (fd, resp, req, dur))
+	return ret;
+
+    // One "name\tvalue\n" line per name.
+    for (auto line : info_list (resp, '\n')) {
+	auto kv = info_split (line, '\t');
+	ret.emplace (kv.key, kv.value);
+    }
     return ret;
 }
 
@@ -512,3 +743,37 @@ std::string to_string (const as_cdt::map_op t)
     }
     return "unknown";
 }
+
+std::string to_string (const as_cdt::ctx_type t)
+{
+    switch (t)
+    {
+    case(as_cdt::ctx_type::exp):			return "exp";
+    case(as_cdt::ctx_type::list_index):		return "list_index";
+    case(as_cdt::ctx_type::list_rank):		return "list_rank";
+    case(as_cdt::ctx_type::list_value):		return "list_value";
+    case(as_cdt::ctx_type::map_index):		return "map_index";
+    case(as_cdt::ctx_type::map_rank):		return "map_rank";
+    case(as_cdt::ctx_type::map_key):		return "map_key";
+    case(as_cdt::ctx_type::map_value):		return "map_value";
+    }
+    return "unknown";
+}
+
+std::string to_string (const as_particle::type t)
+{
+    switch (t)
+    {
+    case(as_particle::type::t_null):		return "null";
+    case(as_particle::type::t_integer):		return "integer";
+    case(as_particle::type::t_float):		return "float";
+    case(as_particle::type::t_string):		return "string";
+    case(as_particle::type::t_blob):		return "blob";
+    case(as_particle::type::t_boolean):		return "boolean";
+    case(as_particle::type::t_hll):		return "hll";
+    case(as_particle::type::t_map):		return "map";
+    case(as_particle::type::t_list):		return "list";
+    case(as_particle::type::t_geojson):		return "geojson";
+    }
+    return "unknown";
+}
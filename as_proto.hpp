@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <string>
+#include <vector>
 #include <nlohmann/json.hpp>
+#include "tsc_clock.hpp"
 
 // Flags
 #define AS_MSG_FLAG_READ                   (1 << 0) // contains a read operation
@@ -459,11 +464,108 @@ size_t write (int fd, const as_msg* msg);
 size_t read (int fd, void **obuf);
 size_t read (int fd, std::string& str);
 
-size_t call (int fd, void **obuf, const as_msg* msg, uint32_t *dur = nullptr);
-size_t call (int fd, as_msg **obuf, const as_msg* msg, uint32_t *dur = nullptr);
-size_t call (int fd, void **obuf, const std::string& str, uint32_t *dur = nullptr);
-size_t call_info (int fd, std::string& obuf, const std::string& ibuf, uint32_t *dur = nullptr);
-std::string call_info (int fd, const std::string& str, uint32_t *dur = nullptr);
+// dur, when given, is the round trip in ns on now_ns () (tsc_clock.hpp).
+size_t call (int fd, void **obuf, const as_msg* msg, uint64_t *dur = nullptr);
+size_t call (int fd, as_msg **obuf, const as_msg* msg, uint64_t *dur = nullptr);
+size_t call (int fd, void **obuf, const std::string& str, uint64_t *dur = nullptr);
+size_t call_info (int fd, std::string& obuf, const std::string& ibuf, uint64_t *dur = nullptr);
+std::string call_info (int fd, const std::string& str, uint64_t *dur = nullptr);
+// Sends all names in one info request and returns name -> value as the
+// server echoes them; empty if the connection failed.
+std::map<std::string,std::string> call_info_batch (int fd, const std::vector<std::string>& names, uint64_t *dur = nullptr);
+
+// Kernel timestamps (SO_TIMESTAMPING) around one call, splitting its round
+// trip at the host's edges.  Times are CLOCK_REALTIME, the clock the
+// kernel stamps on, so user and kernel stamps share one timeline rather
+// than meet across two that drift apart; a step of the wall clock mid
+// call skews that call only, and never makes a phase wrap.  hw_* are the
+// NIC's own clock, only comparable with each other, and 0 unless the NIC
+// stamps packets (it must already have timestamping turned on, e.g. with
+// hwstamp_ctl).  Any stamp the kernel didn't deliver is 0.
+struct call_stamps
+{
+    uint64_t send = 0;		// before writev
+    uint64_t tx = 0;		// request's last byte handed to the device
+    uint64_t rx = 0;		// response's first packet received by the stack
+    uint64_t recv = 0;		// response header in user space
+    uint64_t done = 0;		// whole response read
+    uint64_t hw_tx = 0;
+    uint64_t hw_rx = 0;
+
+    uint64_t kernel_send (void) const	{ return (this->tx > this->send) ? this->tx - this->send : 0; }
+    // Wire and server, on the NIC's clock when both ends have hw stamps.
+    uint64_t wire (void) const
+    {
+	if (this->hw_tx && (this->hw_rx > this->hw_tx))
+	    return this->hw_rx - this->hw_tx;
+	return (this->tx && (this->rx > this->tx)) ? this->rx - this->tx : 0;
+    }
+    uint64_t kernel_recv (void) const	{ return (this->rx && (this->recv > this->rx)) ? this->recv - this->rx : 0; }
+    uint64_t read_body (void) const	{ return (this->done > this->recv) ? this->done - this->recv : 0; }
+    uint64_t total (void) const		{ return (this->done > this->send) ? this->done - this->send : 0; }
+};
+
+// Turns on software TX/RX stamps for fd, and hardware ones too if asked.
+bool timestamping_enable (int fd, bool hardware);
+// As call (), with kernel timestamps; fd must have timestamping enabled.
+size_t call (int fd, void **obuf, const as_msg* msg, call_stamps& st);
+size_t call (int fd, as_msg **obuf, const as_msg* msg, call_stamps& st);
+
+// Per-phase tracing of call () on as_msg requests, for finding where the
+// client's own time goes.  Off until call_trace_start (); while off, a call
+// pays one predicted branch, and building with AS_CALL_TRACE=0 removes even
+// that.  While on, each call leaves a call_trace in its thread's ring for a
+// reporter to drain, and calls slower than the threshold also queue both
+// messages whole.  Times are now_ns ().
+#ifndef AS_CALL_TRACE
+#define AS_CALL_TRACE 1
+#endif
+
+struct call_trace
+{
+    uint64_t encode = 0;	// call_trace_encode () before building it, or 0
+    uint64_t encoded = 0;	// call_trace_encoded () once built, or 0
+    uint64_t send = 0;		// call entered
+    uint64_t sent = 0;		// writev returned
+    uint64_t first = 0;		// response header read (its first segment)
+    uint64_t done = 0;		// whole response read
+};
+
+struct call_trace_slow
+{
+    call_trace t;
+    std::string req, res;	// the as_msg bytes, protocol header excluded
+};
+
+extern bool g_call_trace;
+extern thread_local uint64_t t_call_trace_encode, t_call_trace_encoded;
+
+inline bool call_trace_on (void)
+{
+    return AS_CALL_TRACE && __builtin_expect (g_call_trace, 0);
+}
+
+// Mark the start and end of encoding the calling thread's next request;
+// whatever the caller does between the end and call () shows separately.
+inline void call_trace_encode (void)
+{
+    if (call_trace_on ())
+	t_call_trace_encode = now_ns ();
+}
+inline void call_trace_encoded (void)
+{
+    if (call_trace_on ())
+	t_call_trace_encoded = now_ns ();
+}
+
+// Turns tracing on; call before the calling threads start.  Calls taking
+// over slow_ns from send to done keep their messages; 0 keeps none.
+void call_trace_start (uint64_t slow_ns = 0);
+// Hands every trace recorded since the last drain to f; returns how many
+// were lost to full rings meanwhile.  One reporter at a time.
+uint64_t call_trace_drain (const std::function<void (const call_trace&)>& f);
+// The slow calls queued since the last drain.
+std::vector<call_trace_slow> call_trace_slow_drain (void);
 
 std::string to_string (const as_field::type t);
 std::string to_string (const as_op::type t);
@@ -471,6 +573,8 @@ std::string to_string (const as_exp::op t);
 std::string to_string (const as_exp::result_type t);
 std::string to_string (const as_cdt::list_op t);
 std::string to_string (const as_cdt::map_op t);
+std::string to_string (const as_cdt::ctx_type t);
+std::string to_string (const as_particle::type t);
 
 // Expression helper functions
 namespace expr
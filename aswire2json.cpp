@@ -1,49 +1,319 @@
+// Decodes protocol frames to one JSON line each.
+//
+// Usage: ./aswire2json [key=value ...] < input	(ASWIRE2JSON_ prefix in the environment)
+//
+// FORMAT=hex (the default) reads one hex frame per line; raw reads a stream
+// of binary frames back to back; capture reads a tcp_proxy capture file and
+// adds each frame's ts, conn and dir.  The input is cut into batches that
+// THREADS workers decode in parallel; output keeps the input order.
+
 #include <algorithm>
 #include <endian.h>
 #include <atomic>
-#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <iomanip>
+#include <deque>
 #include <iostream>
+#include <map>
 #include <memory>
-#include <netdb.h>
-#include <signal.h>
-#include <sstream>
+#include <mutex>
 #include <stdexcept>
 #include <stdint.h>
-#include <numeric>
 #include <string>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/uio.h>
 #include <unistd.h>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <thread>
 #include <nlohmann/json.hpp>
 #include "as_proto.hpp"
+#include "capture.hpp"
+#include "config.hpp"
+#include "frame.hpp"
 #include "util.hpp"
 
 using json = nlohmann::json;
 using namespace std;
 
-int main (int argc, char **argv, char **envp)
+// Input bytes per batch; a batch is the unit of work and of ordering.
+static const size_t batch_bytes = 4 << 20;
+
+struct batch
+{
+  uint64_t seq;
+  string in;			// hex lines, or whole binary frames
+  size_t block;			// capture block index
+  string out;
+  string err;
+};
+
+// Bounded hand-off between the reader, the workers and the writer.  At most
+// `limit` batches exist at once, so memory stays flat for any input size.
+class pipeline
+{
+public:
+  pipeline (size_t limit) : limit (limit) {}
+
+  void submit (unique_ptr<batch> b)
+  {
+    unique_lock<mutex> lk (this->mtx);
+    this->cv_space.wait (lk, [this] { return this->live < this->limit; });
+    this->live++;
+    this->todo.push_back (std::move (b));
+    this->cv_todo.notify_one ();
+  }
+  void finish (void)
+  {
+    lock_guard<mutex> lg (this->mtx);
+    this->eof = true;
+    this->cv_todo.notify_all ();
+    this->cv_done.notify_all ();
+  }
+  // Worker side; nullptr once the input is exhausted.
+  unique_ptr<batch> take (void)
+  {
+    unique_lock<mutex> lk (this->mtx);
+    this->cv_todo.wait (lk, [this] { return !this->todo.empty () || this->eof; });
+    if (this->todo.empty ())
+      return nullptr;
+    auto b = std::move (this->todo.front ());
+    this->todo.pop_front ();
+    return b;
+  }
+  void complete (unique_ptr<batch> b)
+  {
+    lock_guard<mutex> lg (this->mtx);
+    auto seq = b->seq;
+    this->done.emplace (seq, std::move (b));
+    if (seq == this->next_out)
+      this->cv_done.notify_one ();
+  }
+  // Writer side: batches strictly in seq order, nullptr at the end.
+  unique_ptr<batch> next (void)
+  {
+    unique_lock<mutex> lk (this->mtx);
+    this->cv_done.wait (lk, [this] {
+      return this->done.count (this->next_out) || (this->eof && !this->live);
+    });
+    auto it = this->done.find (this->next_out);
+    if (it == this->done.end ())
+      return nullptr;
+    auto b = std::move (it->second);
+    this->done.erase (it);
+    this->next_out++;
+    this->live--;
+    this->cv_space.notify_one ();
+    return b;
+  }
+
+private:
+  mutex mtx;
+  condition_variable cv_space, cv_todo, cv_done;
+  deque<unique_ptr<batch>> todo;
+  map<uint64_t,unique_ptr<batch>> done;
+  size_t limit;
+  size_t live = 0;
+  uint64_t next_out = 0;
+  bool eof = false;
+};
+
+string g_format;
+string g_input;
+
+static void emit (string& out, const uint8_t *frame, size_t len, const cap_rec *rec = nullptr)
+{
+  to_json (out, (const as_msg *)(frame + sizeof(as_header)), len - sizeof(as_header));
+  if (rec) {
+    out.pop_back ();
+    out += ",\"ts\":" + to_string ((uint64_t)rec->ts_ns) + ",\"conn\":" + to_string ((uint64_t)rec->conn_id);
+    out += rec->dir ? ",\"dir\":\"s2c\"}" : ",\"dir\":\"c2s\"}";
+  }
+  out += '\n';
+}
+
+static bool decodable (const uint8_t *frame, size_t len)
+{
+  return (len >= sizeof(as_header) + sizeof(as_msg)) && (frame[1] == 3);
+}
+
+void decode_hex (batch& b)
 {
-  string hline;
-  while (getline (cin, hline) && !hline.empty ()) {
-	if (hline.size() % 2) {
-	  fprintf (stderr, "Invalid length: %d\n", hline.size());
-	  continue;
+  vector<uint8_t> buf;
+  size_t pos = 0;
+  while (pos < b.in.size ()) {
+    size_t eol = b.in.find ('\n', pos);
+    if (eol == string::npos)
+      eol = b.in.size ();
+    size_t end = eol;
+    while ((end > pos) && isspace ((unsigned char)b.in[end - 1]))
+      end--;
+    size_t len = end - pos;
+    if (len) {
+      if (len % 2) {
+	b.err += "Invalid length: " + to_string (len) + "\n";
+      } else {
+	buf.resize (len / 2);
+	from_hex (buf.data (), b.in.data () + pos, buf.size ());
+	if (decodable (buf.data (), buf.size ()))
+	  emit (b.out, buf.data (), buf.size ());
+	else
+	  b.err += "Not a message frame: " + b.in.substr (pos, min<size_t> (len, 16)) + "\n";
+      }
+    }
+    pos = eol + 1;
+  }
+}
+
+void decode_raw (batch& b)
+{
+  auto p = (const uint8_t *)b.in.data (), end = p + b.in.size ();
+  while (p < end) {
+    size_t len = sizeof(as_header) + ((const as_header *)p)->size ();
+    if (decodable (p, len))
+      emit (b.out, p, len);
+    p += len;
+  }
+}
+
+void decode_capture (batch& b)
+{
+  // Each worker reads and inflates its own blocks.
+  thread_local unique_ptr<capture_reader> cr;
+  if (!cr)
+    cr.reset (new capture_reader (g_input));
+  vector<uint8_t> raw;
+  if (!cr->read_block (b.block, raw)) {
+    b.err = "block " + to_string (b.block) + ": unreadable\n";
+    return;
+  }
+  for (size_t pos = 0; pos + sizeof(cap_rec) <= raw.size (); ) {
+    cap_rec rec;
+    memcpy (&rec, raw.data () + pos, sizeof(rec));
+    pos += sizeof(rec);
+    if (pos + rec.len > raw.size ())
+      break;
+    if (decodable (raw.data () + pos, rec.len))
+      emit (b.out, raw.data () + pos, rec.len, &rec);
+    pos += rec.len;
+  }
+}
+
+// Cuts the input into batches.  Hex batches end on a line boundary; raw
+// batches hold whole frames only.
+void read_input (pipeline& pl, FILE *fp)
+{
+  uint64_t seq = 0;
+  auto next_batch = [&]() {
+    auto b = make_unique<batch> ();
+    b->seq = seq++;
+    return b;
+  };
+
+  if (g_format == "capture") {
+    capture_reader cr (g_input);
+    if (!cr.complete ())
+      fprintf (stderr, "%s: no index, capture was cut short\n", g_input.c_str ());
+    for (size_t ii = 0; ii < cr.blocks ().size (); ii++) {
+      auto b = next_batch ();
+      b->block = ii;
+      pl.submit (std::move (b));
+    }
+    return;
+  }
+
+  vector<char> chunk (batch_bytes);
+  auto b = next_batch ();
+  if (g_format == "hex") {
+    size_t n;
+    while ((n = fread (chunk.data (), 1, chunk.size (), fp)) > 0) {
+      b->in.append (chunk.data (), n);
+      size_t eol = b->in.rfind ('\n');
+      if ((b->in.size () < batch_bytes) || (eol == string::npos))
+	continue;
+      auto nb = next_batch ();
+      nb->in.assign (b->in, eol + 1);
+      b->in.resize (eol + 1);
+      pl.submit (std::move (b));
+      b = std::move (nb);
+    }
+  } else {
+    frame_reassembler fr;
+    size_t n;
+    while ((n = fread (chunk.data (), 1, chunk.size (), fp)) > 0) {
+      bool ok = fr.feed ((const uint8_t *)chunk.data (), n, [&](const uint8_t *f, size_t len) {
+	b->in.append ((const char *)f, len);
+	if (b->in.size () >= batch_bytes) {
+	  pl.submit (std::move (b));
+	  b = next_batch ();
 	}
-	auto sz = hline.size() / 2;
-	vector<uint8_t> buf(sz, 0);
-	from_hex(buf.data(), hline.c_str(), sz);
-	printf ("%s\n", to_json((as_msg*)(buf.data() + 8)).dump().c_str());
+      });
+      if (!ok) {
+	fprintf (stderr, "%s after %lu frames, stopping\n", fr.error_str (), fr.frames ());
+	break;
+      }
+    }
+    if (fr.pending ())
+      fprintf (stderr, "%lu trailing bytes of a partial frame\n", fr.pending ());
+  }
+  if (!b->in.empty ())
+    pl.submit (std::move (b));
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  using t = config_opt::type;
+  config cfg ("ASWIRE2JSON_", {
+    { "FORMAT",		t::t_string,	"hex",	"input: hex lines, raw binary frames or a capture file", 0, 0, { "hex", "raw", "capture" } },
+    { "INPUT",		t::t_string,	"-",	"input path, - for stdin" },
+    { "THREADS",	t::t_int,	"0",	"decode workers, 0 for one per online core", 0, 1024 },
+  });
+  config_load_or_die (cfg, argc, argv, envp);
+  g_format = cfg.s ("FORMAT");
+  g_input = cfg.s ("INPUT");
+  int nthreads = cfg.i ("THREADS");
+  if (!nthreads)
+    nthreads = max (1u, thread::hardware_concurrency ());
+
+  FILE *fp = stdin;
+  if (g_format == "capture") {
+    try {
+      capture_reader probe (g_input);
+    } catch (const exception& e) {
+      fprintf (stderr, "%s\n", e.what ());
+      return 1;
+    }
+  } else if ((g_input != "-") && !(fp = fopen (g_input.c_str (), "rb"))) {
+    fprintf (stderr, "%s: %s\n", g_input.c_str (), strerror (errno));
+    return 1;
+  }
+
+  pipeline pl (4 * nthreads);
+  vector<thread> workers;
+  for (int ii = 0; ii < nthreads; ii++)
+    workers.emplace_back ([&pl] {
+      while (auto b = pl.take ()) {
+	if (g_format == "hex")		decode_hex (*b);
+	else if (g_format == "raw")	decode_raw (*b);
+	else				decode_capture (*b);
+	b->in = string ();
+	pl.complete (std::move (b));
+      }
+    });
+  thread reader ([&] {
+    read_input (pl, fp);
+    pl.finish ();
+  });
+
+  while (auto b = pl.next ()) {
+    if (!b->err.empty ())
+      fputs (b->err.c_str (), stderr);
+    fwrite (b->out.data (), 1, b->out.size (), stdout);
   }
 
+  reader.join ();
+  for (auto& th : workers)
+    th.join ();
+  if (fp != stdin)
+    fclose (fp);
   return 0;
 }
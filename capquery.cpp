@@ -0,0 +1,256 @@
+// Queries a tcp_proxy capture through its sidecar index.
+//
+// Usage: ./capquery CAPTURE=path [key=value ...]	(CAPQUERY_ prefix in the environment)
+//
+// The index (INDEX, CAPTURE.qidx by default) is built on first use, and
+// rebuilt when the capture has changed size or REINDEX=1.  Building reads
+// every block once with THREADS workers; queries then touch only the chunk
+// summaries and the requests of chunks that can match.
+//
+// Filters combine with AND: FROM/TO (epoch seconds), CONN, DIGEST (hex),
+// OPS and CLASSES (comma lists, any of), MIN_US and RC.  Each match is one
+// JSON line with the request's ts, conn, class, ops, rc and latency_us
+// (null when no response was captured); DECODE=1 adds the decoded request
+// frame, read back from the capture.  Output is in index order, which is
+// time order within a chunk and close to it across chunks.
+//
+// Examples:
+//   ./capquery CAPTURE=cap.bin DIGEST=0a1b...	every request on a record
+//   ./capquery CAPTURE=cap.bin MIN_US=5000 FROM=1760000000 TO=1760000060
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include "as_proto.hpp"
+#include "capture.hpp"
+#include "capture_index.hpp"
+#include "config.hpp"
+#include "proxy_stats.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+static vector<string> split_list (const string& str)
+{
+  vector<string> ret;
+  size_t pos = 0;
+  while (pos < str.size ()) {
+    size_t cp = str.find (',', pos);
+    if (cp == string::npos)
+      cp = str.size ();
+    if (cp > pos)
+      ret.push_back (str.substr (pos, cp - pos));
+    pos = cp + 1;
+  }
+  return ret;
+}
+
+// Builds the query from the config; false with err set on a bad filter.
+static bool load_query (const config& cfg, capx_query& q, string& err)
+{
+  if (cfg.f ("FROM") > 0)
+    q.from_ns = (uint64_t)(cfg.f ("FROM") * 1e9);
+  if (cfg.f ("TO") > 0)
+    q.to_ns = (uint64_t)(cfg.f ("TO") * 1e9);
+  if (cfg.i ("CONN") >= 0) {
+    q.any_conn = false;
+    q.conn_id = cfg.i ("CONN");
+  }
+  q.min_latency_us = cfg.i ("MIN_US");
+  q.rc = cfg.i ("RC");
+
+  for (const auto& name : split_list (cfg.s ("OPS"))) {
+    int ii;
+    for (ii = 0; ii < 32; ii++)
+      if (to_string ((as_op::type)ii) == name)
+	break;
+    if (ii == 32) {
+      err = "OPS: unknown op type '" + name + "'";
+      return false;
+    }
+    q.op_mask |= 1u << ii;
+  }
+  for (const auto& name : split_list (cfg.s ("CLASSES"))) {
+    size_t ii;
+    for (ii = 0; ii < (size_t)req_class::n; ii++)
+      if (name == to_string ((req_class)ii))
+	break;
+    if (ii == (size_t)req_class::n) {
+      err = "CLASSES: unknown class '" + name + "'";
+      return false;
+    }
+    q.cls_mask |= 1u << ii;
+  }
+  auto hex = cfg.s ("DIGEST");
+  if (!hex.empty ()) {
+    if ((hex.size () != 40) || (hex.find_first_not_of ("0123456789abcdefABCDEF") != string::npos)) {
+      err = "DIGEST: '" + hex + "' is not a 40 digit hex digest";
+      return false;
+    }
+    from_hex (q.digest, hex.data (), sizeof(q.digest));
+    q.has_digest = true;
+  }
+  return true;
+}
+
+// Request frames for DECODE, with a few inflated blocks kept around since
+// neighbouring matches tend to share them.
+class frame_source
+{
+public:
+  frame_source (const string& path) : cr (path) {}
+
+  const uint8_t* frame (const capx_req& r, uint32_t& len)
+  {
+    auto it = this->cache.find (r.block);
+    if (it == this->cache.end ()) {
+      if (this->cache.size () >= 16) {
+	this->cache.erase (this->order.front ());
+	this->order.erase (this->order.begin ());
+      }
+      vector<uint8_t> raw;
+      if (!this->cr.read_block (r.block, raw))
+	return nullptr;
+      it = this->cache.emplace (r.block, std::move (raw)).first;
+      this->order.push_back (r.block);
+    }
+    const auto& raw = it->second;
+    cap_rec rec;
+    if (r.offset + sizeof(rec) > raw.size ())
+      return nullptr;
+    memcpy (&rec, raw.data () + r.offset, sizeof(rec));
+    if ((r.offset + sizeof(rec) + rec.len > raw.size ()) || (rec.len < sizeof(as_header) + sizeof(as_msg)))
+      return nullptr;
+    len = rec.len;
+    return raw.data () + r.offset + sizeof(rec);
+  }
+
+private:
+  capture_reader cr;
+  map<uint32_t,vector<uint8_t>> cache;
+  vector<uint32_t> order;
+};
+
+static void emit (string& out, const capx_req& r, frame_source *fs)
+{
+  out += "{\"ts\":" + to_string (r.ts_ns) + ",\"conn\":" + to_string (r.conn_id);
+  out += ",\"class\":\"";
+  out += to_string ((req_class)r.cls);
+  out += "\",\"ops\":[";
+  for (uint32_t m = r.op_mask; m; m &= m - 1) {
+    out += '"';
+    out += to_string ((as_op::type)__builtin_ctz (m));
+    out += (m & (m - 1)) ? "\"," : "\"";
+  }
+  out += "],\"rc\":" + to_string (r.rc) + ",\"latency_us\":";
+  out += (r.latency_us == CAPX_NO_RESPONSE) ? string ("null") : to_string (r.latency_us);
+  if (r.flags & CAPX_HAS_DIGEST) {
+    char hex[41] = {};
+    to_hex (hex, r.digest, sizeof(r.digest));
+    out += ",\"digest\":\"";
+    out += hex;
+    out += '"';
+  }
+  uint32_t len;
+  const uint8_t *f;
+  if (fs && (f = fs->frame (r, len)) && (f[1] == 3)) {
+    out += ",\"request\":";
+    to_json (out, (const as_msg *)(f + sizeof(as_header)), len - sizeof(as_header));
+  }
+  out += "}\n";
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  using t = config_opt::type;
+  config cfg ("CAPQUERY_", {
+    { "CAPTURE",	t::t_string,	"",	"capture file written by tcp_proxy CAPTURE=" },
+    { "CLASSES",	t::t_string,	"",	"only these request classes, e.g. read,batch" },
+    { "CONN",		t::t_int,	"-1",	"only this connection id, -1 for all", -1, CONFIG_INT_MAX },
+    { "DECODE",		t::t_bool,	"false", "add each matching request frame as json" },
+    { "DIGEST",		t::t_string,	"",	"only requests for this hex digest" },
+    { "FROM",		t::t_float,	"0",	"only requests at or after this epoch time in seconds, 0 for the start", 0 },
+    { "INDEX",		t::t_string,	"",	"index path, CAPTURE.qidx when empty" },
+    { "LIMIT",		t::t_int,	"0",	"stop after this many matches, 0 for all", 0, CONFIG_INT_MAX },
+    { "MIN_US",		t::t_int,	"0",	"only requests at least this slow; unanswered ones always qualify", 0, UINT32_MAX - 1.0 },
+    { "OPS",		t::t_string,	"",	"only requests with any of these op types, e.g. read,cdt_modify" },
+    { "RC",		t::t_int,	"-1",	"only responses with this result code, -1 for all", -1, 255 },
+    { "REINDEX",	t::t_bool,	"false", "rebuild the index even if it is current" },
+    { "THREADS",	t::t_int,	"0",	"index and scan workers, 0 for one per online core", 0, 1024 },
+    { "TO",		t::t_float,	"0",	"only requests at or before this epoch time in seconds, 0 for the end", 0 },
+  });
+  config_load_or_die (cfg, argc, argv, envp);
+  string capture = cfg.s ("CAPTURE");
+  string path = cfg.s ("INDEX").empty () ? capture + ".qidx" : cfg.s ("INDEX");
+  unsigned nthreads = cfg.i ("THREADS");
+  if (!nthreads)
+    nthreads = max (1u, thread::hardware_concurrency ());
+  if (capture.empty ()) {
+    fprintf (stderr, "CAPTURE is required\n");
+    cfg.usage (stderr, argv[0]);
+    return 1;
+  }
+  capx_query q;
+  string err;
+  if (!load_query (cfg, q, err)) {
+    fprintf (stderr, "%s\n", err.c_str ());
+    return 1;
+  }
+
+  auto t0 = chrono::steady_clock::now ();
+  auto secs = [&t0]() { return chrono::duration<double> (chrono::steady_clock::now () - t0).count (); };
+  unique_ptr<capx_index> idx;
+  try {
+    struct stat st;
+    if (stat (capture.c_str (), &st))
+      throw runtime_error ("cannot stat '" + capture + "'");
+    if (!cfg.b ("REINDEX")) {
+      try {
+	idx.reset (new capx_index (path));
+	if (idx->hdr ().capture_size != (uint64_t)st.st_size) {
+	  fprintf (stderr, "%s: stale, capture has changed\n", path.c_str ());
+	  idx.reset ();
+	}
+      } catch (const exception&) {}
+    }
+    if (!idx) {
+      auto bs = capx_build (capture, path, nthreads);
+      fprintf (stderr, "indexed %lu frames: %lu requests, %lu unanswered, %lu orphan responses in %.3fs\n",
+	       bs.frames, bs.reqs, bs.unanswered, bs.orphans, secs ());
+      idx.reset (new capx_index (path));
+    }
+  } catch (const exception& e) {
+    fprintf (stderr, "%s\n", e.what ());
+    return 1;
+  }
+
+  unique_ptr<frame_source> fs;
+  if (cfg.b ("DECODE"))
+    fs.reset (new frame_source (capture));
+  uint64_t limit = cfg.i ("LIMIT"), n = 0;
+  string out;
+  auto t1 = chrono::steady_clock::now ();
+  auto ss = idx->scan (q, nthreads, [&](const capx_req& r) {
+    emit (out, r, fs.get ());
+    if (out.size () >= (1 << 16)) {
+      fwrite (out.data (), 1, out.size (), stdout);
+      out.clear ();
+    }
+    return !limit || (++n < limit);
+  });
+  fwrite (out.data (), 1, out.size (), stdout);
+  fflush (stdout);
+  fprintf (stderr, "%lu requests in %lu chunks; %lu chunks in range, %lu scanned, %lu matches in %.3fs\n",
+	   idx->hdr ().nreqs, idx->hdr ().nchunks, ss.chunks, ss.scanned, ss.matches,
+	   chrono::duration<double> (chrono::steady_clock::now () - t1).count ());
+  return 0;
+}
@@ -0,0 +1,241 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <zlib.h>
+
+cap_ring::cap_ring (size_t bytes)
+{
+    size_t cap = 4096;
+    while (cap < bytes)	cap <<= 1;
+    this->buf.resize (cap);
+    this->mask = cap - 1;
+}
+
+void cap_ring::copy_in (uint64_t pos, const void *src, size_t n)
+{
+    size_t off = pos & this->mask, first = std::min (n, this->buf.size () - off);
+    memcpy (this->buf.data () + off, src, first);
+    memcpy (this->buf.data (), (const uint8_t *)src + first, n - first);
+}
+
+void cap_ring::copy_out (uint64_t pos, void *dst, size_t n) const
+{
+    size_t off = pos & this->mask, first = std::min (n, this->buf.size () - off);
+    memcpy (dst, this->buf.data () + off, first);
+    memcpy ((uint8_t *)dst + first, this->buf.data (), n - first);
+}
+
+bool cap_ring::push (uint64_t ts_ns, uint64_t conn_id, uint8_t dir, const uint8_t *data, uint32_t len)
+{
+    uint64_t t = this->tail.load (std::memory_order_relaxed);
+    uint64_t h = this->head.load (std::memory_order_acquire);
+    size_t need = sizeof(cap_rec) + len;
+    if (need > this->buf.size () - (t - h)) {
+	this->ndropped.fetch_add (1, std::memory_order_relaxed);
+	return false;
+    }
+    cap_rec rec = {};
+    rec.ts_ns = ts_ns;
+    rec.conn_id = conn_id;
+    rec.len = len;
+    rec.dir = dir;
+    this->copy_in (t, &rec, sizeof(rec));
+    this->copy_in (t + sizeof(rec), data, len);
+    this->tail.store (t + need, std::memory_order_release);
+    return true;
+}
+
+bool cap_ring::pop (std::vector<uint8_t>& out, cap_rec& rec)
+{
+    uint64_t h = this->head.load (std::memory_order_relaxed);
+    uint64_t t = this->tail.load (std::memory_order_acquire);
+    if (h == t)	return false;
+    this->copy_out (h, &rec, sizeof(rec));
+    size_t need = sizeof(rec) + rec.len, old = out.size ();
+    out.resize (old + need);
+    this->copy_out (h, out.data () + old, need);
+    this->head.store (h + need, std::memory_order_release);
+    return true;
+}
+
+capture_writer::capture_writer (const std::string& path, size_t nrings, size_t ring_bytes, bool zlib, size_t block_size) :
+    zlib (zlib),
+    block_size (block_size)
+{
+    if (!(this->fp = fopen (path.c_str (), "w")))
+	throw std::runtime_error ("cannot open capture file '" + path + "'");
+    cap_file_hdr fh = {};
+    memcpy (fh.magic, CAP_MAGIC, sizeof(fh.magic));
+    fh.version = 1;
+    fh.flags = zlib ? CAP_BLOCK_ZLIB : 0;
+    fwrite (&fh, sizeof(fh), 1, this->fp);
+    this->offset = sizeof(fh);
+    for (size_t ii = 0; ii < nrings; ii++)
+	this->rings.emplace_back (new cap_ring (ring_bytes));
+    this->raw.reserve (block_size + 65536);
+    this->th = std::thread (&capture_writer::run, this);
+}
+
+capture_writer::~capture_writer ()
+{
+    this->close ();
+}
+
+void capture_writer::run (void)
+{
+    auto cut = std::chrono::steady_clock::now () + std::chrono::seconds (1);
+    // One last pass after running drops, so nothing pushed before close() is lost.
+    for (bool last = false; !last; ) {
+	last = !this->running.load ();
+	bool any = false;
+	for (auto& r : this->rings) {
+	    cap_rec rec;
+	    while (r->pop (this->raw, rec)) {
+		any = true;
+		if (!this->cur.nframes || rec.ts_ns < this->cur.first_ts)	this->cur.first_ts = rec.ts_ns;
+		this->cur.last_ts = std::max (this->cur.last_ts, rec.ts_ns);
+		this->cur.nframes++;
+		if (this->raw.size () >= this->block_size) {
+		    this->write_block ();
+		    cut = std::chrono::steady_clock::now () + std::chrono::seconds (1);
+		}
+	    }
+	}
+	if (!any && std::chrono::steady_clock::now () >= cut) {
+	    this->write_block ();
+	    cut = std::chrono::steady_clock::now () + std::chrono::seconds (1);
+	}
+	if (!any && !last)	usleep (1000);
+    }
+    this->write_block ();
+}
+
+void capture_writer::write_block (void)
+{
+    if (this->raw.empty ())	return;
+    this->cur.raw_len = this->raw.size ();
+    this->cur.stored_len = this->raw.size ();
+    this->cur.flags = 0;
+    const uint8_t *data = this->raw.data ();
+    if (this->zlib) {
+	uLongf zlen = compressBound (this->raw.size ());
+	this->packed.resize (zlen);
+	// Level 1: the writer has to keep up with line rate.
+	if ((compress2 (this->packed.data (), &zlen, this->raw.data (), this->raw.size (), 1) == Z_OK) && (zlen < this->raw.size ())) {
+	    this->cur.stored_len = zlen;
+	    this->cur.flags = CAP_BLOCK_ZLIB;
+	    data = this->packed.data ();
+	}
+    }
+    fwrite (&this->cur, sizeof(this->cur), 1, this->fp);
+    fwrite (data, this->cur.stored_len, 1, this->fp);
+    fflush (this->fp);
+    this->index.push_back ({ this->offset, this->cur.first_ts, this->cur.last_ts, this->cur.nframes, this->cur.stored_len });
+    this->offset += sizeof(this->cur) + this->cur.stored_len;
+    this->nframes += this->cur.nframes;
+    this->raw.clear ();
+    this->cur = {};
+}
+
+void capture_writer::close (void)
+{
+    if (!this->fp)	return;
+    this->running.store (false);
+    this->th.join ();
+
+    cap_trailer tr = {};
+    tr.index_offset = this->offset;
+    tr.nblocks = this->index.size ();
+    tr.nframes = this->nframes;
+    for (auto& r : this->rings)	tr.dropped += r->dropped ();
+    memcpy (tr.magic, CAP_IDX_MAGIC, sizeof(tr.magic));
+    fwrite (this->index.data (), sizeof(cap_index_entry), this->index.size (), this->fp);
+    fwrite (&tr, sizeof(tr), 1, this->fp);
+    fclose (this->fp);
+    this->fp = nullptr;
+}
+
+capture_reader::capture_reader (const std::string& path)
+{
+    cap_file_hdr fh;
+    if (!(this->fp = fopen (path.c_str (), "r")))
+	throw std::runtime_error ("cannot open capture file '" + path + "'");
+    if ((fread (&fh, sizeof(fh), 1, this->fp) != 1) || memcmp (fh.magic, CAP_MAGIC, sizeof(fh.magic)) || (fh.version != 1)) {
+	fclose (this->fp);
+	throw std::runtime_error ("'" + path + "' is not a capture file");
+    }
+
+    if ((fseeko (this->fp, -(off_t)sizeof(cap_trailer), SEEK_END) == 0) &&
+	(fread (&this->trailer, sizeof(cap_trailer), 1, this->fp) == 1) &&
+	!memcmp (this->trailer.magic, CAP_IDX_MAGIC, sizeof(this->trailer.magic))) {
+	this->index.resize (this->trailer.nblocks);
+	fseeko (this->fp, this->trailer.index_offset, SEEK_SET);
+	this->has_trailer = fread (this->index.data (), sizeof(cap_index_entry), this->index.size (), this->fp) == this->index.size ();
+    }
+    if (!this->has_trailer) {
+	this->trailer = {};
+	this->scan ();
+    }
+}
+
+capture_reader::~capture_reader ()
+{
+    if (this->fp)	fclose (this->fp);
+}
+
+void capture_reader::scan (void)
+{
+    // Walk block headers up to the first short block.
+    this->index.clear ();
+    fseeko (this->fp, 0, SEEK_END);
+    uint64_t end = ftello (this->fp), off = sizeof(cap_file_hdr);
+    cap_block_hdr bh;
+    while ((off + sizeof(bh) <= end) && !fseeko (this->fp, off, SEEK_SET) && (fread (&bh, sizeof(bh), 1, this->fp) == 1)) {
+	if (off + sizeof(bh) + bh.stored_len > end)	break;
+	this->index.push_back ({ off, bh.first_ts, bh.last_ts, bh.nframes, bh.stored_len });
+	this->trailer.nframes += bh.nframes;
+	off += sizeof(bh) + bh.stored_len;
+    }
+    this->trailer.nblocks = this->index.size ();
+}
+
+bool capture_reader::read_block (size_t ii, std::vector<uint8_t>& out)
+{
+    cap_block_hdr bh;
+    if ((ii >= this->index.size ()) || fseeko (this->fp, this->index[ii].offset, SEEK_SET) ||
+	(fread (&bh, sizeof(bh), 1, this->fp) != 1))
+	return false;
+    std::vector<uint8_t> stored (bh.stored_len);
+    if (fread (stored.data (), 1, stored.size (), this->fp) != stored.size ())
+	return false;
+    if (!(bh.flags & CAP_BLOCK_ZLIB)) {
+	out.swap (stored);
+	return true;
+    }
+    out.resize (bh.raw_len);
+    uLongf rlen = bh.raw_len;
+    return (uncompress (out.data (), &rlen, stored.data (), stored.size ()) == Z_OK) && (rlen == bh.raw_len);
+}
+
+bool capture_reader::next (cap_frame& f)
+{
+    while (this->pos + sizeof(cap_rec) > this->block.size ()) {
+	if (!this->read_block (this->cur_block++, this->block))
+	    return false;
+	this->pos = 0;
+    }
+    cap_rec rec;
+    memcpy (&rec, this->block.data () + this->pos, sizeof(rec));
+    if (this->pos + sizeof(rec) + rec.len > this->block.size ())
+	return false;
+    f.ts_ns = rec.ts_ns;
+    f.conn_id = rec.conn_id;
+    f.dir = rec.dir;
+    f.len = rec.len;
+    f.data = this->block.data () + this->pos + sizeof(rec);
+    this->pos += sizeof(rec) + rec.len;
+    return true;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Binary capture of proxied protocol frames.
+//
+// File layout (little-endian, as written by the host):
+//   cap_file_hdr
+//   blocks: cap_block_hdr, then stored_len bytes holding raw_len bytes of
+//           records (zlib-compressed when the block says so)
+//   index:  one cap_index_entry per block
+//   cap_trailer
+// A record is cap_rec followed by len frame bytes, header included.
+//
+// Frames from different rings interleave per block, so records are in time
+// order within a connection and direction, not across the whole file.  A
+// file without a trailer (writer killed) is still readable by scanning.
+
+#define CAP_MAGIC	"ASCAP\0\0\1"
+#define CAP_IDX_MAGIC	"ASCAPIDX"
+
+struct cap_file_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+} __attribute__((__packed__));
+
+struct cap_block_hdr
+{
+    uint32_t raw_len;
+    uint32_t stored_len;
+    uint32_t nframes;
+    uint32_t flags;		// CAP_BLOCK_ZLIB
+    uint64_t first_ts;
+    uint64_t last_ts;
+} __attribute__((__packed__));
+#define CAP_BLOCK_ZLIB	1
+
+struct cap_rec
+{
+    uint64_t ts_ns;		// CLOCK_REALTIME
+    uint64_t conn_id;
+    uint32_t len;
+    uint8_t dir;		// 0 client -> server, 1 server -> client
+    uint8_t _res[3];
+} __attribute__((__packed__));
+
+struct cap_index_entry
+{
+    uint64_t offset;		// of the cap_block_hdr
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint32_t nframes;
+    uint32_t stored_len;
+} __attribute__((__packed__));
+
+struct cap_trailer
+{
+    uint64_t index_offset;
+    uint64_t nblocks;
+    uint64_t nframes;
+    uint64_t dropped;
+    char magic[8];
+} __attribute__((__packed__));
+
+// Single-producer single-consumer byte ring of cap_rec + payload records.
+// push() never blocks: a record that does not fit is dropped and counted.
+class cap_ring
+{
+public:
+    explicit cap_ring (size_t bytes);
+    bool push (uint64_t ts_ns, uint64_t conn_id, uint8_t dir, const uint8_t *data, uint32_t len);
+    // Appends one record (cap_rec + payload) to out; false if the ring is empty.
+    bool pop (std::vector<uint8_t>& out, cap_rec& rec);
+    uint64_t dropped (void) const	{ return this->ndropped.load (std::memory_order_relaxed); }
+
+private:
+    void copy_in (uint64_t pos, const void *src, size_t n);
+    void copy_out (uint64_t pos, void *dst, size_t n) const;
+
+    std::vector<uint8_t> buf;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> head{0};	// consumer
+    alignas(64) std::atomic<uint64_t> tail{0};	// producer
+    std::atomic<uint64_t> ndropped{0};
+};
+
+// Drains a set of rings (one per producer thread) into a capture file from
+// a dedicated thread, cutting a block every block_size raw bytes or once a
+// second, whichever comes first.
+class capture_writer
+{
+public:
+    capture_writer (const std::string& path, size_t nrings, size_t ring_bytes, bool zlib, size_t block_size = 1 << 20);
+    ~capture_writer ();
+    cap_ring& ring (size_t ii)	{ return *this->rings[ii]; }
+    // Stops the thread, writes the last block, the index and the trailer.
+    void close (void);
+
+private:
+    void run (void);
+    void write_block (void);
+
+    FILE *fp = nullptr;
+    bool zlib;
+    size_t block_size;
+    std::vector<std::unique_ptr<cap_ring>> rings;
+    std::vector<uint8_t> raw, packed;
+    cap_block_hdr cur = {};
+    std::vector<cap_index_entry> index;
+    uint64_t nframes = 0;
+    uint64_t offset = 0;
+    std::atomic<bool> running{true};
+    std::thread th;
+};
+
+// One decoded record; data points into the reader's block buffer and stays
+// valid until the next call to next().
+struct cap_frame
+{
+    uint64_t ts_ns;
+    uint64_t conn_id;
+    uint8_t dir;
+    const uint8_t *data;
+    uint32_t len;
+};
+
+class capture_reader
+{
+public:
+    // Throws std::runtime_error if path is not a capture file.
+    explicit capture_reader (const std::string& path);
+    ~capture_reader ();
+    bool next (cap_frame& f);
+    // Blocks from the index, or from a scan when the trailer is missing.
+    const std::vector<cap_index_entry>& blocks (void) const	{ return this->index; }
+    // Decodes block ii into out (cap_rec + payload records).
+    bool read_block (size_t ii, std::vector<uint8_t>& out);
+    bool complete (void) const	{ return this->has_trailer; }
+    uint64_t dropped (void) const	{ return this->trailer.dropped; }
+
+private:
+    void scan (void);
+
+    FILE *fp = nullptr;
+    std::vector<cap_index_entry> index;
+    cap_trailer trailer = {};
+    bool has_trailer = false;
+    size_t cur_block = 0;
+    std::vector<uint8_t> block;
+    size_t pos = 0;
+};
@@ -0,0 +1,433 @@
+#include "capture_index.hpp"
+#include "as_proto.hpp"
+#include "capture.hpp"
+#include "proxy_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Runs work (worker, ii) for every ii in [first, last) on nthreads threads
+// and hands the results to emit on the calling thread in ii order.  At most
+// window results exist at once; emit returning false stops early.
+template <typename T, typename W, typename E>
+static void ordered_parallel (uint64_t first, uint64_t last, unsigned nthreads, size_t window, const W& work, const E& emit)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<T> res (window);
+    std::vector<char> done (window);
+    uint64_t next = first, emitted = first;
+    bool stop = false;
+
+    std::vector<std::thread> th;
+    for (unsigned w = 0; w < std::max (1u, nthreads); w++)
+	th.emplace_back ([&, w] {
+	    for (;;) {
+		uint64_t ii;
+		{
+		    std::unique_lock<std::mutex> lk (mtx);
+		    cv.wait (lk, [&] { return stop || (next >= last) || (next < emitted + window); });
+		    if (stop || (next >= last))	return;
+		    ii = next++;
+		}
+		T out = work (w, ii);
+		{
+		    std::lock_guard<std::mutex> lg (mtx);
+		    res[ii % window] = std::move (out);
+		    done[ii % window] = 1;
+		}
+		cv.notify_all ();
+	    }
+	});
+
+    for (uint64_t ii = first; (ii < last) && !stop; ii++) {
+	T out;
+	{
+	    std::unique_lock<std::mutex> lk (mtx);
+	    cv.wait (lk, [&] { return done[ii % window]; });
+	    out = std::move (res[ii % window]);
+	    done[ii % window] = 0;
+	    emitted = ii + 1;
+	}
+	cv.notify_all ();
+	if (!emit (out)) {
+	    std::lock_guard<std::mutex> lg (mtx);
+	    stop = true;
+	}
+    }
+    {
+	std::lock_guard<std::mutex> lg (mtx);
+	stop = true;
+    }
+    cv.notify_all ();
+    for (auto& t : th)	t.join ();
+}
+
+static bool bloom_test (const uint8_t *bloom, const uint8_t *digest)
+{
+    // Digests are uniform already; three 16 bit slices make the hashes.
+    for (int ii = 0; ii < 3; ii++) {
+	unsigned bit = digest[2 * ii] | (digest[2 * ii + 1] << 8);
+	if (!(bloom[bit >> 3] & (1 << (bit & 7))))	return false;
+    }
+    return true;
+}
+
+static void bloom_set (uint8_t *bloom, const uint8_t *digest)
+{
+    for (int ii = 0; ii < 3; ii++) {
+	unsigned bit = digest[2 * ii] | (digest[2 * ii + 1] << 8);
+	bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+namespace {
+
+struct frame_ent
+{
+    uint64_t ts_ns;
+    uint64_t conn_id;
+    uint32_t offset;
+    uint8_t dir;
+    bool last;
+    int16_t rc;
+    pending_req req;		// client -> server only
+};
+
+struct block_ents
+{
+    bool ok = false;
+    std::vector<frame_ent> ents;
+};
+
+struct pend
+{
+    pending_req req;
+    uint32_t block;
+    uint32_t offset;
+};
+
+// Cuts requests into chunks; requests go straight to the index file, chunk
+// summaries to a temporary until the tail minimums are known.
+class chunk_writer
+{
+public:
+    chunk_writer (FILE *fp, FILE *ctmp) : fp (fp), ctmp (ctmp) {}
+
+    void add (const pend& p, uint64_t conn_id, int rc, uint32_t latency_us)
+    {
+	capx_req r = {};
+	r.ts_ns = p.req.ts_ns;
+	r.conn_id = conn_id;
+	r.latency_us = latency_us;
+	r.op_mask = p.req.op_mask;
+	r.block = p.block;
+	r.offset = p.offset;
+	r.rc = rc;
+	r.cls = (uint8_t)p.req.cls;
+	if (p.req.has_digest) {
+	    r.flags |= CAPX_HAS_DIGEST;
+	    memcpy (r.digest, p.req.digest, sizeof(r.digest));
+	}
+	this->cur.push_back (r);
+	if (this->cur.size () == CAPX_CHUNK)
+	    this->flush ();
+    }
+
+    void flush (void)
+    {
+	if (this->cur.empty ())	return;
+	std::stable_sort (this->cur.begin (), this->cur.end (), [](const capx_req& a, const capx_req& b) { return a.ts_ns < b.ts_ns; });
+	auto c = std::make_unique<capx_chunk> ();
+	c->first_req = this->nreqs;
+	c->nreqs = this->cur.size ();
+	c->min_ts = this->cur.front ().ts_ns;
+	c->max_ts = this->cur.back ().ts_ns;
+	c->min_conn = UINT64_MAX;
+	for (const auto& r : this->cur) {
+	    c->op_mask |= r.op_mask;
+	    c->cls_mask |= 1u << r.cls;
+	    c->min_conn = std::min (c->min_conn, r.conn_id);
+	    c->max_conn = std::max (c->max_conn, r.conn_id);
+	    c->max_latency_us = std::max (c->max_latency_us, r.latency_us);
+	    if (r.flags & CAPX_HAS_DIGEST)	bloom_set (c->bloom, r.digest);
+	}
+	this->head_max = std::max (this->head_max, c->max_ts);
+	c->head_max_ts = this->head_max;
+	fwrite (this->cur.data (), sizeof(capx_req), this->cur.size (), this->fp);
+	fwrite (c.get (), sizeof(capx_chunk), 1, this->ctmp);
+	this->min_ts.push_back (c->min_ts);
+	this->first_ts = std::min (this->first_ts, c->min_ts);
+	this->last_ts = std::max (this->last_ts, c->max_ts);
+	this->nreqs += this->cur.size ();
+	this->cur.clear ();
+    }
+
+    // Copies the chunk table in after the requests, filling in tail_min_ts.
+    void finish (capx_file_hdr& h)
+    {
+	this->flush ();
+	h.nreqs = this->nreqs;
+	h.nchunks = this->min_ts.size ();
+	h.chunks_offset = sizeof(capx_file_hdr) + this->nreqs * sizeof(capx_req);
+	h.first_ts = this->nreqs ? this->first_ts : 0;
+	h.last_ts = this->last_ts;
+	for (size_t ii = this->min_ts.size (); ii-- > 1; )
+	    this->min_ts[ii - 1] = std::min (this->min_ts[ii - 1], this->min_ts[ii]);
+	rewind (this->ctmp);
+	auto c = std::make_unique<capx_chunk> ();
+	for (size_t ii = 0; ii < this->min_ts.size (); ii++) {
+	    if (fread (c.get (), sizeof(capx_chunk), 1, this->ctmp) != 1)
+		throw std::runtime_error ("chunk table: short read of temporary");
+	    c->tail_min_ts = this->min_ts[ii];
+	    fwrite (c.get (), sizeof(capx_chunk), 1, this->fp);
+	}
+    }
+
+private:
+    FILE *fp, *ctmp;
+    std::vector<capx_req> cur;
+    std::vector<uint64_t> min_ts;
+    uint64_t nreqs = 0;
+    uint64_t head_max = 0;
+    uint64_t first_ts = UINT64_MAX;
+    uint64_t last_ts = 0;
+};
+
+}
+
+static block_ents extract (capture_reader& cr, size_t block)
+{
+    block_ents ret;
+    std::vector<uint8_t> raw;
+    if (!cr.read_block (block, raw))
+	return ret;
+    ret.ok = true;
+    for (size_t pos = 0; pos + sizeof(cap_rec) <= raw.size (); ) {
+	cap_rec rec;
+	memcpy (&rec, raw.data () + pos, sizeof(rec));
+	if (pos + sizeof(rec) + rec.len > raw.size ())
+	    break;
+	const uint8_t *f = raw.data () + pos + sizeof(rec);
+	if (rec.len >= sizeof(as_header)) {
+	    frame_ent e = {};
+	    e.ts_ns = rec.ts_ns;
+	    e.conn_id = rec.conn_id;
+	    e.offset = pos;
+	    e.dir = rec.dir;
+	    if (rec.dir)
+		e.rc = response_result (f, rec.len, e.last);
+	    else
+		e.req = classify_request (f, rec.len, rec.ts_ns);
+	    ret.ents.push_back (e);
+	}
+	pos += sizeof(rec) + rec.len;
+    }
+    return ret;
+}
+
+capx_build_stats capx_build (const std::string& capture, const std::string& path, unsigned nthreads)
+{
+    nthreads = std::max (1u, nthreads);
+    struct stat st;
+    if (stat (capture.c_str (), &st))
+	throw std::runtime_error ("cannot stat '" + capture + "'");
+    std::vector<std::unique_ptr<capture_reader>> readers;
+    for (unsigned ii = 0; ii < nthreads; ii++)
+	readers.emplace_back (new capture_reader (capture));
+    size_t nblocks = readers[0]->blocks ().size ();
+
+    auto tmp = path + ".tmp";
+    FILE *fp = fopen (tmp.c_str (), "w");
+    if (!fp)
+	throw std::runtime_error ("cannot create '" + tmp + "'");
+    FILE *ctmp = tmpfile ();
+    if (!ctmp) {
+	fclose (fp);
+	throw std::runtime_error ("cannot create a temporary file");
+    }
+
+    capx_file_hdr h = {};
+    memcpy (h.magic, CAPX_MAGIC, sizeof(h.magic));
+    h.version = 1;
+    h.chunk_reqs = CAPX_CHUNK;
+    h.capture_size = st.st_size;
+    fwrite (&h, sizeof(h), 1, fp);
+
+    // Workers inflate and classify blocks; matching is sequential since a
+    // connection's frames are spread over consecutive blocks.
+    capx_build_stats ret;
+    chunk_writer cw (fp, ctmp);
+    std::unordered_map<uint64_t,std::deque<pend>> conns;
+    uint64_t block = 0;
+    std::string err;
+    ordered_parallel<block_ents> (0, nblocks, nthreads, 4 * nthreads,
+	[&](unsigned w, uint64_t ii) { return extract (*readers[w], ii); },
+	[&](block_ents& b) {
+	    if (!b.ok) {
+		err = "capture block " + std::to_string (block) + " is unreadable";
+		return false;
+	    }
+	    for (const auto& e : b.ents) {
+		ret.frames++;
+		if (!e.dir) {
+		    conns[e.conn_id].push_back ({ e.req, (uint32_t)block, e.offset });
+		    continue;
+		}
+		auto it = conns.find (e.conn_id);
+		if (it == conns.end ()) {
+		    ret.orphans++;
+		    continue;
+		}
+		const auto& p = it->second.front ();
+		if (p.req.stream && !e.last)
+		    continue;
+		uint64_t ns = (e.ts_ns > p.req.ts_ns) ? e.ts_ns - p.req.ts_ns : 0;
+		cw.add (p, e.conn_id, e.rc, (uint32_t)std::min<uint64_t> (ns / 1000, CAPX_NO_RESPONSE - 1));
+		ret.reqs++;
+		it->second.pop_front ();
+		if (it->second.empty ())
+		    conns.erase (it);
+	    }
+	    block++;
+	    return true;
+	});
+
+    if (err.empty ()) {
+	std::vector<uint64_t> ids;
+	for (const auto& kv : conns)	ids.push_back (kv.first);
+	std::sort (ids.begin (), ids.end ());
+	for (auto id : ids)
+	    for (const auto& p : conns[id]) {
+		cw.add (p, id, -1, CAPX_NO_RESPONSE);
+		ret.reqs++;
+		ret.unanswered++;
+	    }
+	try {
+	    cw.finish (h);
+	} catch (const std::exception& e) {
+	    err = e.what ();
+	}
+	rewind (fp);
+	fwrite (&h, sizeof(h), 1, fp);
+	if (ferror (fp))
+	    err = "write error on '" + tmp + "'";
+    }
+    fclose (ctmp);
+    if (fclose (fp) && err.empty ())
+	err = "write error on '" + tmp + "'";
+    if (err.empty () && rename (tmp.c_str (), path.c_str ()))
+	err = "cannot rename '" + tmp + "' to '" + path + "'";
+    if (!err.empty ()) {
+	unlink (tmp.c_str ());
+	throw std::runtime_error (err);
+    }
+    return ret;
+}
+
+bool capx_query::may_match (const capx_chunk& c) const
+{
+    if ((c.max_ts < this->from_ns) || (c.min_ts > this->to_ns))	return false;
+    if (!this->any_conn && ((this->conn_id < c.min_conn) || (this->conn_id > c.max_conn)))	return false;
+    if (this->op_mask && !(this->op_mask & c.op_mask))	return false;
+    if (this->cls_mask && !(this->cls_mask & c.cls_mask))	return false;
+    if (c.max_latency_us < this->min_latency_us)	return false;
+    if (this->has_digest && !bloom_test (c.bloom, this->digest))	return false;
+    return true;
+}
+
+bool capx_query::match (const capx_req& r) const
+{
+    if ((r.ts_ns < this->from_ns) || (r.ts_ns > this->to_ns))	return false;
+    if (!this->any_conn && (r.conn_id != this->conn_id))	return false;
+    if (this->op_mask && !(this->op_mask & r.op_mask))	return false;
+    if (this->cls_mask && !(this->cls_mask & (1u << r.cls)))	return false;
+    if (r.latency_us < this->min_latency_us)	return false;
+    if ((this->rc >= 0) && (r.rc != this->rc))	return false;
+    if (this->has_digest && (!(r.flags & CAPX_HAS_DIGEST) || memcmp (r.digest, this->digest, sizeof(r.digest))))	return false;
+    return true;
+}
+
+capx_index::capx_index (const std::string& path)
+{
+    int fd = open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+	throw std::runtime_error ("cannot open index '" + path + "'");
+    struct stat st;
+    if (!fstat (fd, &st) && (st.st_size >= (off_t)sizeof(capx_file_hdr))) {
+	this->len = st.st_size;
+	this->base = mmap (nullptr, this->len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close (fd);
+    if (!this->base || (this->base == MAP_FAILED)) {
+	this->base = nullptr;
+	throw std::runtime_error ("'" + path + "' is not an index file");
+    }
+
+    this->h = (const capx_file_hdr *)this->base;
+    this->r = (const capx_req *)(this->h + 1);
+    this->c = (const capx_chunk *)((const uint8_t *)this->base + this->h->chunks_offset);
+    if (memcmp (this->h->magic, CAPX_MAGIC, sizeof(this->h->magic)) || (this->h->version != 1) ||
+	(this->h->chunks_offset != sizeof(capx_file_hdr) + this->h->nreqs * sizeof(capx_req)) ||
+	(this->h->chunks_offset + this->h->nchunks * sizeof(capx_chunk) != this->len)) {
+	munmap (this->base, this->len);
+	this->base = nullptr;
+	throw std::runtime_error ("'" + path + "' is not an index file");
+    }
+}
+
+capx_index::~capx_index ()
+{
+    if (this->base)	munmap (this->base, this->len);
+}
+
+std::pair<uint64_t,uint64_t> capx_index::time_range (uint64_t from_ns, uint64_t to_ns) const
+{
+    auto b = this->c, e = this->c + this->h->nchunks;
+    auto first = std::partition_point (b, e, [from_ns](const capx_chunk& c) { return c.head_max_ts < from_ns; });
+    auto last = std::partition_point (first, e, [to_ns](const capx_chunk& c) { return c.tail_min_ts <= to_ns; });
+    return { first - b, last - b };
+}
+
+capx_index::scan_stats capx_index::scan (const capx_query& q, unsigned nthreads, const std::function<bool (const capx_req&)>& fn) const
+{
+    scan_stats ret;
+    auto range = this->time_range (q.from_ns, q.to_ns);
+    ret.chunks = range.second - range.first;
+    std::atomic<uint64_t> scanned{0};
+    ordered_parallel<std::vector<uint64_t>> (range.first, range.second, nthreads, 16 * std::max (1u, nthreads),
+	[&](unsigned, uint64_t ii) {
+	    std::vector<uint64_t> hits;
+	    const auto& c = this->c[ii];
+	    if (!q.may_match (c))
+		return hits;
+	    scanned.fetch_add (1, std::memory_order_relaxed);
+	    for (uint64_t jj = c.first_req; jj < c.first_req + c.nreqs; jj++)
+		if (q.match (this->r[jj]))
+		    hits.push_back (jj);
+	    return hits;
+	},
+	[&](std::vector<uint64_t>& hits) {
+	    for (auto jj : hits) {
+		ret.matches++;
+		if (!fn (this->r[jj]))
+		    return false;
+	    }
+	    return true;
+	});
+    ret.scanned = scanned.load ();
+    return ret;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Sidecar query index over a capture file, CAPTURE.qidx by default, so a
+// post-mortem question ("every op on this digest", "requests slower than
+// 5ms between t1 and t2") reads a few MB instead of inflating every block.
+//
+// File layout (little-endian, as written by the host):
+//   capx_file_hdr
+//   capx_req[nreqs]	one per request, grouped into chunks
+//   capx_chunk[nchunks]
+// Requests are matched to their responses per connection the way
+// proxy_stats does, and emitted as they complete.  Completion order is close
+// to time order, so each chunk of up to CAPX_CHUNK requests (sorted by ts
+// within the chunk) spans a narrow time range.  A chunk summarises its
+// requests: time range, connection range, op and class masks, worst
+// latency and a bloom filter of digests, enough to skip most chunks of a
+// query without touching their requests.  head_max_ts and tail_min_ts are
+// monotonic over the chunk table, which lets a time range become a pair of
+// binary searches.
+
+#define CAPX_MAGIC		"ASCAPQX\1"
+#define CAPX_CHUNK		4096
+#define CAPX_BLOOM_BYTES	8192
+#define CAPX_NO_RESPONSE	UINT32_MAX
+
+struct capx_file_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_reqs;
+    uint64_t capture_size;	// of the capture when indexed; differs once stale
+    uint64_t nreqs;
+    uint64_t nchunks;
+    uint64_t chunks_offset;
+    uint64_t first_ts;
+    uint64_t last_ts;
+} __attribute__((__packed__));
+
+struct capx_req
+{
+    uint64_t ts_ns;		// request frame complete
+    uint64_t conn_id;
+    uint32_t latency_us;	// to the last response frame, or CAPX_NO_RESPONSE
+    uint32_t op_mask;		// bit per as_op::type
+    uint32_t block;		// capture block holding the request
+    uint32_t offset;		// of its cap_rec in the decoded block
+    int16_t rc;			// -1 for info or undecodable responses
+    uint8_t cls;		// req_class
+    uint8_t flags;		// CAPX_HAS_DIGEST
+    uint8_t digest[20];
+} __attribute__((__packed__));
+#define CAPX_HAS_DIGEST	1
+
+struct capx_chunk
+{
+    uint64_t first_req;
+    uint32_t nreqs;
+    uint32_t op_mask;		// union over the chunk
+    uint64_t min_ts;
+    uint64_t max_ts;
+    uint64_t head_max_ts;	// max of max_ts over this and all earlier chunks
+    uint64_t tail_min_ts;	// min of min_ts over this and all later chunks
+    uint64_t min_conn;
+    uint64_t max_conn;
+    uint32_t max_latency_us;	// CAPX_NO_RESPONSE counts as the worst
+    uint32_t cls_mask;
+    uint8_t bloom[CAPX_BLOOM_BYTES];	// digests, three bits each
+} __attribute__((__packed__));
+
+struct capx_build_stats
+{
+    uint64_t frames = 0;
+    uint64_t reqs = 0;
+    uint64_t unanswered = 0;	// requests still pending at end of capture
+    uint64_t orphans = 0;	// responses with no request outstanding
+};
+
+// Reads the capture with nthreads workers inflating blocks, writes the
+// index to path (via a temporary and a rename).  Throws std::runtime_error.
+capx_build_stats capx_build (const std::string& capture, const std::string& path, unsigned nthreads);
+
+struct capx_query
+{
+    uint64_t from_ns = 0;
+    uint64_t to_ns = UINT64_MAX;
+    bool any_conn = true;
+    uint64_t conn_id = 0;
+    uint32_t op_mask = 0;	// any of these ops, 0 for all
+    uint32_t cls_mask = 0;	// any of these classes, 0 for all
+    uint32_t min_latency_us = 0;	// unanswered requests always qualify
+    int rc = -1;		// -1 for any
+    bool has_digest = false;
+    uint8_t digest[20] = {};
+
+    bool may_match (const capx_chunk& c) const;
+    bool match (const capx_req& r) const;
+};
+
+// Read-only mmap of an index file.
+class capx_index
+{
+public:
+    // Throws std::runtime_error if path is not a valid index.
+    explicit capx_index (const std::string& path);
+    ~capx_index ();
+    capx_index (const capx_index&) = delete;
+    capx_index& operator= (const capx_index&) = delete;
+
+    const capx_file_hdr& hdr (void) const	{ return *this->h; }
+    const capx_req* reqs (void) const		{ return this->r; }
+    const capx_chunk* chunks (void) const	{ return this->c; }
+
+    // Chunks [first, last) that can hold requests in [from_ns, to_ns].
+    std::pair<uint64_t,uint64_t> time_range (uint64_t from_ns, uint64_t to_ns) const;
+
+    struct scan_stats
+    {
+	uint64_t chunks = 0;	// in the time range
+	uint64_t scanned = 0;	// not ruled out by their summary
+	uint64_t matches = 0;
+    };
+    // Scans the chunks of the query's time range on nthreads workers and
+    // hands matches to fn on the calling thread, in chunk order.  fn
+    // returning false stops the scan.
+    scan_stats scan (const capx_query& q, unsigned nthreads, const std::function<bool (const capx_req&)>& fn) const;
+
+private:
+    void *base = nullptr;
+    size_t len = 0;
+    const capx_file_hdr *h = nullptr;
+    const capx_req *r = nullptr;
+    const capx_chunk *c = nullptr;
+};
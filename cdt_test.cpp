@@ -1,5 +1,6 @@
 // CDT Comprehensive Test Suite - Complete coverage of all CDT operations
 #include "as_proto.hpp"
+#include "config.hpp"
 #include "util.hpp"
 #include <iostream>
 #include <iomanip>
@@ -119,7 +120,7 @@ void test_cdt_operation(int fd, const char* name, const string& bin_name,
     visit(req, record_id, (op_type == as_op::type::t_cdt_modify) ? AS_MSG_FLAG_WRITE : AS_MSG_FLAG_READ);
     dieunless(req->add(op_type, bin_name, cdt_op));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(55) << name << " | ";
@@ -138,7 +139,7 @@ void test_cdt_operation(int fd, const char* name, const string& bin_name,
         report_fail(name, "request failed with code " + to_string((int)res->result_code));
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -153,7 +154,7 @@ void test_cdt_success(int fd, const char* name, const string& bin_name,
     visit(req, record_id, (op_type == as_op::type::t_cdt_modify) ? AS_MSG_FLAG_WRITE : AS_MSG_FLAG_READ);
     dieunless(req->add(op_type, bin_name, cdt_op));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(55) << name << " | ";
@@ -166,7 +167,7 @@ void test_cdt_success(int fd, const char* name, const string& bin_name,
         report_fail(name, "request failed");
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -209,22 +210,13 @@ int main(int argc, char **argv, char **envp)
 {
     srand(time(nullptr));
 
-    // Setup defaults
-    p = {
-        {"ASDB", "localhost:3000"},
-        {"NS", "test"},
-        {"SN", "cdt_test"}
-    };
-
-    // Override from environment
-    for (auto ep = *envp; ep; ep = *(++envp)) {
-        const char* prefix = "JP_INFO_";
-        if (!strncmp(prefix, ep, 8)) {
-            auto vs = strchr(ep, '=');
-            auto ks = string(ep).substr(8, (vs - ep) - 8);
-            if (ks.length()) p[ks] = string(vs + 1);
-        }
-    }
+    config cfg("JP_INFO_", {
+        {"ASDB", config_opt::type::t_string, "localhost:3000", "server host:port"},
+        {"NS", config_opt::type::t_string, "test", "namespace"},
+        {"SN", config_opt::type::t_string, "cdt_test", "set name"}
+    });
+    config_load_or_die(cfg, argc, argv, envp);
+    p = cfg.strings();
 
     cout << "Connecting to " << p["ASDB"] << " (ns=" << p["NS"] << ", set=" << p["SN"] << ")" << endl;
     int fd = tcp_connect(p["ASDB"]);
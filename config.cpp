@@ -0,0 +1,249 @@
+#include "config.hpp"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using json = nlohmann::json;
+
+static std::string upcase (std::string s)
+{
+    std::transform (s.begin (), s.end (), s.begin (), ::toupper);
+    return s;
+}
+
+static bool parse_int (const std::string& s, int64_t& v)
+{
+    const char *b = s.data (), *e = b + s.size ();
+    auto [ptr, ec] = std::from_chars (b, e, v);
+    return (ec == std::errc ()) && (ptr == e) && (b != e);
+}
+
+// Decimal only: no hex floats, and no inf or nan, which would pass any
+// range check.
+static bool parse_float (const std::string& s, double& v)
+{
+    const char *b = s.data (), *e = b + s.size ();
+    auto [ptr, ec] = std::from_chars (b, e, v, std::chars_format::general);
+    return (ec == std::errc ()) && (ptr == e) && (b != e) && std::isfinite (v);
+}
+
+static bool parse_bool (const std::string& s, bool& v)
+{
+    auto ls = s;
+    std::transform (ls.begin (), ls.end (), ls.begin (), ::tolower);
+    if (ls == "1" || ls == "true" || ls == "yes" || ls == "on")	{ v = true;	return true; }
+    if (ls == "0" || ls == "false" || ls == "no" || ls == "off")	{ v = false;	return true; }
+    return false;
+}
+
+config::config (const std::string& env_prefix, std::vector<config_opt> _schema) :
+    prefix (env_prefix),
+    schema (std::move (_schema))
+{
+    for (const auto& o : this->schema)
+	this->vals[o.name] = o.def;
+}
+
+const config_opt* config::opt (const std::string& key) const
+{
+    for (const auto& o : this->schema)
+	if (o.name == key)
+	    return &o;
+    return nullptr;
+}
+
+bool config::validate (const config_opt& o, const std::string& val)
+{
+    int64_t iv;
+    double fv;
+    bool bv;
+    double lb = o.lb, ub = o.ub;
+
+    switch (o.t)
+    {
+    case(config_opt::type::t_int):
+	if (!parse_int (val, iv)) {
+	    this->err = o.name + ": '" + val + "' is not an integer";
+	    return false;
+	}
+	fv = (double)iv;
+	// Callers mostly keep ints in an int; a wider option says so in its bounds.
+	if (lb == std::numeric_limits<double>::lowest ())	lb = INT_MIN;
+	if (ub == std::numeric_limits<double>::max ())	ub = INT_MAX;
+	break;
+    case(config_opt::type::t_float):
+	if (!parse_float (val, fv)) {
+	    this->err = o.name + ": '" + val + "' is not a number";
+	    return false;
+	}
+	break;
+    case(config_opt::type::t_bool):
+	if (!parse_bool (val, bv)) {
+	    this->err = o.name + ": '" + val + "' is not a boolean";
+	    return false;
+	}
+	return true;
+    case(config_opt::type::t_string):
+	if (!o.choices.empty () && std::find (o.choices.begin (), o.choices.end (), val) == o.choices.end ()) {
+	    this->err = o.name + ": '" + val + "' is not one of";
+	    for (const auto& c : o.choices)	this->err += " " + c;
+	    return false;
+	}
+	return true;
+    }
+
+    if ((fv < lb) || (fv > ub)) {
+	char buf[128];
+	snprintf (buf, sizeof(buf), " out of range [%g, %g]", lb, ub);
+	this->err = o.name + ": " + val + buf;
+	return false;
+    }
+    return true;
+}
+
+bool config::set (const std::string& key, const std::string& val)
+{
+    auto o = this->opt (upcase (key));
+    if (!o) {
+	this->err = "unknown option '" + key + "'";
+	return false;
+    }
+    if (!this->validate (*o, val))	return false;
+    this->vals[o->name] = val;
+    return true;
+}
+
+bool config::load_json (const json& jo)
+{
+    if (!jo.is_object ()) {
+	this->err = "config file must hold a json object";
+	return false;
+    }
+    for (const auto& [k, v] : jo.items ()) {
+	std::string sv;
+	if (v.is_string ())		sv = v.get<std::string> ();
+	else if (v.is_boolean ())	sv = v.get<bool> () ? "1" : "0";
+	else if (v.is_number ())	sv = v.dump ();
+	else {
+	    this->err = k + ": unsupported json type";
+	    return false;
+	}
+	if (!this->set (k, sv))	return false;
+    }
+    return true;
+}
+
+bool config::load (int argc, char **argv, char **envp)
+{
+    std::vector<std::pair<std::string,std::string>> env, args;
+    std::string cfile;
+
+    for (auto ep = envp ? *envp : nullptr; ep; ep = *(++envp)) {
+	if (strncmp (this->prefix.c_str (), ep, this->prefix.size ()))	continue;
+	auto vs = strchr (ep, '=');
+	if (!vs)	continue;
+	auto ks = std::string (ep + this->prefix.size (), vs);
+	if (ks == "CONFIG")		cfile = vs + 1;
+	else if (this->opt (ks))	env.emplace_back (ks, vs + 1);
+    }
+
+    for (auto ii = 1; ii < argc; ii++) {
+	auto ap = argv[ii];
+	auto vs = strchr (ap, '=');
+	if (!vs) {
+	    this->err = "expected key=value, got '" + std::string (ap) + "'";
+	    return false;
+	}
+	auto ks = upcase (std::string (ap, vs));
+	if (ks == "CONFIG")	cfile = vs + 1;
+	else			args.emplace_back (ks, vs + 1);
+    }
+
+    if (!cfile.empty ()) {
+	std::ifstream ifs (cfile);
+	if (!ifs) {
+	    this->err = "cannot open config file '" + cfile + "'";
+	    return false;
+	}
+	json jo = json::parse (ifs, nullptr, false);
+	if (jo.is_discarded ()) {
+	    this->err = "cannot parse config file '" + cfile + "'";
+	    return false;
+	}
+	if (!this->load_json (jo))	return false;
+    }
+
+    for (const auto& [k, v] : env)
+	if (!this->set (k, v))	return false;
+    for (const auto& [k, v] : args)
+	if (!this->set (k, v))	return false;
+
+    return true;
+}
+
+int64_t config::i (const std::string& key) const
+{
+    int64_t v = 0;
+    parse_int (this->vals.at (key), v);
+    return v;
+}
+
+double config::f (const std::string& key) const
+{
+    double v = 0;
+    parse_float (this->vals.at (key), v);
+    return v;
+}
+
+bool config::b (const std::string& key) const
+{
+    bool v = false;
+    parse_bool (this->vals.at (key), v);
+    return v;
+}
+
+const std::string& config::s (const std::string& key) const	{ return this->vals.at (key); }
+
+std::unordered_map<std::string,std::string> config::strings (void) const	{ return this->vals; }
+
+json config::to_json (void) const
+{
+    json ret = json::object ();
+    for (const auto& o : this->schema) {
+	switch (o.t)
+	{
+	case(config_opt::type::t_int):		ret[o.name] = this->i (o.name);		break;
+	case(config_opt::type::t_float):	ret[o.name] = this->f (o.name);		break;
+	case(config_opt::type::t_bool):		ret[o.name] = this->b (o.name);		break;
+	case(config_opt::type::t_string):	ret[o.name] = this->s (o.name);		break;
+	}
+    }
+    return ret;
+}
+
+void config::usage (FILE *fp, const char *argv0) const
+{
+    fprintf (fp, "Usage: %s [key=value ...]\n", argv0);
+    fprintf (fp, "  Options may also be set as %sKEY=value in the environment,\n", this->prefix.c_str ());
+    fprintf (fp, "  or as a json object in the file named by CONFIG.\n\n");
+    for (const auto& o : this->schema)
+	fprintf (fp, "  %-16s %-24s %s\n", o.name.c_str (), ("[" + o.def + "]").c_str (), o.help.c_str ());
+}
+
+void config_load_or_die (config& cfg, int argc, char **argv, char **envp)
+{
+    for (auto ii = 1; ii < argc; ii++)
+	if (!strcmp (argv[ii], "-h") || !strcmp (argv[ii], "--help")) {
+	    cfg.usage (stdout, argv[0]);
+	    exit (0);
+	}
+    if (!cfg.load (argc, argv, envp)) {
+	fprintf (stderr, "%s: %s\n\n", argv[0], cfg.error ().c_str ());
+	cfg.usage (stderr, argv[0]);
+	exit (1);
+    }
+}
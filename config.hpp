@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Typed configuration shared by all of the tools.  A tool declares a schema
+// (name, type, default, help, bounds), then loads it once at startup from, in
+// increasing precedence: schema defaults, a JSON file named by CONFIG, the
+// environment (PREFIX_NAME=value) and argv (name=value).  Everything is
+// validated up front so a bad value fails before any connection is made;
+// hot code copies the values it needs into plain struct fields.
+//
+// Integers must fit in an int unless the option's bounds allow more, up to
+// CONFIG_INT_MAX (2^53, where doubles stop being exact).
+
+const double CONFIG_INT_MAX = 9007199254740992.0;
+
+struct config_opt
+{
+    enum class type : uint8_t
+    {
+	t_int,
+	t_float,
+	t_bool,
+	t_string
+    };
+    std::string name;
+    config_opt::type t;
+    std::string def;
+    std::string help;
+    double lb = std::numeric_limits<double>::lowest ();
+    double ub = std::numeric_limits<double>::max ();
+    std::vector<std::string> choices = {};
+};
+
+class config
+{
+public:
+    config (const std::string& env_prefix, std::vector<config_opt> schema);
+
+    // Returns false and sets error () on the first invalid or unknown key.
+    // Unknown environment keys are ignored since prefixes are shared.
+    bool load (int argc, char **argv, char **envp);
+    bool load_json (const nlohmann::json& jo);
+    bool set (const std::string& key, const std::string& val);
+    const std::string& error (void) const	{ return this->err; }
+
+    int64_t i (const std::string& key) const;
+    double f (const std::string& key) const;
+    bool b (const std::string& key) const;
+    const std::string& s (const std::string& key) const;
+
+    std::unordered_map<std::string,std::string> strings (void) const;
+    nlohmann::json to_json (void) const;
+    void usage (FILE *fp, const char *argv0) const;
+
+private:
+    const config_opt* opt (const std::string& key) const;
+    bool validate (const config_opt& o, const std::string& val);
+
+    std::string prefix;
+    std::vector<config_opt> schema;
+    std::unordered_map<std::string,std::string> vals;
+    std::string err;
+};
+
+// Load or exit(1) with the error and usage on stderr.
+void config_load_or_die (config& cfg, int argc, char **argv, char **envp);
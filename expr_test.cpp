@@ -1,5 +1,6 @@
 // Expression test - unified testing for read and write expressions
 #include "as_proto.hpp"
+#include "config.hpp"
 #include "util.hpp"
 #include <iostream>
 #include <iomanip>
@@ -146,7 +147,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id =
     json expr_with_flags = (flags == as_exp::flags::none) ? expr : json::array({expr, static_cast<int>(flags)});
     dieunless(req->add(as_op::type::t_exp_read, "result", expr_with_flags));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(40) << name << " | ";
@@ -174,7 +175,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id =
         cout << "ERROR: code " << (int)res->result_code;
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -188,7 +189,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
     visit(req, record_id, AS_MSG_FLAG_READ);
     dieunless(req->add(as_op::type::t_exp_read, "result", expr));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(40) << name << " | ";
@@ -214,7 +215,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
         report_fail(name, "request failed");
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -228,7 +229,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
     visit(req, record_id, AS_MSG_FLAG_READ);
     dieunless(req->add(as_op::type::t_exp_read, "result", expr));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(40) << name << " | ";
@@ -254,7 +255,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
         report_fail(name, "request failed");
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -268,7 +269,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
     visit(req, record_id, AS_MSG_FLAG_READ);
     dieunless(req->add(as_op::type::t_exp_read, "result", expr));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     cout << left << setw(40) << name << " | ";
@@ -294,7 +295,7 @@ void test_expression(int fd, const char* name, const json& expr, int record_id,
         report_fail(name, "request failed");
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     free(res);
 }
 
@@ -330,7 +331,7 @@ bool test_expr_write(int fd, as_msg* req, as_msg** res,
     op->data_type = as_particle::type::t_integer;
     *(uint64_t *)op->data() = htobe64(write_value);
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)res, req, &dur);
 
     bool success = ((*res)->result_code == 0);
@@ -348,7 +349,7 @@ bool test_expr_write(int fd, as_msg* req, as_msg** res,
         report_fail(test_name.c_str(), ss.str());
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     return success == expect_success;
 }
 
@@ -365,7 +366,7 @@ bool test_expr_modify(int fd, as_msg* req, as_msg** res,
     json expr_with_flags = (flags == as_exp::flags::none) ? modify_expr : json::array({modify_expr, static_cast<int>(flags)});
     req->add(as_op::type::t_exp_modify, result_bin, expr_with_flags);
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)res, req, &dur);
 
     cout << left << setw(50) << test_name << " | ";
@@ -373,7 +374,7 @@ bool test_expr_modify(int fd, as_msg* req, as_msg** res,
     if ((*res)->result_code != 0) {
         cout << "ERROR: code " << (int)(*res)->result_code;
         report_fail(test_name.c_str(), "request failed");
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         return false;
     }
 
@@ -396,7 +397,7 @@ bool test_expr_modify(int fd, as_msg* req, as_msg** res,
         report_pass(test_name.c_str());
     }
 
-    cout << " | " << dur << " us" << endl;
+    cout << " | " << dur / 1e3 << " us" << endl;
     return true;
 }
 
@@ -404,20 +405,13 @@ int main(int argc, char **argv, char **envp)
 {
     srand(time(nullptr));
 
-    p = {
-        {"ASDB", "localhost:3000"},
-        {"NS", "test"},
-        {"SN", "expr_test"}
-    };
-
-    for (auto ep = *envp; ep; ep = *(++envp)) {
-        const char* prefix = "JP_INFO_";
-        if (!strncmp(prefix, ep, 8)) {
-            auto vs = strchr(ep, '=');
-            auto ks = string(ep).substr(8, (vs - ep) - 8);
-            if (ks.length()) p[ks] = string(vs + 1);
-        }
-    }
+    config cfg("JP_INFO_", {
+        {"ASDB", config_opt::type::t_string, "localhost:3000", "server host:port"},
+        {"NS", config_opt::type::t_string, "test", "namespace"},
+        {"SN", config_opt::type::t_string, "expr_test", "set name"}
+    });
+    config_load_or_die(cfg, argc, argv, envp);
+    p = cfg.strings();
 
     cout << "Connecting to " << p["ASDB"] << " (ns=" << p["NS"] << ", set=" << p["SN"] << ")" << endl;
     int fd = tcp_connect(p["ASDB"]);
@@ -1022,7 +1016,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, static_cast<int>(as_exp::flags::create_only)});
         req->add(as_op::type::t_exp_modify, "newbin2", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "CREATE_ONLY: fail on existing record" << " | ";
@@ -1036,7 +1030,7 @@ int main(int argc, char **argv, char **envp)
             report_fail("CREATE_ONLY: fail on existing record", "should have failed");
         }
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1066,7 +1060,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, static_cast<int>(as_exp::flags::update_only)});
         req->add(as_op::type::t_exp_modify, "nonexistent", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "UPDATE_ONLY: fail on non-existent bin" << " | ";
@@ -1080,7 +1074,7 @@ int main(int argc, char **argv, char **envp)
             report_fail("UPDATE_ONLY: fail on non-existent bin", "should have failed");
         }
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1105,7 +1099,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({nil_expr, static_cast<int>(as_exp::flags::allow_delete)});
         req->add(as_op::type::t_exp_modify, "to_delete", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "ALLOW_DELETE: delete bin with nil expr" << " | ";
@@ -1118,7 +1112,7 @@ int main(int argc, char **argv, char **envp)
             report_fail("ALLOW_DELETE: delete bin with nil expr", "operation failed");
         }
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1136,7 +1130,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, static_cast<int>(as_exp::flags::policy_no_fail)});
         req->add(as_op::type::t_exp_modify, "nofail_test", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "POLICY_NO_FAIL: handle expr result" << " | ";
@@ -1150,7 +1144,7 @@ int main(int argc, char **argv, char **envp)
             report_fail("POLICY_NO_FAIL: handle expr result", "operation failed");
         }
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1167,7 +1161,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, static_cast<int>(as_exp::flags::eval_no_fail)});
         req->add(as_op::type::t_exp_modify, "divzero_test", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "EVAL_NO_FAIL: handle divide-by-zero" << " | ";
@@ -1177,7 +1171,7 @@ int main(int argc, char **argv, char **envp)
         cout << "OK: completed (code " << (int)res->result_code << ")";
         report_pass("EVAL_NO_FAIL: handle divide-by-zero");
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1192,7 +1186,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, static_cast<int>(as_exp::flags::eval_no_fail)});
         req->add(as_op::type::t_exp_modify, "nilaccess_test", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "EVAL_NO_FAIL: handle nil bin access" << " | ";
@@ -1201,7 +1195,7 @@ int main(int argc, char **argv, char **envp)
         cout << "OK: completed (code " << (int)res->result_code << ")";
         report_pass("EVAL_NO_FAIL: handle nil bin access");
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -1219,7 +1213,7 @@ int main(int argc, char **argv, char **envp)
         json expr_with_flags = json::array({expr, combined_flags});
         req->add(as_op::type::t_exp_modify, "testbin", expr_with_flags);
 
-        uint32_t dur = 0;
+        uint64_t dur = 0;
         call(fd, (void**)&res, req, &dur);
 
         cout << left << setw(50) << "Combined: UPDATE_ONLY + EVAL_NO_FAIL" << " | ";
@@ -1227,7 +1221,7 @@ int main(int argc, char **argv, char **envp)
         cout << "OK: completed (code " << (int)res->result_code << ")";
         report_pass("Combined: UPDATE_ONLY + EVAL_NO_FAIL");
 
-        cout << " | " << dur << " us" << endl;
+        cout << " | " << dur / 1e3 << " us" << endl;
         free(res);
     }
 
@@ -0,0 +1,107 @@
+#include "fault.hpp"
+#include "as_proto.hpp"
+#include "proxy_stats.hpp"
+#include <cmath>
+#include <cstring>
+
+static std::vector<std::string> split_list (const std::string& str)
+{
+    std::vector<std::string> ret;
+    size_t pos = 0;
+    while (pos < str.size ()) {
+	size_t cp = str.find (',', pos);
+	if (cp == std::string::npos)	cp = str.size ();
+	if (cp > pos)	ret.push_back (str.substr (pos, cp - pos));
+	pos = cp + 1;
+    }
+    return ret;
+}
+
+std::vector<config_opt> fault_schema (void)
+{
+    return {
+	{ "BW_BPS", config_opt::type::t_int, "0", "fault: bytes/s per connection and direction, 0 for no limit", 0, CONFIG_INT_MAX },
+	{ "BW_BURST", config_opt::type::t_int, "65536", "fault: bandwidth token bucket depth in bytes", 1 },
+	{ "CLOSE_PROB", config_opt::type::t_float, "0", "fault: chance a frame closes the connection instead", 0, 1 },
+	{ "DELAY_DIST", config_opt::type::t_string, "fixed", "fault: delay distribution with mean DELAY_US", 0, 0, { "fixed", "uniform", "exp" } },
+	{ "DELAY_US", config_opt::type::t_int, "0", "fault: delay per frame in microseconds", 0 },
+	{ "DROP_PROB", config_opt::type::t_float, "0", "fault: chance a frame is silently discarded", 0, 1 },
+	{ "FAULT_DIR", config_opt::type::t_string, "none", "fault: direction(s) faults apply to", 0, 0, { "none", "c2s", "s2c", "both" } },
+	{ "RESET_PROB", config_opt::type::t_float, "0", "fault: chance a frame resets the connection instead", 0, 1 },
+	{ "TARGET_DIGESTS", config_opt::type::t_string, "", "fault: only requests for these hex digests, comma separated" },
+	{ "TARGET_OPS", config_opt::type::t_string, "", "fault: only requests with these op types, e.g. read,cdt_modify" }
+    };
+}
+
+bool fault_load (const config& cfg, fault_opts& opts, std::string& err)
+{
+    auto dir = cfg.s ("FAULT_DIR");
+    opts.dir[0] = (dir == "c2s") || (dir == "both");
+    opts.dir[1] = (dir == "s2c") || (dir == "both");
+    auto dd = cfg.s ("DELAY_DIST");
+    opts.delay_dist = (dd == "uniform") ? fault_opts::dist::uniform : (dd == "exp") ? fault_opts::dist::exp : fault_opts::dist::fixed;
+    opts.delay_ns = cfg.i ("DELAY_US") * 1000;
+    opts.bw_bps = cfg.i ("BW_BPS");
+    opts.burst = cfg.i ("BW_BURST");
+    opts.drop_prob = cfg.f ("DROP_PROB");
+    opts.close_prob = cfg.f ("CLOSE_PROB");
+    opts.reset_prob = cfg.f ("RESET_PROB");
+    if (opts.drop_prob + opts.close_prob + opts.reset_prob > 1.0) {
+	err = "DROP_PROB + CLOSE_PROB + RESET_PROB must not exceed 1";
+	return false;
+    }
+
+    for (const auto& name : split_list (cfg.s ("TARGET_OPS"))) {
+	int ii;
+	for (ii = 0; ii < 32; ii++)
+	    if (to_string ((as_op::type)ii) == name)
+		break;
+	if (ii == 32) {
+	    err = "TARGET_OPS: unknown op type '" + name + "'";
+	    return false;
+	}
+	opts.target_ops |= 1u << ii;
+    }
+    for (const auto& hex : split_list (cfg.s ("TARGET_DIGESTS"))) {
+	if ((hex.size () != 40) || (hex.find_first_not_of ("0123456789abcdefABCDEF") != std::string::npos)) {
+	    err = "TARGET_DIGESTS: '" + hex + "' is not a 40 digit hex digest";
+	    return false;
+	}
+	std::string bin (20, '\0');
+	for (size_t ii = 0; ii < 20; ii++)
+	    bin[ii] = (char)std::stoi (hex.substr (ii * 2, 2), nullptr, 16);
+	opts.target_digests.push_back (bin);
+    }
+    return true;
+}
+
+bool fault_opts::targeted (const pending_req& req) const
+{
+    if (!this->targeting ())	return true;
+    if (req.op_mask & this->target_ops)	return true;
+    if (req.has_digest)
+	for (const auto& d : this->target_digests)
+	    if (!memcmp (d.data (), req.digest, 20))
+		return true;
+    return false;
+}
+
+fault_action fault_plan::action (void)
+{
+    double p = this->unif (this->rng);
+    if ((p -= this->opts.drop_prob) < 0)	return fault_action::drop;
+    if ((p -= this->opts.close_prob) < 0)	return fault_action::close;
+    if ((p -= this->opts.reset_prob) < 0)	return fault_action::reset;
+    return fault_action::pass;
+}
+
+uint64_t fault_plan::delay_ns (void)
+{
+    switch (this->opts.delay_dist)
+    {
+    case(fault_opts::dist::fixed):	return this->opts.delay_ns;
+    case(fault_opts::dist::uniform):	return (uint64_t)(this->unif (this->rng) * 2.0 * this->opts.delay_ns);
+    case(fault_opts::dist::exp):	return (uint64_t)(-std::log (1.0 - this->unif (this->rng)) * this->opts.delay_ns);
+    }
+    return 0;
+}
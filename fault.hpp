@@ -0,0 +1,55 @@
+#pragma once
+#include "config.hpp"
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+struct pending_req;
+
+// Fault injection for tcp_proxy.  Faults act on whole frames travelling in
+// the FAULT_DIR direction(s) of an inspected connection.  With TARGET_OPS or
+// TARGET_DIGESTS set, only frames of matching requests (or the responses to
+// them) are delayed, dropped or cut; everything else still passes through
+// the same ordered hold queue undelayed.
+
+struct fault_opts
+{
+    enum class dist : uint8_t { fixed, uniform, exp };
+
+    bool dir[2] = { false, false };	// indexed by the sending side
+    dist delay_dist = dist::fixed;
+    uint64_t delay_ns = 0;		// mean for uniform and exp
+    double bw_bps = 0;			// bytes/s per connection and direction, 0 for no limit
+    double burst = 0;			// token bucket depth in bytes
+    double drop_prob = 0;		// frame silently discarded
+    double close_prob = 0;		// connection closed (FIN) instead
+    double reset_prob = 0;		// connection reset (RST) instead
+    uint32_t target_ops = 0;		// as_op::type bitmask
+    std::vector<std::string> target_digests;	// 20-byte binary digests
+
+    bool enabled (void) const	{ return this->dir[0] || this->dir[1]; }
+    bool targeting (void) const	{ return this->target_ops || !this->target_digests.empty (); }
+    bool targeted (const pending_req& req) const;
+};
+
+// Options shared by tcp_proxy's config schema.
+std::vector<config_opt> fault_schema (void);
+// Fills opts from cfg; false with err set on a bad list or digest.
+bool fault_load (const config& cfg, fault_opts& opts, std::string& err);
+
+enum class fault_action : uint8_t { pass, drop, close, reset };
+
+// Per-worker decisions; owns the worker's random engine.
+class fault_plan
+{
+public:
+    fault_plan (const fault_opts& opts, uint64_t seed) : opts (opts), rng (seed) {}
+    fault_action action (void);
+    uint64_t delay_ns (void);
+
+private:
+    const fault_opts& opts;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unif{0.0, 1.0};
+};
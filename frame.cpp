@@ -0,0 +1,35 @@
+#include "frame.hpp"
+
+size_t frame_reassembler::check (const as_header *h)
+{
+    // Types: 1 info, 2 security, 3 msg, 4 compressed msg.  The 48-bit size's
+    // upper bits (be_sz_extra) are far beyond any sane max_frame.
+    if (h->version != 2)			this->err = status::bad_version;
+    else if (h->type < 1 || h->type > 4)	this->err = status::bad_type;
+    else if (h->be_sz_extra || (h->size () + sizeof(as_header) > this->max_frame))
+	this->err = status::too_large;
+    else
+	return h->size () + sizeof(as_header);
+    this->carry.clear ();
+    this->need = 0;
+    return 0;
+}
+
+const char* frame_reassembler::error_str (void) const
+{
+    switch (this->err)
+    {
+    case(status::ok):		return "ok";
+    case(status::bad_version):	return "bad protocol version";
+    case(status::bad_type):	return "bad message type";
+    case(status::too_large):	return "frame too large";
+    }
+    return "unknown";
+}
+
+void frame_reassembler::reset (void)
+{
+    this->carry.clear ();
+    this->need = 0;
+    this->err = status::ok;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "as_proto.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Splits one direction of a connection into whole protocol frames (the
+// 8-byte as_header plus its payload), whatever the recv() boundaries were.
+// Frames that arrive whole are handed out in place; only a frame straddling
+// two feeds is copied into the carry buffer.
+
+class frame_reassembler
+{
+public:
+    enum class status : uint8_t { ok, bad_version, bad_type, too_large };
+    static constexpr size_t default_max = 128ul * 1024 * 1024;
+
+    explicit frame_reassembler (size_t max_frame = default_max) : max_frame (max_frame) {}
+
+    // Calls fn (const uint8_t *frame, size_t len) for each complete frame,
+    // header included.  Returns false, and ignores further input, once a
+    // header fails validation; the stream cannot be resynchronised.
+    template <typename F> bool feed (const uint8_t *p, size_t n, F&& fn);
+
+    status error (void) const	{ return this->err; }
+    const char* error_str (void) const;
+    size_t pending (void) const	{ return this->carry.size (); }
+    uint64_t frames (void) const	{ return this->nframes; }
+    void reset (void);
+
+private:
+    // Full frame size from a header, or 0 after setting err.
+    size_t check (const as_header *h);
+
+    size_t max_frame;
+    std::vector<uint8_t> carry;
+    size_t need = 0;		// full size of the frame in carry, once known
+    uint64_t nframes = 0;
+    status err = status::ok;
+};
+
+template <typename F>
+bool frame_reassembler::feed (const uint8_t *p, size_t n, F&& fn)
+{
+    if (this->err != status::ok)	return false;
+
+    // Finish the frame carried over from the previous feed.
+    if (!this->carry.empty ()) {
+	if (this->carry.size () < sizeof(as_header)) {
+	    size_t take = std::min (n, sizeof(as_header) - this->carry.size ());
+	    this->carry.insert (this->carry.end (), p, p + take);
+	    p += take;
+	    n -= take;
+	    if (this->carry.size () < sizeof(as_header))	return true;
+	    if (!(this->need = this->check ((const as_header *)this->carry.data ())))	return false;
+	}
+	size_t take = std::min (n, this->need - this->carry.size ());
+	this->carry.insert (this->carry.end (), p, p + take);
+	p += take;
+	n -= take;
+	if (this->carry.size () < this->need)	return true;
+	fn (this->carry.data (), this->carry.size ());
+	this->nframes++;
+	this->carry.clear ();
+	this->need = 0;
+    }
+
+    // Whole frames straight out of the caller's buffer.
+    while (n >= sizeof(as_header)) {
+	as_header h;
+	memcpy (&h, p, sizeof(h));
+	size_t sz = this->check (&h);
+	if (!sz)	return false;
+	if (n < sz) {
+	    this->need = sz;
+	    break;
+	}
+	fn (p, sz);
+	this->nframes++;
+	p += sz;
+	n -= sz;
+    }
+    if (n)	this->carry.assign (p, p + n);
+    return true;
+}
@@ -2,6 +2,9 @@
  * hdr_decoder.c
  * Written by Michael Barker and released to the public domain,
  * as explained at http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * With a file name (or stdin) prints each interval's percentile table;
+ * with key=value arguments merges and re-windows many logs, see analyze.
  */
 
 #include <stdint.h>
@@ -14,12 +17,23 @@
 #include <hdr/hdr_histogram.h>
 #include <hdr/hdr_histogram_log.h>
 
+#include <atomic>
+#include <cmath>
+#include <fnmatch.h>
+#include <glob.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.hpp"
+
 #if defined(_MSC_VER)
 #pragma warning(push)
 #pragma warning(disable: 4996)
 #endif
 
-int main(int argc, char** argv)
+static int print_classic(int argc, char** argv)
 {
     int rc = 0;
     FILE* f;
@@ -77,6 +91,349 @@ int main(int argc, char** argv)
     return 0;
 }
 
+// Analysis mode: any key=value argument selects it (HDR_DECODER_ prefix in
+// the environment).
+//
+//   ./hdr_decoder LOGS='run1/*.hlog,run2/*.hlog' WINDOW=60 PERCENTILES=50,99,99.9
+//
+// Every interval of every log in LOGS (comma list of files or glob
+// patterns) whose tag matches TAGS and whose start is within [FROM, TO) is
+// added into the window its start falls in: WINDOW seconds aligned to the
+// epoch, or the interval's own start and length when WINDOW=0.  An interval
+// is never split, so windows should be multiples of the logged interval.
+// Intervals from different logs (threads, hosts) merge into the same
+// window; SPLIT_TAGS=1 keeps one series per tag instead.  Logs decode in
+// parallel, THREADS at a time.
+//
+// Each window is one CSV row, or one JSON line with FORMAT=json: start,
+// length, tag, count, min, mean, max and the chosen percentiles, values
+// divided by SCALE.
+
+using namespace std;
+
+struct window_key
+{
+  int64_t start_ms;
+  string tag;
+  bool operator< (const window_key& o) const
+  {
+    return (this->start_ms != o.start_ms) ? (this->start_ms < o.start_ms) : (this->tag < o.tag);
+  }
+};
+
+struct window_hist
+{
+  int64_t end_ms = 0;
+  uint64_t intervals = 0;
+  hdr_histogram *h = nullptr;
+};
+
+typedef map<window_key,window_hist> window_map;
+
+struct analysis
+{
+  vector<string> tags;
+  double from = 0, to = 0, window = 0;
+  bool split_tags = false;
+};
+
+static vector<string> split_list (const string& str)
+{
+  vector<string> ret;
+  size_t pos = 0;
+  while (pos < str.size ()) {
+    size_t cp = str.find (',', pos);
+    if (cp == string::npos)
+      cp = str.size ();
+    if (cp > pos)
+      ret.push_back (str.substr (pos, cp - pos));
+    pos = cp + 1;
+  }
+  return ret;
+}
+
+static bool tag_matches (const analysis& an, const string& tag)
+{
+  if (an.tags.empty ())
+    return true;
+  for (const auto& pat : an.tags)
+    if (!fnmatch (pat.c_str (), tag.c_str (), 0))
+      return true;
+  return false;
+}
+
+// Adds src into the window's histogram, created like the first one added
+// so values from any log fit.  Returns the number of values that did not.
+static int64_t add_into (window_hist& w, const hdr_histogram *src)
+{
+  if (!w.h)
+    hdr_init (src->lowest_discernible_value, src->highest_trackable_value, src->significant_figures, &w.h);
+  return hdr_add (w.h, src);
+}
+
+struct decode_stats
+{
+  uint64_t lines = 0, intervals = 0, bad = 0, dropped = 0;
+};
+
+// One log into wm.  Timestamps are absolute unless a BaseTime header says
+// otherwise or, as the Java reader assumes, they are too small to be.
+static bool decode_log (const string& path, const analysis& an, window_map& wm, decode_stats& ds, string& err)
+{
+  FILE *f = fopen (path.c_str (), "r");
+  if (!f) {
+    err = path + ": " + strerror (errno);
+    return false;
+  }
+  double start_time = 0, base_time = 0;
+  bool has_base = false;
+  char *line = nullptr;
+  size_t cap = 0;
+  ssize_t len;
+  while ((len = getline (&line, &cap, f)) > 0) {
+    ds.lines++;
+    while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+      line[--len] = 0;
+    if (line[0] == '#') {
+      if (!strncmp (line, "#[StartTime: ", 13))
+	start_time = strtod (line + 13, nullptr);
+      else if (!strncmp (line, "#[BaseTime: ", 12)) {
+	base_time = strtod (line + 12, nullptr);
+	has_base = true;
+      }
+      continue;
+    }
+    if ((line[0] == '"') || !line[0])
+      continue;
+
+    char *p = line;
+    string tag;
+    if (!strncmp (p, "Tag=", 4)) {
+      char *comma = strchr (p, ',');
+      if (!comma) {
+	ds.bad++;
+	continue;
+      }
+      tag.assign (p + 4, comma);
+      p = comma + 1;
+    }
+    char *end;
+    double ts = strtod (p, &end);
+    if ((end == p) || (*end != ',')) {
+      ds.bad++;
+      continue;
+    }
+    double ilen = strtod (end + 1, &end);
+    char *enc = (*end == ',') ? strchr (end + 1, ',') : nullptr;
+    if (!enc) {
+      ds.bad++;
+      continue;
+    }
+    enc++;
+    if (!has_base && (start_time > 0) && (ts < start_time / 2))
+      base_time = start_time;
+    ts += base_time;
+
+    if ((an.from > 0) && (ts < an.from))
+      continue;
+    if ((an.to > 0) && (ts >= an.to))
+      continue;
+    if (!tag_matches (an, tag))
+      continue;
+
+    hdr_histogram *h = nullptr;
+    if (hdr_log_decode (&h, enc, strlen (enc)) || !h) {
+      ds.bad++;
+      continue;
+    }
+    window_key k;
+    k.tag = an.split_tags ? tag : string ();
+    int64_t end_ms;
+    if (an.window > 0) {
+      double ws = floor (ts / an.window) * an.window;
+      k.start_ms = llround (ws * 1000);
+      end_ms = llround ((ws + an.window) * 1000);
+    } else {
+      k.start_ms = llround (ts * 1000);
+      end_ms = llround ((ts + ilen) * 1000);
+    }
+    auto& w = wm[k];
+    w.end_ms = max (w.end_ms, end_ms);
+    w.intervals++;
+    ds.dropped += add_into (w, h);
+    ds.intervals++;
+    hdr_close (h);
+  }
+  free (line);
+  fclose (f);
+  return true;
+}
+
+static void merge_into (window_map& dst, window_map& src, decode_stats& ds)
+{
+  for (auto& [k, w] : src) {
+    auto& d = dst[k];
+    d.end_ms = max (d.end_ms, w.end_ms);
+    d.intervals += w.intervals;
+    ds.dropped += add_into (d, w.h);
+    hdr_close (w.h);
+  }
+  src.clear ();
+}
+
+static vector<string> expand_logs (const string& list)
+{
+  vector<string> ret;
+  for (const auto& pat : split_list (list)) {
+    glob_t g;
+    if (!glob (pat.c_str (), 0, nullptr, &g)) {
+      for (size_t ii = 0; ii < g.gl_pathc; ii++)
+	ret.push_back (g.gl_pathv[ii]);
+    } else
+      ret.push_back (pat);	// fails to open, with its name
+    globfree (&g);
+  }
+  return ret;
+}
+
+static void emit_window (string& out, bool json_out, const window_key& k, const window_hist& w,
+			 const vector<double>& pcts, double scale)
+{
+  char buf[128];
+  auto num = [&](double v) {
+    snprintf (buf, sizeof(buf), "%.3f", v);
+    return string (buf);
+  };
+  const auto *h = w.h;
+  string sstart = num (k.start_ms / 1e3), slen = num ((w.end_ms - k.start_ms) / 1e3);
+  string smin = num (hdr_min (h) / scale), smean = num (hdr_mean (h) / scale), smax = num (hdr_max (h) / scale);
+  if (json_out) {
+    out += "{\"start\":" + sstart + ",\"length\":" + slen + ",\"tag\":" + nlohmann::json (k.tag).dump ();
+    out += ",\"count\":" + to_string (h->total_count) + ",\"min\":" + smin + ",\"mean\":" + smean + ",\"max\":" + smax;
+    out += ",\"percentiles\":{";
+    for (size_t ii = 0; ii < pcts.size (); ii++) {
+      snprintf (buf, sizeof(buf), "%s\"%g\":", ii ? "," : "", pcts[ii]);
+      out += buf;
+      out += num (hdr_value_at_percentile (h, pcts[ii]) / scale);
+    }
+    out += "}}\n";
+    return;
+  }
+  out += sstart + "," + slen + "," + k.tag + "," + to_string (h->total_count) + "," + smin + "," + smean + "," + smax;
+  for (auto p : pcts)
+    out += "," + num (hdr_value_at_percentile (h, p) / scale);
+  out += "\n";
+}
+
+static int analyze (int argc, char **argv, char **envp)
+{
+  using t = config_opt::type;
+  config cfg ("HDR_DECODER_", {
+    { "FORMAT",		t::t_string,	"csv",	"output format", 0, 0, { "csv", "json" } },
+    { "FROM",		t::t_float,	"0",	"only intervals starting at or after this epoch time in seconds, 0 for the start", 0 },
+    { "LOGS",		t::t_string,	"",	"comma list of interval logs or glob patterns" },
+    { "PERCENTILES",	t::t_string,	"50,90,99,99.9,99.99,100", "comma list of percentiles per window" },
+    { "SCALE",		t::t_float,	"1",	"divide values by this, e.g. 1000 for the tools' ns logs in usec", 1e-9 },
+    { "SPLIT_TAGS",	t::t_bool,	"false", "one series per tag instead of merging the matching tags" },
+    { "TAGS",		t::t_string,	"",	"comma list of tag patterns (fnmatch), empty for all, untagged lines included" },
+    { "THREADS",	t::t_int,	"0",	"decode workers, 0 for one per online core", 0, 1024 },
+    { "TO",		t::t_float,	"0",	"only intervals starting before this epoch time in seconds, 0 for the end", 0 },
+    { "WINDOW",		t::t_float,	"0",	"window length in seconds, 0 to keep the logged intervals", 0 },
+  });
+  config_load_or_die (cfg, argc, argv, envp);
+
+  analysis an;
+  an.tags = split_list (cfg.s ("TAGS"));
+  an.from = cfg.f ("FROM");
+  an.to = cfg.f ("TO");
+  an.window = cfg.f ("WINDOW");
+  an.split_tags = cfg.b ("SPLIT_TAGS");
+  vector<double> pcts;
+  for (const auto& s : split_list (cfg.s ("PERCENTILES"))) {
+    char *end;
+    double p = strtod (s.c_str (), &end);
+    if (*end || (p < 0) || (p > 100)) {
+      fprintf (stderr, "PERCENTILES: bad percentile '%s'\n", s.c_str ());
+      return 1;
+    }
+    pcts.push_back (p);
+  }
+  auto logs = expand_logs (cfg.s ("LOGS"));
+  if (logs.empty ()) {
+    fprintf (stderr, "LOGS is required\n");
+    cfg.usage (stderr, argv[0]);
+    return 1;
+  }
+  unsigned nthreads = cfg.i ("THREADS");
+  if (!nthreads)
+    nthreads = max (1u, thread::hardware_concurrency ());
+  nthreads = min<size_t> (nthreads, logs.size ());
+
+  // Workers pull whole logs and fill their own maps, merged once at the end.
+  window_map total;
+  decode_stats total_ds;
+  atomic<size_t> next (0);
+  mutex mtx;
+  vector<string> errs;
+  vector<thread> th;
+  for (unsigned w = 0; w < nthreads; w++)
+    th.emplace_back ([&] {
+      window_map wm;
+      decode_stats ds;
+      for (size_t ii; (ii = next++) < logs.size ();) {
+	string err;
+	if (!decode_log (logs[ii], an, wm, ds, err)) {
+	  lock_guard<mutex> lg (mtx);
+	  errs.push_back (err);
+	}
+      }
+      lock_guard<mutex> lg (mtx);
+      merge_into (total, wm, total_ds);
+      total_ds.lines += ds.lines;
+      total_ds.intervals += ds.intervals;
+      total_ds.bad += ds.bad;
+      total_ds.dropped += ds.dropped;
+    });
+  for (auto& t : th)
+    t.join ();
+  for (const auto& e : errs)
+    fprintf (stderr, "%s\n", e.c_str ());
+
+  bool json_out = (cfg.s ("FORMAT") == "json");
+  double scale = cfg.f ("SCALE");
+  string out;
+  if (!json_out) {
+    out = "start,length,tag,count,min,mean,max";
+    for (auto p : pcts) {
+      char buf[32];
+      snprintf (buf, sizeof(buf), ",p%g", p);
+      out += buf;
+    }
+    out += "\n";
+  }
+  for (auto& [k, w] : total) {
+    emit_window (out, json_out, k, w, pcts, scale);
+    if (out.size () >= (1 << 16)) {
+      fwrite (out.data (), 1, out.size (), stdout);
+      out.clear ();
+    }
+    hdr_close (w.h);
+  }
+  fwrite (out.data (), 1, out.size (), stdout);
+  fflush (stdout);
+  fprintf (stderr, "%lu logs, %lu intervals into %lu windows; %lu unreadable lines, %lu values out of range\n",
+	   logs.size (), total_ds.intervals, total.size (), total_ds.bad, total_ds.dropped);
+  return errs.empty () ? 0 : 1;
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  for (int ii = 1; ii < argc; ii++)
+    if (strchr (argv[ii], '='))
+      return analyze (argc, argv, envp);
+  return print_classic (argc, argv);
+}
+
 #if defined(_MSC_VER)
 #pragma warning(pop)
 #endif
@@ -1,3 +1,17 @@
+// Info protocol client.
+//
+// MODE=interactive (the default) reads info commands from stdin, one per
+// line, sends each to ASDB and prints the response.
+//
+// MODE=poll issues COMMANDS (comma separated, e.g.
+// statistics,namespace/test,latencies:) to every node in NODES each
+// INTERVAL seconds, one thread per node and one round trip per node and
+// round, with rounds aligned to the wall clock so nodes are sampled
+// together and line up with workload HLOG intervals.  Numeric values
+// become gauges; integer values are treated as counters and also get a
+// per-second _rate, a decrease counting as a reset.  The latest round is
+// served as Prometheus text on PROM_ADDR.
+
 #include <algorithm>
 #include <endian.h>
 #include <atomic>
@@ -8,13 +22,16 @@
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <signal.h>
 #include <sstream>
 #include <stdexcept>
 #include <stdint.h>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -25,29 +42,280 @@
 #include <vector>
 #include <thread>
 #include "as_proto.hpp"
+#include "config.hpp"
+#include "info_parse.hpp"
 #include "util.hpp"
 
 using namespace std;
 
-const char g_ep_str[] = "JP_INFO_";
-const size_t g_ep_str_sz = char_traits<char>::length (g_ep_str);
+// Gauge value of an info field, and whether it could be a counter.
+static bool parse_value (string_view v, double& out, bool& integral)
+{
+    int64_t iv;
+    if ((integral = info_number (v, iv))) {
+	out = iv;
+	return true;
+    }
+    return info_number (v, out);
+}
+
+static string metric_name (string_view prefix, string_view key)
+{
+    string ret (prefix);
+    for (char c : key)
+	ret += isalnum ((unsigned char)c) ? c : '_';
+    return ret;
+}
+
+struct info_sample
+{
+    string name;
+    string labels;		// {node="...",...}
+    double value;
+};
+
+// One node: its connection, the latest round of samples and what the rate
+// computation needs from the last round that saw each value.
+class node_poller
+{
+public:
+    node_poller (const string& hostport, const vector<string>& cmds, double interval)
+	: hostport (hostport), addr (addr_resolve (hostport)), cmds (cmds), interval (interval) {}
+    ~node_poller ()	{ if (this->fd >= 0) close (this->fd); }
+
+    void poll (uint64_t now_us)
+    {
+	vector<info_sample> out;
+	auto t0 = chrono::steady_clock::now ();
+	bool ok = this->connect ();
+	if (ok) {
+	    // Every command in one round trip.
+	    auto resp = call_info_batch (this->fd, this->cmds);
+	    ok = !resp.empty ();
+	    for (const auto& cmd : this->cmds) {
+		auto it = resp.find (cmd);
+		if (it != resp.end ())
+		    this->parse (cmd, it->second, now_us, out);
+	    }
+	}
+	if (!ok && (this->fd >= 0)) {
+	    close (this->fd);
+	    this->fd = -1;
+	}
+	if (ok != this->up)
+	    fprintf (stderr, "%s: %s\n", this->hostport.c_str (), ok ? "up" : "down");
+	this->up = ok;
+	string nl = "{node=\"" + this->hostport + "\"}";
+	out.push_back ({ "aerospike_up", nl, ok ? 1.0 : 0.0 });
+	out.push_back ({ "aerospike_poll_seconds", nl, chrono::duration<double> (chrono::steady_clock::now () - t0).count () });
+
+	lock_guard<mutex> lg (this->mtx);
+	this->cur.swap (out);
+    }
+
+    void snapshot (vector<info_sample>& out)
+    {
+	lock_guard<mutex> lg (this->mtx);
+	out.insert (out.end (), this->cur.begin (), this->cur.end ());
+    }
+
+private:
+    bool connect (void)
+    {
+	if (this->fd >= 0)
+	    return true;
+	if ((this->fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+	    return false;
+	// A hung node must not stall its thread past the next round.
+	timeval tv = { (time_t)this->interval, (suseconds_t)((this->interval - (time_t)this->interval) * 1e6) };
+	setsockopt (this->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt (this->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (::connect (this->fd, (sockaddr *)this->addr.data (), this->addr.size ())) {
+	    close (this->fd);
+	    this->fd = -1;
+	    return false;
+	}
+	return true;
+    }
+
+    // Adds the value, and for an integer its rate since the last round
+    // that saw it, so a round missed in an outage stretches the interval
+    // rather than inflating the rate.  A decrease is a counter reset, as
+    // after a node restart: the rate skips that round and resumes from
+    // the new value.
+    void add (vector<info_sample>& out, string name, const string& labels, double v, bool integral, uint64_t now_us)
+    {
+	auto& st = this->prev[name + labels];
+	if (integral && st.seen && (v >= st.last) && (now_us > st.us))
+	    out.push_back ({ name + "_rate", labels, (v - st.last) * 1e6 / (now_us - st.us) });
+	st.seen = true;
+	st.last = v;
+	st.us = now_us;
+	out.push_back ({ std::move (name), labels, v });
+    }
+
+    void parse (const string& cmd, string_view val, uint64_t now_us, vector<info_sample>& out)
+    {
+	string labels = "{node=\"" + this->hostport + "\"";
+	if (cmd.compare (0, 10, "latencies:") == 0) {
+	    this->parse_latencies (val, labels, out);
+	    return;
+	}
+	string prefix;
+	if (cmd == "statistics") {
+	    prefix = "aerospike_node_";
+	} else if (cmd.compare (0, 10, "namespace/") == 0) {
+	    prefix = "aerospike_namespace_";
+	    labels += ",ns=\"" + cmd.substr (10) + "\"";
+	} else {
+	    prefix = metric_name ("aerospike_", cmd) + "_";
+	}
+	labels += "}";
+	for (auto kv : info_pairs (val)) {
+	    double v;
+	    bool integral;
+	    if (parse_value (kv.value, v, integral))
+		this->add (out, metric_name (prefix, kv.key), labels, v, integral, now_us);
+	}
+    }
+
+    void parse_latencies (string_view resp, const string& node_labels, vector<info_sample>& out)
+    {
+	for (const auto& lat : info_latencies (resp)) {
+	    string labels = node_labels;
+	    if (!lat.ns.empty ())
+		labels += ",ns=\"" + lat.ns + "\"";
+	    labels += ",hist=\"" + lat.name + "\"";
+	    out.push_back ({ "aerospike_latency_ops_per_sec", labels + "}", lat.ops_per_sec });
+	    const char *unit = lat.usec ? "us" : "ms";
+	    for (size_t k = 0; k < lat.pct_over.size (); k++) {
+		auto th = to_string (1ul << k) + unit;
+		out.push_back ({ "aerospike_latency_over_pct", labels + ",threshold=\"" + th + "\"}", lat.pct_over[k] });
+	    }
+	}
+    }
+
+    struct prev_value
+    {
+	double last = 0;
+	uint64_t us = 0;		// when last was read
+	bool seen = false;
+    };
+
+    string hostport;
+    vector<uint8_t> addr;
+    vector<string> cmds;
+    double interval;
+    int fd = -1;
+    bool up = true;
+    unordered_map<string,prev_value> prev;
+    mutex mtx;
+    vector<info_sample> cur;
+};
+
+static string render (const vector<unique_ptr<node_poller>>& nodes)
+{
+    vector<info_sample> all;
+    for (auto& n : nodes)
+	n->snapshot (all);
+    // The text format wants each family's samples together.
+    stable_sort (all.begin (), all.end (), [](const info_sample& a, const info_sample& b) { return a.name < b.name; });
+    string ret;
+    char buf[64];
+    for (size_t ii = 0; ii < all.size (); ii++) {
+	if (!ii || (all[ii].name != all[ii - 1].name))
+	    ret += "# TYPE " + all[ii].name + " gauge\n";
+	snprintf (buf, sizeof(buf), " %.15g\n", all[ii].value);
+	ret += all[ii].name + all[ii].labels + buf;
+    }
+    return ret;
+}
+
+// Minimal HTTP/1.0: any request gets the current exposition.
+static void serve (int lfd, const vector<unique_ptr<node_poller>>& nodes)
+{
+    for (;;) {
+	int cfd = accept4 (lfd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (cfd < 0)
+	    continue;
+	timeval tv = { 2, 0 };
+	setsockopt (cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt (cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	string req;
+	char buf[4096];
+	ssize_t n;
+	while ((req.find ("\r\n\r\n") == string::npos) && (req.size () < 65536) && ((n = read (cfd, buf, sizeof(buf))) > 0))
+	    req.append (buf, n);
+	auto body = render (nodes);
+	auto resp = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+	    to_string (body.size ()) + "\r\n\r\n" + body;
+	for (size_t off = 0; (off < resp.size ()) && ((n = write (cfd, resp.data () + off, resp.size () - off)) > 0); off += n)
+	    ;
+	close (cfd);
+    }
+}
+
+static int run_poller (const config& cfg)
+{
+    vector<string> cmds, hosts;
+    for (auto t : info_list (cfg.s ("COMMANDS"), ','))
+	cmds.emplace_back (t);
+    for (auto t : info_list (cfg.s ("NODES").empty () ? cfg.s ("ASDB") : cfg.s ("NODES"), ','))
+	hosts.emplace_back (t);
+    double interval = cfg.f ("INTERVAL");
+    signal (SIGPIPE, SIG_IGN);
+
+    vector<unique_ptr<node_poller>> nodes;
+    for (const auto& h : hosts)
+	nodes.emplace_back (new node_poller (h, cmds, interval));
+
+    if (!cfg.s ("PROM_ADDR").empty ()) {
+	auto ab = addr_resolve (cfg.s ("PROM_ADDR"));
+	int lfd, one = 1;
+	dieunless ((lfd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0);
+	setsockopt (lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	dieunless (bind (lfd, (sockaddr *)ab.data (), ab.size ()) == 0);
+	dieunless (listen (lfd, 16) == 0);
+	thread (serve, lfd, cref (nodes)).detach ();
+    }
+
+    // Every node is polled at the same wall clock instants.
+    auto period = chrono::microseconds ((int64_t)(interval * 1e6));
+    auto now = chrono::system_clock::now ();
+    auto first = chrono::system_clock::time_point ((now.time_since_epoch () / period + 1) * period);
+    auto stop = (cfg.f ("DURATION") > 0) ? now + chrono::microseconds ((int64_t)(cfg.f ("DURATION") * 1e6)) : chrono::system_clock::time_point::max ();
+    vector<thread> th;
+    for (auto& n : nodes)
+	th.emplace_back ([&, np = n.get ()] {
+	    for (auto t = first; t < stop; t += period) {
+		this_thread::sleep_until (t);
+		np->poll (chrono::duration_cast<chrono::microseconds> (t.time_since_epoch ()).count ());
+	    }
+	});
+    for (auto& t : th)
+	t.join ();
+    if (cfg.f ("DURATION") > 0)
+	fputs (render (nodes).c_str (), stdout);
+    return 0;
+}
 
 // envp is POSIX but not C++
 int main (int argc, char **argv, char **envp)
 {
-    // Defaults for required variables.
-    unordered_map<string,string> p = {
-	{ "ASDB",		"localhost:3000" }
-    };
-    // Override from environment
-    for (auto ep = *envp; ep; ep = *(++envp))
-	if (!strncmp (g_ep_str, ep, g_ep_str_sz)) {
-	    auto vs = strchr (ep, '=');
-	    auto ks = string (ep).substr (g_ep_str_sz, (vs - ep) - g_ep_str_sz);
-	    if (ks.length ()) p[ks] = string (vs + 1);
-	}
+    config cfg ("JP_INFO_", {
+	{ "ASDB",	config_opt::type::t_string,	"localhost:3000",	"server host:port" },
+	{ "COMMANDS",	config_opt::type::t_string,	"statistics,latencies:",	"poll: info commands, comma separated" },
+	{ "DURATION",	config_opt::type::t_float,	"0",	"poll: seconds to run, then print the last round; 0 runs forever", 0 },
+	{ "INTERVAL",	config_opt::type::t_float,	"1",	"poll: seconds between rounds", 0.01 },
+	{ "MODE",	config_opt::type::t_string,	"interactive",	"commands from stdin, or poll NODES", 0, 0, { "interactive", "poll" } },
+	{ "NODES",	config_opt::type::t_string,	"",	"poll: host:port list, comma separated; ASDB when empty" },
+	{ "PROM_ADDR",	config_opt::type::t_string,	"127.0.0.1:9145",	"poll: Prometheus text endpoint host:port, empty for none" }
+    });
+    config_load_or_die (cfg, argc, argv, envp);
+    if (cfg.s ("MODE") == "poll")
+	return run_poller (cfg);
 
-    auto ab = addr_resolve (p["ASDB"]);
+    auto ab = addr_resolve (cfg.s ("ASDB"));
 
     // Make a client fd and connect
     int cfd;
@@ -0,0 +1,235 @@
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+// Zero-copy views over info responses.  Nothing here allocates but
+// info_latencies: every piece is a std::string_view into the response,
+// which must outlive it.
+//
+// Info values nest their separators, outermost first:
+//   '\n' '\t'	one "name\tvalue" line per command of a request
+//   ';'	records, or key=value pairs	"objects=10;memory_used_bytes=100"
+//   ':'	fields of a record		"ns=test:set=demo:objects=5"
+//   ','	list items			"read:msec,1.0,0.00,..."
+// info_list walks the pieces between one separator, info_pairs looks keys
+// up in a list of key=value pieces, and info_section splits the "{ns}-"
+// prefix of per-namespace entries (latencies:, histograms).
+
+// Pieces of s between sep, empty pieces skipped.
+class info_list
+{
+public:
+    info_list (std::string_view s, char sep) : s (s), sep (sep) {}
+
+    class iterator
+    {
+    public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = std::string_view;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const std::string_view*;
+	using reference = const std::string_view&;
+
+	iterator (void) = default;
+	iterator (std::string_view rest, char sep) : rest (rest), sep (sep), done (false)	{ this->advance (); }
+	reference operator* (void) const	{ return this->cur; }
+	pointer operator-> (void) const		{ return &this->cur; }
+	iterator& operator++ (void)		{ this->advance (); return *this; }
+	iterator operator++ (int)		{ auto ret = *this; this->advance (); return ret; }
+	bool operator== (const iterator& o) const
+	{
+	    return (this->done == o.done) && (this->done || (this->cur.data () == o.cur.data ()));
+	}
+	bool operator!= (const iterator& o) const	{ return !(*this == o); }
+
+    private:
+	void advance (void)
+	{
+	    for (;;) {
+		if (this->rest.data () == nullptr) {
+		    this->done = true;
+		    return;
+		}
+		size_t p = this->rest.find (this->sep);
+		this->cur = this->rest.substr (0, p);
+		this->rest = (p == std::string_view::npos) ? std::string_view () : this->rest.substr (p + 1);
+		if (!this->cur.empty ())
+		    return;
+	    }
+	}
+
+	std::string_view rest, cur;
+	char sep = 0;
+	bool done = true;
+    };
+
+    iterator begin (void) const	{ return this->s.empty () ? iterator () : iterator (this->s, this->sep); }
+    iterator end (void) const	{ return iterator (); }
+    bool empty (void) const	{ return this->begin () == this->end (); }
+    // Linear; prefer a range for loop when visiting every piece.
+    size_t size (void) const	{ return std::distance (this->begin (), this->end ()); }
+    std::optional<std::string_view> at (size_t ii) const
+    {
+	for (auto p : *this)
+	    if (!ii--)
+		return p;
+	return std::nullopt;
+    }
+
+private:
+    std::string_view s;
+    char sep;
+};
+
+struct info_kv
+{
+    std::string_view key;
+    std::string_view value;	// empty when the piece has no eq
+};
+
+inline info_kv info_split (std::string_view piece, char eq = '=')
+{
+    size_t p = piece.find (eq);
+    if (p == std::string_view::npos)
+	return { piece, {} };
+    return { piece.substr (0, p), piece.substr (p + 1) };
+}
+
+// Number in an info value: integers and floats as from_chars reads them,
+// and true/false as 1/0.  The whole of v must parse.
+template <typename T>
+bool info_number (std::string_view v, T& out)
+{
+    static_assert (std::is_arithmetic_v<T>);
+    if ((v == "true") || (v == "false")) {
+	out = (v == "true");
+	return true;
+    }
+    auto end = v.data () + v.size ();
+    auto r = std::from_chars (v.data (), end, out);
+    return !v.empty () && (r.ec == std::errc ()) && (r.ptr == end);
+}
+
+template <typename T>
+std::optional<T> info_number (std::string_view v)
+{
+    T ret;
+    if (info_number (v, ret))
+	return ret;
+    return std::nullopt;
+}
+
+// key=value pieces between sep: "a=1;b=2" or, within a record, "ns=x:set=y".
+class info_pairs
+{
+public:
+    info_pairs (std::string_view s, char sep = ';', char eq = '=') : list (s, sep), eq (eq) {}
+
+    class iterator
+    {
+    public:
+	iterator (info_list::iterator it, char eq) : it (it), eq (eq) {}
+	info_kv operator* (void) const	{ return info_split (*this->it, this->eq); }
+	iterator& operator++ (void)	{ ++this->it; return *this; }
+	bool operator!= (const iterator& o) const	{ return this->it != o.it; }
+	bool operator== (const iterator& o) const	{ return this->it == o.it; }
+
+    private:
+	info_list::iterator it;
+	char eq;
+    };
+
+    iterator begin (void) const	{ return iterator (this->list.begin (), this->eq); }
+    iterator end (void) const	{ return iterator (this->list.end (), this->eq); }
+
+    // First value for key; linear, so visit the pairs once when reading
+    // many keys from a large response.
+    std::optional<std::string_view> get (std::string_view key) const
+    {
+	for (auto kv : *this)
+	    if (kv.key == key)
+		return kv.value;
+	return std::nullopt;
+    }
+    template <typename T>
+    T get (std::string_view key, T def) const
+    {
+	auto v = this->get (key);
+	T ret;
+	return (v && info_number (*v, ret)) ? ret : def;
+    }
+
+private:
+    info_list list;
+    char eq;
+};
+
+// "{ns}-name" as ns and name; ns is empty without the prefix.
+struct info_section
+{
+    std::string_view ns;
+    std::string_view name;
+};
+
+inline info_section info_split_section (std::string_view s)
+{
+    if (s.empty () || (s[0] != '{'))
+	return { {}, s };
+    size_t p = s.find ("}-");
+    if (p == std::string_view::npos)
+	return { {}, s };
+    return { s.substr (1, p - 1), s.substr (p + 2) };
+}
+
+// One histogram of a latencies: response.  The server reports ops/sec and
+// the percentage of ops over 2^k ms (or us) thresholds.
+struct info_latency
+{
+    std::string ns;		// empty for node-wide histograms
+    std::string name;		// read, write, batch-index, ...
+    bool usec = false;		// thresholds in us rather than ms
+    double ops_per_sec = 0;
+    std::vector<double> pct_over;	// % of ops over 2^k units
+};
+
+// The histograms of a latencies: value, copied out; entries that do not
+// parse whole are skipped.
+inline std::vector<info_latency> info_latencies (std::string_view val)
+{
+    // {ns}-name:unit,ops/sec,pct>1,pct>2,pct>4,... per ';'
+    std::vector<info_latency> ret;
+    for (auto ent : info_list (val, ';')) {
+	auto kv = info_split (ent, ':');
+	if (kv.value.empty ())
+	    continue;
+	auto sec = info_split_section (kv.key);
+	info_latency lat;
+	lat.ns = sec.ns;
+	lat.name = sec.name;
+	int col = 0;
+	bool ok = true;
+	for (auto tok : info_list (kv.value, ',')) {
+	    double v = 0;
+	    if (col == 0)
+		lat.usec = (tok == "usec");
+	    else if (!(ok = info_number (tok, v)))
+		break;
+	    else if (col == 1)
+		lat.ops_per_sec = v;
+	    else
+		lat.pct_over.push_back (v);
+	    col++;
+	}
+	if (ok && (col >= 2))
+	    ret.push_back (std::move (lat));
+    }
+    return ret;
+}
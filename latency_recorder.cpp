@@ -1,66 +1,64 @@
-#include <cstdio>
-#include <cstdlib>
+// Example of the recording library (recorder.hpp): a worker times a
+// synthetic ~120us operation at a fixed rate and records each latency into
+// an interval recorder, while the main thread closes one interval a second
+// into latency_log.hdr and prints a summary at the end.
+//
+// Latency is measured from when each operation was due rather than when it
+// started, so a stall shows up in every operation it delays instead of
+// only the one it hit (no coordinated omission).
+#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <ctime>
+#include <cstdio>
 #include <thread>
-#include <chrono>
 #include <hdr/hdr_histogram.h>
-#include <hdr/hdr_histogram_log.h>
+#include "recorder.hpp"
 
 int main() {
-    // 1) Initialize a histogram tracking [1μs–1 000 000μs] with 3 significant digits
-    struct hdr_histogram* hist = nullptr;
-    if (hdr_init(1, 1000000, 3, &hist) != 0) {
-        std::fprintf(stderr, "Failed to initialize HDR histogram\n");
-        return 1;
-    }
-    // 2) Prepare two output files: one for binary HDR-log, one for human-readable percentiles
-    FILE* log_out  = std::fopen("latency_log.hdr", "w");
-    if (!log_out) {
-        std::perror("fopen");
+    const uint64_t period_ns = 1000000;   // 1000 ops/sec
+    const int seconds = 10;
+
+    auto log = hist_log::open("latency_log.hdr");
+    if (!log) {
+        std::perror("latency_log.hdr");
         return 1;
     }
-    // 3) Set up the log writer and write a header with a tag
-    struct hdr_log_writer writer;
-    hdr_log_writer_init(&writer);
-    hdr_timespec ts_start;
-    clock_gettime(CLOCK_REALTIME, &ts_start);
-    hdr_log_write_header(&writer, log_out, "latency_measurements", &ts_start);
-    // (recording & logging example flow based on hiccup example) :contentReference[oaicite:1]{index=1}
-
-    // 4) Simulate 100 measurements
-    for (int i = 0; i < 10000; ++i) {
-      hdr_timespec t0, t1;
-        clock_gettime(CLOCK_REALTIME, &t0);
+    interval_recorder rec;   // ns
+    hdr_histogram* total = new_latency_hist();
 
-        // synthetic work: sleep 100μs
-        std::this_thread::sleep_for(
-            std::chrono::microseconds(120)
-        );
+    clock_init();
+    uint64_t start = now_ns();
+    log->header("latency_measurements", to_epoch_ns(start));
+    std::atomic<bool> running{true};
+    std::thread worker([&] {
+        for (uint64_t due = start; running.load(std::memory_order_relaxed); due += period_ns) {
+            while (now_ns() < due)
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            std::this_thread::sleep_for(std::chrono::microseconds(120));
+            rec.record(now_ns() - due);
+        }
+    });
 
-        clock_gettime(CLOCK_REALTIME, &t1);
-        // compute latency in μs
-        int64_t us = (t1.tv_sec  - t0.tv_sec ) * 1000000
-                   + (t1.tv_nsec - t0.tv_nsec) / 1000;
-        // record with coordinated-omission correction
-        hdr_record_corrected_value(hist, us, 1000);
-
-        // write one interval record to the HDR-log
-        hdr_log_write(&writer, log_out, &t0, &t1, hist);
+    uint64_t t0 = start;
+    for (int ii = 1; ii <= seconds; ii++) {
+        uint64_t t1 = start + ii * 1000000000ull;
+        while (now_ns() < t1)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        hdr_histogram* h = rec.sample();
+        log->write("", to_epoch_ns(t0), to_epoch_ns(t1), h);
+        hdr_add(total, h);
+        t0 = t1;
     }
+    running.store(false);
+    worker.join();
 
     FILE* text_out = std::fopen("latency_percentiles.txt", "w");
     if (!text_out) {
-        std::perror("fopen");
+        std::perror("latency_percentiles.txt");
         return 1;
     }
-    // 5) Dump percentiles (5 ticks per half-distance) in "CLASSIC" text format
-    hdr_percentiles_print(hist, text_out, 5, 1.0, CLASSIC);
-    // (usage from Simple Tutorial) :contentReference[oaicite:2]{index=2}
-
-    // cleanup
-    std::fclose(log_out);
+    hdr_percentiles_print(total, text_out, 5, 1000.0, CLASSIC);   // in usec
     std::fclose(text_out);
-    hdr_close(hist);
+    hdr_close(total);
     return 0;
 }
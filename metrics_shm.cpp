@@ -0,0 +1,135 @@
+#include "metrics_shm.hpp"
+#include "tsc_clock.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Slots start on a cache line after the header.
+static const size_t slots_offset = (sizeof(wlm_hdr) + 63) & ~(size_t)63;
+
+wlm_writer::wlm_writer (const std::string& name, uint32_t nslots, const std::string& agent, const std::string& mode,
+			uint64_t interval_ns) : name (name)
+{
+    shm_unlink (name.c_str ());
+    int fd = shm_open (name.c_str (), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+	throw std::runtime_error ("cannot create shared memory '" + name + "'");
+    this->len = slots_offset + nslots * sizeof(wlm_slot);
+    if (ftruncate (fd, this->len) == 0)
+	this->base = mmap (nullptr, this->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (!this->base || (this->base == MAP_FAILED)) {
+	this->base = nullptr;
+	shm_unlink (name.c_str ());
+	throw std::runtime_error ("cannot map shared memory '" + name + "'");
+    }
+
+    // The mapping starts zeroed, which is every slot's initial state.
+    this->h = (wlm_hdr *)this->base;
+    this->slots = (wlm_slot *)((uint8_t *)this->base + slots_offset);
+    this->h->version = WLM_VERSION;
+    this->h->hdr_size = sizeof(wlm_hdr);
+    this->h->slot_size = sizeof(wlm_slot);
+    this->h->nslots = nslots;
+    this->h->buckets = WLM_BUCKETS;
+    this->h->pid = getpid ();
+    this->h->start_mono_ns = now_ns ();
+    this->h->start_epoch_ns = to_epoch_ns (this->h->start_mono_ns);
+    this->h->interval_ns = interval_ns;
+    strncpy (this->h->agent, agent.c_str (), sizeof(this->h->agent) - 1);
+    strncpy (this->h->mode, mode.c_str (), sizeof(this->h->mode) - 1);
+    std::atomic_thread_fence (std::memory_order_release);
+    memcpy (this->h->magic, WLM_MAGIC, sizeof(this->h->magic));
+}
+
+wlm_writer::~wlm_writer ()
+{
+    munmap (this->base, this->len);
+    shm_unlink (this->name.c_str ());
+}
+
+wlm_slot* wlm_writer::claim (int cpu)
+{
+    auto ii = this->h->nthreads.load ();
+    do {
+	if (ii >= this->h->nslots)
+	    return nullptr;
+    } while (!this->h->nthreads.compare_exchange_weak (ii, ii + 1));
+    auto s = &this->slots[ii];
+    s->cpu.store (cpu, std::memory_order_relaxed);
+    s->active.store (1, std::memory_order_release);
+    return s;
+}
+
+wlm_reader::wlm_reader (const std::string& name)
+{
+    int fd = shm_open (name.c_str (), O_RDONLY, 0);
+    if (fd < 0)
+	throw std::runtime_error ("no shared memory '" + name + "'");
+    struct stat st;
+    if (!fstat (fd, &st) && (st.st_size >= (off_t)sizeof(wlm_hdr))) {
+	this->len = st.st_size;
+	this->base = mmap (nullptr, this->len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close (fd);
+    if (!this->base || (this->base == MAP_FAILED)) {
+	this->base = nullptr;
+	throw std::runtime_error ("'" + name + "' is not a workload metrics segment");
+    }
+
+    this->h = (const wlm_hdr *)this->base;
+    this->slots = (const wlm_slot *)((const uint8_t *)this->base + slots_offset);
+    bool ok = !memcmp (this->h->magic, WLM_MAGIC, sizeof(this->h->magic));
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (!ok || (this->h->version != WLM_VERSION) || (this->h->hdr_size != sizeof(wlm_hdr)) ||
+	(this->h->slot_size != sizeof(wlm_slot)) || (this->h->buckets != WLM_BUCKETS) || !this->h->interval_ns ||
+	(slots_offset + this->h->nslots * sizeof(wlm_slot) > this->len)) {
+	munmap (this->base, this->len);
+	this->base = nullptr;
+	throw std::runtime_error ("'" + name + "' is not a workload metrics segment of version " + std::to_string (WLM_VERSION));
+    }
+}
+
+wlm_reader::~wlm_reader ()
+{
+    if (this->base)	munmap (this->base, this->len);
+}
+
+uint64_t wlm_reader::interval (uint64_t mono_now) const
+{
+    auto t0 = this->h->start_mono_ns;
+    return (mono_now > t0) ? (mono_now - t0) / this->h->interval_ns : 0;
+}
+
+void wlm_reader::read (uint32_t ii, uint64_t iv, wlm_snapshot& out) const
+{
+    const auto& s = this->slots[ii];
+    const auto& b = s.blk[iv & 1];
+    auto ld = [](const std::atomic<uint64_t>& a) { return a.load (std::memory_order_relaxed); };
+    for (;;) {
+	uint32_t s0 = s.seq.load (std::memory_order_acquire);
+	if (s0 & 1) {
+	    sched_yield ();
+	    continue;
+	}
+	out.cpu = s.cpu.load (std::memory_order_relaxed);
+	out.active = s.active.load (std::memory_order_relaxed);
+	bool mine = (ld (b.interval) == iv);
+	for (uint32_t op = 0; op < WLM_NOPS; op++) {
+	    out.ops[op] = ld (s.ops[op]);
+	    out.errors[op] = ld (s.errors[op]);
+	    out.iv_ops[op] = mine ? ld (b.ops[op]) : 0;
+	    out.iv_errors[op] = mine ? ld (b.errors[op]) : 0;
+	    out.iv_max_ns[op] = mine ? ld (b.max_ns[op]) : 0;
+	    for (uint32_t jj = 0; jj < WLM_BUCKETS; jj++)
+		out.iv_hist[op][jj] = mine ? ld (b.hist[op][jj]) : 0;
+	}
+	std::atomic_thread_fence (std::memory_order_acquire);
+	if (s.seq.load (std::memory_order_relaxed) == s0)
+	    return;
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Live metrics of a workload run in a POSIX shared memory segment, for
+// workload_top and anything else that wants to watch without parsing
+// stdout.  Readers map it read-only, so any number of them can watch and
+// none of them can slow the workers down.
+//
+// Segment layout (host order):
+//   wlm_hdr
+//   wlm_slot[nslots]	one per worker thread
+// Each worker writes only its own slot, under that slot's seqlock: seq is
+// odd while an update is in progress, and a reader retries a copy that
+// straddled one.  A slot keeps cumulative counters and the histograms of
+// the current and previous intervals (interval_ns long, from start_mono_ns
+// on CLOCK_MONOTONIC), alternating between two blocks by interval parity.
+// The previous interval is complete once the current one has begun.
+//
+// Histogram buckets are log-linear: values under 8ns exactly, then 8 per
+// power of two (within 12.5%), the last bucket holding everything beyond.
+// The header is written last, magic after everything else, so a reader
+// that sees WLM_MAGIC sees a complete segment.
+
+#define WLM_MAGIC	"ASWLMET\1"
+#define WLM_VERSION	1
+#define WLM_BUCKETS	320
+
+enum wlm_op : uint32_t { WLM_READ, WLM_WRITE, WLM_NOPS };
+inline const char *wlm_op_name (uint32_t op)	{ return (op == WLM_READ) ? "read" : "write"; }
+
+inline uint32_t wlm_bucket (uint64_t ns)
+{
+    if (ns < 8)
+	return ns;
+    uint32_t k = 63 - __builtin_clzll (ns);
+    uint32_t b = (k - 2) * 8 + ((ns >> (k - 3)) & 7);
+    return (b < WLM_BUCKETS) ? b : WLM_BUCKETS - 1;
+}
+
+// Highest value bucket b holds.
+inline uint64_t wlm_bucket_max (uint32_t b)
+{
+    if (b < 8)
+	return b;
+    if (b == WLM_BUCKETS - 1)
+	return UINT64_MAX;
+    uint32_t k = b / 8 + 2;
+    return ((8ull + b % 8 + 1) << (k - 3)) - 1;
+}
+
+struct wlm_block
+{
+    std::atomic<uint64_t> interval;	// that these counts are for
+    std::atomic<uint64_t> ops[WLM_NOPS];
+    std::atomic<uint64_t> errors[WLM_NOPS];
+    std::atomic<uint64_t> max_ns[WLM_NOPS];
+    std::atomic<uint64_t> hist[WLM_NOPS][WLM_BUCKETS];
+};
+
+struct alignas(64) wlm_slot
+{
+    std::atomic<uint32_t> seq;
+    std::atomic<int32_t> cpu;		// -1 unpinned
+    std::atomic<uint32_t> active;	// a worker owns the slot
+    std::atomic<uint64_t> ops[WLM_NOPS];	// since the start
+    std::atomic<uint64_t> errors[WLM_NOPS];
+    wlm_block blk[2];
+
+    // Writer side, the slot's own worker only.  now_ns on CLOCK_MONOTONIC.
+    void record (uint32_t op, uint64_t now_ns, uint64_t lat_ns, bool err, uint64_t start_ns, uint64_t interval_ns);
+};
+
+struct wlm_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t hdr_size;		// sizeof(wlm_hdr) and sizeof(wlm_slot), to
+    uint32_t slot_size;		// catch a viewer built against another layout
+    uint32_t nslots;
+    uint32_t buckets;
+    int32_t pid;
+    uint64_t start_mono_ns;
+    uint64_t start_epoch_ns;
+    uint64_t interval_ns;
+    char agent[64];
+    char mode[16];
+    std::atomic<uint32_t> nthreads;	// slots handed out so far
+};
+
+// A slot's contents copied out under its seqlock.
+struct wlm_snapshot
+{
+    int32_t cpu;
+    bool active;
+    uint64_t ops[WLM_NOPS];
+    uint64_t errors[WLM_NOPS];
+    // The interval asked for, zero if the slot has no counts for it.
+    uint64_t iv_ops[WLM_NOPS];
+    uint64_t iv_errors[WLM_NOPS];
+    uint64_t iv_max_ns[WLM_NOPS];
+    uint64_t iv_hist[WLM_NOPS][WLM_BUCKETS];
+};
+
+inline void wlm_slot::record (uint32_t op, uint64_t now_ns, uint64_t lat_ns, bool err, uint64_t start_ns, uint64_t interval_ns)
+{
+    auto bump = [](std::atomic<uint64_t>& a, uint64_t n) { a.store (a.load (std::memory_order_relaxed) + n, std::memory_order_relaxed); };
+    uint64_t iv = (now_ns > start_ns) ? (now_ns - start_ns) / interval_ns : 0;
+    auto& b = this->blk[iv & 1];
+    uint32_t s = this->seq.load (std::memory_order_relaxed);
+    this->seq.store (s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    if (b.interval.load (std::memory_order_relaxed) != iv) {
+	for (uint32_t ii = 0; ii < WLM_NOPS; ii++) {
+	    b.ops[ii].store (0, std::memory_order_relaxed);
+	    b.errors[ii].store (0, std::memory_order_relaxed);
+	    b.max_ns[ii].store (0, std::memory_order_relaxed);
+	    for (auto& h : b.hist[ii])
+		h.store (0, std::memory_order_relaxed);
+	}
+	b.interval.store (iv, std::memory_order_relaxed);
+    }
+    bump (this->ops[op], 1);
+    bump (b.ops[op], 1);
+    bump (b.hist[op][wlm_bucket (lat_ns)], 1);
+    if (lat_ns > b.max_ns[op].load (std::memory_order_relaxed))
+	b.max_ns[op].store (lat_ns, std::memory_order_relaxed);
+    if (err) {
+	bump (this->errors[op], 1);
+	bump (b.errors[op], 1);
+    }
+    this->seq.store (s + 2, std::memory_order_release);
+}
+
+// The publishing side: creates the segment and hands out slots.
+class wlm_writer
+{
+public:
+    // Creates shm_open name (e.g. "/workload"), replacing any left behind.
+    // Throws std::runtime_error.
+    wlm_writer (const std::string& name, uint32_t nslots, const std::string& agent, const std::string& mode,
+		uint64_t interval_ns = 1000000000);
+    ~wlm_writer ();			// unmaps and unlinks
+    wlm_writer (const wlm_writer&) = delete;
+    wlm_writer& operator= (const wlm_writer&) = delete;
+
+    // The next free slot, nullptr once all are taken.
+    wlm_slot* claim (int cpu);
+    void release (wlm_slot *s)		{ s->active.store (0, std::memory_order_release); }
+    void record (wlm_slot *s, uint32_t op, uint64_t now_ns, uint64_t lat_ns, bool err)
+    {
+	s->record (op, now_ns, lat_ns, err, this->h->start_mono_ns, this->h->interval_ns);
+    }
+
+private:
+    std::string name;
+    void *base = nullptr;
+    size_t len = 0;
+    wlm_hdr *h = nullptr;
+    wlm_slot *slots = nullptr;
+};
+
+// Read-only mapping of a live segment.
+class wlm_reader
+{
+public:
+    // Throws std::runtime_error if name is missing or not a segment of this
+    // version.
+    explicit wlm_reader (const std::string& name);
+    ~wlm_reader ();
+    wlm_reader (const wlm_reader&) = delete;
+    wlm_reader& operator= (const wlm_reader&) = delete;
+
+    const wlm_hdr& hdr (void) const	{ return *this->h; }
+    uint32_t nthreads (void) const	{ return this->h->nthreads.load (std::memory_order_acquire); }
+    // The interval in progress at mono_now; interval - 1 is the last
+    // complete one.
+    uint64_t interval (uint64_t mono_now) const;
+    // Copies slot ii with its counts for interval iv.
+    void read (uint32_t ii, uint64_t iv, wlm_snapshot& out) const;
+
+private:
+    void *base = nullptr;
+    size_t len = 0;
+    const wlm_hdr *h = nullptr;
+    const wlm_slot *slots = nullptr;
+};
@@ -0,0 +1,229 @@
+#include "proxy_stats.hpp"
+#include "as_proto.hpp"
+#include <cstring>
+#include <endian.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+
+using json = nlohmann::json;
+
+static const char *class_names[] = { "read", "write", "batch", "info", "other" };
+
+const char *to_string (req_class c)
+{
+    return (c < req_class::n) ? class_names[(size_t)c] : "unknown";
+}
+
+pending_req classify_request (const uint8_t *frame, size_t len, uint64_t ts_ns)
+{
+    pending_req ret = { ts_ns, 0, req_class::other, false, false, {} };
+    if (frame[1] == 1) {
+	ret.cls = req_class::info;
+	return ret;
+    }
+    if ((frame[1] != 3) || (len < sizeof(as_header) + sizeof(as_msg)))
+	return ret;
+
+    // Walk fields and ops by hand, bounded by the frame; it came off the wire.
+    const uint8_t *p = frame + sizeof(as_header), *end = frame + len;
+    auto msg = (const as_msg *)p;
+    uint32_t flags = msg->flags;
+    bool has_batch = false;
+    p += sizeof(as_msg);
+    for (auto ii = be16toh (msg->be_fields); ii--; ) {
+	uint32_t sz;
+	if (p + 5 > end)	break;
+	memcpy (&sz, p, 4);
+	sz = be32toh (sz);
+	auto t = (as_field::type)p[4];
+	if ((t == as_field::type::t_digest_ripe) && (sz == 21) && (p + 4 + sz <= end)) {
+	    ret.has_digest = true;
+	    memcpy (ret.digest, p + 5, 20);
+	}
+	has_batch |= (t == as_field::type::t_batch) || (t == as_field::type::t_batch_with_set);
+	p += 4 + sz;
+    }
+    for (auto ii = be16toh (msg->be_ops); ii--; ) {
+	uint32_t sz;
+	if (p + 5 > end)	break;
+	memcpy (&sz, p, 4);
+	ret.op_mask |= 1u << (p[4] & 31);
+	p += 4 + be32toh (sz);
+    }
+
+    if ((flags & AS_MSG_FLAG_BATCH) || has_batch)	ret.cls = req_class::batch;
+    else if (flags & AS_MSG_FLAG_WRITE)			ret.cls = req_class::write;
+    else if (flags & AS_MSG_FLAG_READ)			ret.cls = req_class::read;
+    // Batch, scan and query answers stream back until a LAST frame.
+    ret.stream = (ret.cls == req_class::batch) || !ret.has_digest;
+    return ret;
+}
+
+// End of the as_msg at p, past its fields and ops, or nullptr if that
+// runs beyond end.
+static const uint8_t* msg_end (const uint8_t *p, const uint8_t *end)
+{
+    auto msg = (const as_msg *)p;
+    uint32_t n = be16toh (msg->be_fields) + be16toh (msg->be_ops);
+    p += sizeof(as_msg);
+    while (n--) {
+	uint32_t sz;
+	if (p + 4 > end)	return nullptr;
+	memcpy (&sz, p, 4);
+	p += 4 + (size_t)be32toh (sz);
+    }
+    return (p <= end) ? p : nullptr;
+}
+
+int response_result (const uint8_t *frame, size_t len, bool& last)
+{
+    last = true;
+    if ((frame[1] != 3) || (len < sizeof(as_header) + sizeof(as_msg)))
+	return -1;
+    // Batch, scan and query responses pack many msgs per frame, records
+    // first; the LAST msg, when the frame has it, carries the result.
+    const uint8_t *p = frame + sizeof(as_header), *end = frame + len;
+    auto first = (const as_msg *)p;
+    last = false;
+    while (p && (p + sizeof(as_msg) <= end)) {
+	auto msg = (const as_msg *)p;
+	if (msg->flags & AS_MSG_FLAG_LAST) {
+	    last = true;
+	    return msg->result_code;
+	}
+	p = msg_end (p, end);
+    }
+    return first->result_code;
+}
+
+const pending_req* inflight_reqs::response (const uint8_t *frame, size_t len, int& rc, bool& done)
+{
+    if (this->q.empty ())
+	return nullptr;
+    bool last;
+    rc = response_result (frame, len, last);
+    done = !this->q.front ().stream || last;
+    if (!done)
+	return &this->q.front ();
+    this->last_done = this->q.front ();
+    this->q.pop_front ();
+    return &this->last_done;
+}
+
+void proxy_stats::hist_set::record (const pending_req& req, int rc, uint64_t ns)
+{
+    auto rec = [ns](hdr_histogram*& h) {
+	if (!h)	h = new_latency_hist ();
+	hdr_record_value (h, ns);
+    };
+    rec (this->all);
+    for (uint32_t m = req.op_mask; m; m &= m - 1)
+	rec (this->op[__builtin_ctz (m)]);
+    rec (this->cls[(size_t)req.cls]);
+    if (rc >= 0)
+	rec (this->rc[rc & 255]);
+}
+
+void proxy_stats::hist_set::add (const hist_set& o)
+{
+    auto add1 = [](hdr_histogram*& dst, hdr_histogram *src) {
+	if (!src || !src->total_count)	return;
+	if (!dst)	dst = new_latency_hist ();
+	hdr_add (dst, src);
+    };
+    add1 (this->all, o.all);
+    for (size_t ii = 0; ii < 32; ii++)	add1 (this->op[ii], o.op[ii]);
+    for (size_t ii = 0; ii < (size_t)req_class::n; ii++)	add1 (this->cls[ii], o.cls[ii]);
+    for (size_t ii = 0; ii < 256; ii++)	add1 (this->rc[ii], o.rc[ii]);
+}
+
+void proxy_stats::hist_set::reset (void)
+{
+    auto r = [](hdr_histogram *h) { if (h) hdr_reset (h); };
+    r (this->all);
+    for (auto h : this->op)	r (h);
+    for (auto h : this->cls)	r (h);
+    for (auto h : this->rc)	r (h);
+}
+
+proxy_stats::hist_set::~hist_set ()
+{
+    auto c = [](hdr_histogram *h) { if (h) hdr_close (h); };
+    c (this->all);
+    for (auto h : this->op)	c (h);
+    for (auto h : this->cls)	c (h);
+    for (auto h : this->rc)	c (h);
+}
+
+proxy_stats::proxy_stats (size_t nworkers)
+{
+    for (size_t ii = 0; ii < nworkers; ii++)
+	this->slots.emplace_back (new worker_slot);
+}
+
+proxy_stats::~proxy_stats () {}
+
+void proxy_stats::record (size_t worker, const pending_req& req, int rc, uint64_t ns)
+{
+    auto& s = *this->slots[worker];
+    auto e = s.ph.enter ();
+    s.cur.load (std::memory_order_acquire)->record (req, rc, ns);
+    s.ph.exit (e);
+}
+
+// Visit every non-empty histogram of a set with its log tag.
+template <typename F>
+static void each_tagged (const F& fn, hdr_histogram *all, hdr_histogram *const *op, hdr_histogram *const *cls, hdr_histogram *const *rc)
+{
+    if (all && all->total_count)	fn (std::string (), all);
+    for (size_t ii = 0; ii < 32; ii++)
+	if (op[ii] && op[ii]->total_count) {
+	    auto name = to_string ((as_op::type)ii);
+	    fn ("op:" + (name == "unknown" ? "type" + std::to_string (ii) : name), op[ii]);
+	}
+    for (size_t ii = 0; ii < (size_t)req_class::n; ii++)
+	if (cls[ii] && cls[ii]->total_count)	fn (std::string ("class:") + class_names[ii], cls[ii]);
+    for (size_t ii = 0; ii < 256; ii++)
+	if (rc[ii] && rc[ii]->total_count)	fn ("rc:" + std::to_string (ii), rc[ii]);
+}
+
+static json hist_json (hdr_histogram *h)
+{
+    return { { "count", h->total_count }, { "p50", hdr_value_at_percentile (h, 50.0) },
+	     { "p90", hdr_value_at_percentile (h, 90.0) }, { "p99", hdr_value_at_percentile (h, 99.0) },
+	     { "p999", hdr_value_at_percentile (h, 99.9) }, { "max", hdr_max (h) } };
+}
+
+json proxy_stats::interval (hist_log *log, uint64_t t0_usec, uint64_t t1_usec)
+{
+    hist_set iv;
+    for (auto& sp : this->slots) {
+	auto old = sp->cur.exchange (sp->spare);
+	sp->ph.flip ();
+	sp->spare = old;
+	iv.add (*old);
+	old->reset ();
+    }
+    this->total.add (iv);
+
+    if (log) {
+	each_tagged ([&](const std::string& tag, hdr_histogram *h) {
+	    log->write (tag, t0_usec * 1000, t1_usec * 1000, h);
+	}, iv.all, iv.op, iv.cls, iv.rc);
+    }
+
+    json ret = { { "now", t1_usec }, { "count", 0 } };
+    if (iv.all)
+	ret.update (hist_json (iv.all));
+    return ret;
+}
+
+json proxy_stats::summary (void) const
+{
+    json ret = { { "event", "summary" }, { "count", 0 } };
+    each_tagged ([&](const std::string& tag, hdr_histogram *h) {
+	if (tag.empty ())	ret.update (hist_json (h));
+	else			ret["by_tag"][tag] = hist_json (h);
+    }, this->total.all, this->total.op, this->total.cls, this->total.rc);
+    return ret;
+}
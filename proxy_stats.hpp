@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "recorder.hpp"
+
+// Passive request latency for tcp_proxy.  Each inspected connection keeps a
+// FIFO of its outstanding requests; a response frame completes the request
+// at the head (a batch, scan or query only on the frame flagged LAST).
+// Latency is request frame complete -> response frame complete, as seen by
+// the proxy, so it covers the server and the proxy <-> server hop.  It is
+// recorded in ns.
+
+enum class req_class : uint8_t { read, write, batch, info, other, n };
+
+struct pending_req
+{
+    uint64_t ts_ns;
+    uint32_t op_mask;		// bit per as_op::type present
+    req_class cls;
+    bool stream;		// response spans frames, ends with AS_MSG_FLAG_LAST
+    bool has_digest;
+    uint8_t digest[20];
+};
+
+const char *to_string (req_class c);
+
+// Classify a whole request frame (header included).
+pending_req classify_request (const uint8_t *frame, size_t len, uint64_t ts_ns);
+// Result code of a whole response frame, -1 for info or undecodable ones,
+// and whether it ends the response.
+int response_result (const uint8_t *frame, size_t len, bool& last);
+
+// One connection's outstanding requests, oldest first.
+class inflight_reqs
+{
+public:
+    // A request frame from the client; the entry is valid until the next call.
+    const pending_req& request (const uint8_t *frame, size_t len, uint64_t ts_ns)
+    {
+	this->q.push_back (classify_request (frame, len, ts_ns));
+	return this->q.back ();
+    }
+    // The last request never reaches the server (a fault dropped it), so no
+    // response will answer it.
+    void unrequest (void)		{ if (!this->q.empty ()) this->q.pop_back (); }
+    // The request a response frame answers, nullptr if none is waiting;
+    // done when the frame completes it (and it leaves the queue), with rc
+    // from response_result.  Valid until the next call.
+    const pending_req* response (const uint8_t *frame, size_t len, int& rc, bool& done);
+    size_t size (void) const		{ return this->q.size (); }
+
+private:
+    std::deque<pending_req> q;
+    pending_req last_done;
+};
+
+class proxy_stats
+{
+public:
+    proxy_stats (size_t nworkers);
+    ~proxy_stats ();
+    void record (size_t worker, const pending_req& req, int rc, uint64_t ns);
+
+    // Called from the reporting thread only.  Writes one tagged interval
+    // line per non-empty histogram ("Tag=op:read,...", "Tag=class:write",
+    // "Tag=rc:2", and the untagged total), and returns a json line for the
+    // interval total.
+    nlohmann::json interval (hist_log *log, uint64_t t0_usec, uint64_t t1_usec);
+    // Cumulative breakdown since start.
+    nlohmann::json summary (void) const;
+
+private:
+    // One histogram per op type, class and result code, plus the total;
+    // allocated on first use.
+    struct hist_set
+    {
+	hdr_histogram *all = nullptr;
+	hdr_histogram *op[32] = {};
+	hdr_histogram *cls[(size_t)req_class::n] = {};
+	hdr_histogram *rc[256] = {};
+	void record (const pending_req& req, int rc, uint64_t ns);
+	void add (const hist_set& o);
+	void reset (void);
+	~hist_set ();
+    };
+    // Workers record into cur inside the phaser; the reporter swaps in
+    // spare, flips, and folds the old set in while the worker goes on.
+    struct worker_slot
+    {
+	wr_phaser ph;
+	std::unique_ptr<hist_set> sets[2]{std::make_unique<hist_set> (), std::make_unique<hist_set> ()};
+	std::atomic<hist_set*> cur{sets[0].get ()};
+	hist_set *spare = sets[1].get ();
+    };
+
+    std::vector<std::unique_ptr<worker_slot>> slots;
+    hist_set total;
+};
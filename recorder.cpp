@@ -0,0 +1,129 @@
+#include "recorder.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <hdr/hdr_histogram_log.h>
+#include <stdexcept>
+
+void wr_phaser::flip (void)
+{
+    bool next_odd = (this->start.load () >= 0);
+    int64_t init = next_odd ? INT64_MIN : 0;
+    (next_odd ? this->odd_end : this->even_end).store (init);
+    int64_t at_flip = this->start.exchange (init);
+    auto& end = next_odd ? this->even_end : this->odd_end;
+    while (end.load (std::memory_order_acquire) != at_flip)
+	std::this_thread::yield ();
+}
+
+interval_recorder::interval_recorder (int64_t lowest, int64_t highest, int sigfigs)
+{
+    hdr_histogram *a = nullptr;
+    if (hdr_init (lowest, highest, sigfigs, &a) || hdr_init (lowest, highest, sigfigs, &this->spare))
+	throw std::runtime_error ("interval_recorder: bad histogram range");
+    this->active.store (a);
+}
+
+interval_recorder::~interval_recorder ()
+{
+    hdr_close (this->active.load ());
+    hdr_close (this->spare);
+}
+
+hdr_histogram* interval_recorder::sample (void)
+{
+    std::lock_guard<std::mutex> lg (this->mtx);
+    hdr_reset (this->spare);
+    auto old = this->active.exchange (this->spare);
+    this->ph.flip ();
+    this->spare = old;
+    return old;
+}
+
+hist_log::hist_log (FILE *fp) : fp (fp)
+{
+    this->th = std::thread (&hist_log::run, this);
+}
+
+hist_log::~hist_log ()
+{
+    {
+	std::lock_guard<std::mutex> lg (this->mtx);
+	this->stop = true;
+    }
+    this->cv.notify_all ();
+    this->th.join ();
+    fclose (this->fp);
+}
+
+std::unique_ptr<hist_log> hist_log::open (const std::string& path)
+{
+    FILE *fp = fopen (path.c_str (), "w");
+    return fp ? std::make_unique<hist_log> (fp) : nullptr;
+}
+
+void hist_log::header (const char *tag, uint64_t start_epoch_ns)
+{
+    char *buf = nullptr;
+    size_t len = 0;
+    FILE *mf = open_memstream (&buf, &len);
+    if (!mf)
+	return;
+    hdr_log_writer writer;
+    hdr_timespec ts = { (time_t)(start_epoch_ns / 1000000000), (long)(start_epoch_ns % 1000000000) };
+    hdr_log_writer_init (&writer);
+    hdr_log_write_header (&writer, mf, tag, &ts);
+    fclose (mf);
+    {
+	std::lock_guard<std::mutex> lg (this->mtx);
+	this->todo.emplace_back (buf, len);
+	this->queued++;
+    }
+    free (buf);
+    this->cv.notify_all ();
+}
+
+void hist_log::write (const std::string& tag, uint64_t t0_epoch_ns, uint64_t t1_epoch_ns, const hdr_histogram *h)
+{
+    char *enc = nullptr;
+    if (hdr_log_encode ((hdr_histogram *)h, &enc) != 0)
+	return;
+    std::string line = tag.empty () ? std::string () : "Tag=" + tag + ",";
+    char buf[96];
+    snprintf (buf, sizeof(buf), "%.3f,%.3f,%.3f,", t0_epoch_ns / 1e9, (t1_epoch_ns - t0_epoch_ns) / 1e9, (double)hdr_max (h));
+    line += buf;
+    line += enc;
+    line += '\n';
+    free (enc);
+    {
+	std::lock_guard<std::mutex> lg (this->mtx);
+	this->todo.push_back (std::move (line));
+	this->queued++;
+    }
+    this->cv.notify_all ();
+}
+
+void hist_log::flush (void)
+{
+    std::unique_lock<std::mutex> lk (this->mtx);
+    auto target = this->queued;
+    this->cv.wait (lk, [&] { return this->written >= target; });
+}
+
+void hist_log::run (void)
+{
+    std::unique_lock<std::mutex> lk (this->mtx);
+    for (;;) {
+	this->cv.wait (lk, [this] { return this->stop || !this->todo.empty (); });
+	if (this->todo.empty ())
+	    return;
+	std::deque<std::string> batch;
+	batch.swap (this->todo);
+	lk.unlock ();
+	for (const auto& l : batch)
+	    fwrite (l.data (), 1, l.size (), this->fp);
+	fflush (this->fp);
+	lk.lock ();
+	this->written += batch.size ();
+	this->cv.notify_all ();
+    }
+}
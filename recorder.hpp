@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <hdr/hdr_histogram.h>
+#include "tsc_clock.hpp"
+
+// Latency recording shared by the tools: interval recorders that hot
+// threads write without locks, and an interval log written off the
+// reporting thread.
+//
+// Latencies are differences of now_ns () (tsc_clock.hpp), never of the
+// wall clock, and are recorded in nanoseconds.  Log timestamps are wall
+// clock, via to_epoch_ns.
+
+// Latency histograms across the tools: 1ns .. 60s at 3 digits.
+const int64_t LATENCY_HIST_MAX_NS = 60000000000ll;
+inline hdr_histogram* new_latency_hist (void)
+{
+    hdr_histogram *h = nullptr;
+    hdr_init (1, LATENCY_HIST_MAX_NS, 3, &h);
+    return h;
+}
+
+// Writer-reader phaser, as in HdrHistogram's interval recorders.  Writers
+// bracket each update with enter/exit, two uncontended atomic adds; after
+// swapping the pointer writers load, the reader calls flip, which returns
+// once every writer that could still see the old pointer has exited.
+class wr_phaser
+{
+public:
+    int64_t enter (void)		{ return this->start.fetch_add (1); }
+    void exit (int64_t e)		{ ((e < 0) ? this->odd_end : this->even_end).fetch_add (1, std::memory_order_release); }
+    // Reader side, one thread at a time.
+    void flip (void);
+
+private:
+    std::atomic<int64_t> start{0}, even_end{0}, odd_end{INT64_MIN};
+};
+
+// One interval histogram at a time, double buffered: record () goes to the
+// active histogram, sample () swaps in the cleared spare and hands back the
+// interval just ended.  record () is for one writer thread; shared
+// recorders use record_atomic ().
+class interval_recorder
+{
+public:
+    // Defaults to the latency histograms' range, in ns.
+    interval_recorder (int64_t lowest = 1, int64_t highest = LATENCY_HIST_MAX_NS, int sigfigs = 3);
+    ~interval_recorder ();
+    interval_recorder (const interval_recorder&) = delete;
+    interval_recorder& operator= (const interval_recorder&) = delete;
+
+    bool record (int64_t v)
+    {
+	auto e = this->ph.enter ();
+	bool ok = hdr_record_value (this->active.load (std::memory_order_acquire), v);
+	this->ph.exit (e);
+	return ok;
+    }
+    bool record_atomic (int64_t v)
+    {
+	auto e = this->ph.enter ();
+	bool ok = hdr_record_value_atomic (this->active.load (std::memory_order_acquire), v);
+	this->ph.exit (e);
+	return ok;
+    }
+    // The interval since the last call; owned by the recorder and valid
+    // until the next one.  Reader side.
+    hdr_histogram* sample (void);
+
+private:
+    wr_phaser ph;
+    std::atomic<hdr_histogram*> active;
+    hdr_histogram *spare;
+    std::mutex mtx;
+};
+
+// An HdrHistogram interval log whose file writes happen on its own thread,
+// so a slow disk never stalls the thread closing intervals.  Lines are
+// "[Tag=tag,]start,length,max,histogram", as hdr_decoder reads them.
+class hist_log
+{
+public:
+    // Takes fp over and closes it once everything queued is written.
+    explicit hist_log (FILE *fp);
+    ~hist_log ();
+    // nullptr, with errno set, if path cannot be created.
+    static std::unique_ptr<hist_log> open (const std::string& path);
+
+    void header (const char *tag, uint64_t start_epoch_ns);
+    // Encodes h now; an empty tag writes an untagged line.
+    void write (const std::string& tag, uint64_t t0_epoch_ns, uint64_t t1_epoch_ns, const hdr_histogram *h);
+    // Returns once everything queued so far is written and flushed.
+    void flush (void);
+
+private:
+    void run (void);
+
+    FILE *fp;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::string> todo;
+    uint64_t queued = 0, written = 0;
+    bool stop = false;
+    std::thread th;
+};
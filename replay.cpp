@@ -0,0 +1,414 @@
+// Replays captured client traffic against a cluster.
+//
+// Usage: ./replay [key=value ...]	(REPLAY_ prefix in the environment)
+//
+// INPUT is a tcp_proxy capture file (CAPTURE=) or, failing that, hex lines
+// of whole frames as aswire2json reads them; "-" is stdin.  Only client ->
+// server frames are sent.  Each captured connection is mapped, in order of
+// first appearance, onto one of CONNS replay connections, so every
+// connection's requests go out in their captured order.
+//
+// TIMING=original sends each frame at its captured offset from the start of
+// the capture divided by SPEED; a connection that falls behind sends as soon
+// as it can, and the lag is reported.  TIMING=max ignores the timestamps.
+// Either way at most WINDOW requests are outstanding per connection (the
+// server answers a connection's requests in order).  Hex lines carry no
+// timestamps and are dealt round robin over the connections, as fast as
+// possible.
+//
+// Latency is request sent -> last response frame, broken down by op type,
+// class and result code like tcp_proxy STATS, and written to HLOG with the
+// same tags.
+
+#include "as_proto.hpp"
+#include "capture.hpp"
+#include "config.hpp"
+#include "frame.hpp"
+#include "proxy_stats.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+using namespace std;
+
+struct replay_cfg
+{
+  string asdb;
+  string input;
+  string hlog;
+  bool original;
+  double speed;
+  int conns;
+  int window;
+  int interval;
+  bool info;
+  size_t queue_bytes;
+} g_cfg;
+
+atomic<bool> g_running;
+void sigint_handler (int) { g_running.store (false); }
+
+struct replay_frame
+{
+  uint64_t due_ns;		// offset from the start of the replay
+  bool timed;			// due_ns is a captured offset, lag is meaningful
+  vector<uint8_t> bytes;
+};
+
+// Frames for one replay connection.  The reader blocks once queue_bytes
+// are waiting, which bounds memory for captures of any size.
+class frame_queue
+{
+public:
+  // False if the connection has given up; the frame is discarded.
+  bool push (replay_frame&& f)
+  {
+    unique_lock<mutex> lk (this->mtx);
+    while (!this->dead && (this->bytes >= g_cfg.queue_bytes) && g_running.load ())
+      this->cv.wait_for (lk, chrono::milliseconds (100));
+    if (this->dead)
+      return false;
+    this->bytes += f.bytes.size ();
+    this->q.push_back (std::move (f));
+    this->cv.notify_all ();
+    return true;
+  }
+  // 1 with a frame, 0 if none is ready, -1 once closed and empty.
+  int pop (replay_frame& f, bool wait)
+  {
+    unique_lock<mutex> lk (this->mtx);
+    if (wait)
+      this->cv.wait_for (lk, chrono::milliseconds (100), [this] { return !this->q.empty () || this->closed; });
+    if (this->q.empty ())
+      return this->closed ? -1 : 0;
+    f = std::move (this->q.front ());
+    this->q.pop_front ();
+    this->bytes -= f.bytes.size ();
+    this->cv.notify_all ();
+    return 1;
+  }
+  // No more input.
+  void close (void)
+  {
+    lock_guard<mutex> lg (this->mtx);
+    this->closed = true;
+    this->cv.notify_all ();
+  }
+  // The connection failed; drop what is queued and anything pushed later.
+  void abandon (void)
+  {
+    lock_guard<mutex> lg (this->mtx);
+    this->dead = this->closed = true;
+    this->q.clear ();
+    this->bytes = 0;
+    this->cv.notify_all ();
+  }
+
+private:
+  mutex mtx;
+  condition_variable cv;
+  deque<replay_frame> q;
+  size_t bytes = 0;
+  bool closed = false;
+  bool dead = false;
+};
+
+struct conn_result
+{
+  uint64_t sent = 0;
+  uint64_t done = 0;
+  uint64_t late = 0;		// sent over 1ms behind schedule
+  uint64_t max_lag_ns = 0;
+  string error;
+};
+
+static bool send_all (int fd, const uint8_t *p, size_t n)
+{
+  while (n) {
+    ssize_t r = send (fd, p, n, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    p += r;
+    n -= r;
+  }
+  return true;
+}
+
+void conn_entry (size_t idx, frame_queue& q, proxy_stats& stats, uint64_t t0_ns, conn_result& res)
+{
+  int fd = tcp_connect (g_cfg.asdb);
+  frame_reassembler fr;
+  deque<pending_req> inflight;
+  vector<uint8_t> rbuf (64 * 1024);
+  replay_frame next;
+  bool have = false, eof = false;
+
+  auto on_response = [&](const uint8_t *f, size_t len) {
+    uint64_t now = now_ns ();
+    if (inflight.empty ())
+      return;
+    bool last;
+    int rc = response_result (f, len, last);
+    auto& req = inflight.front ();
+    if (req.stream && !last)
+      return;
+    stats.record (idx, req, rc, now - req.ts_ns);
+    inflight.pop_front ();
+    res.done++;
+  };
+
+  while (g_running.load ()) {
+    if (!have && !eof) {
+      // Block on the queue only when there is nothing to read meanwhile.
+      int r = q.pop (next, inflight.empty ());
+      have = (r > 0);
+      eof = (r < 0);
+    }
+    if (eof && inflight.empty ())
+      break;
+
+    int timeout_ms = 1;
+    if (have && (inflight.size () < (size_t)g_cfg.window)) {
+      uint64_t now = now_ns (), due = t0_ns + next.due_ns;
+      if (due <= now) {
+	if (next.timed) {
+	  res.max_lag_ns = max (res.max_lag_ns, now - due);
+	  res.late += (now - due > 1000000);
+	}
+	inflight.push_back (classify_request (next.bytes.data (), next.bytes.size (), now));
+	if (!send_all (fd, next.bytes.data (), next.bytes.size ())) {
+	  res.error = string ("send: ") + strerror (errno);
+	  break;
+	}
+	res.sent++;
+	have = false;
+	continue;
+      }
+      timeout_ms = min<uint64_t> (100, (due - now) / 1000000);
+    } else if (eof || have) {
+      timeout_ms = 100;
+    }
+
+    pollfd pfd = { fd, POLLIN, 0 };
+    int pr = poll (&pfd, 1, timeout_ms);
+    if (pr <= 0)
+      continue;
+    ssize_t n = recv (fd, rbuf.data (), rbuf.size (), 0);
+    if (n <= 0) {
+      res.error = n ? string ("recv: ") + strerror (errno) : "closed by server";
+      break;
+    }
+    if (!fr.feed (rbuf.data (), n, on_response)) {
+      res.error = string ("response stream: ") + fr.error_str ();
+      break;
+    }
+  }
+
+  if (!res.error.empty ())
+    q.abandon ();
+  close (fd);
+}
+
+// Feeds the connection queues from a capture file, or from hex lines when
+// INPUT is not one.  Returns the number of frames queued.
+uint64_t reader_entry (vector<unique_ptr<frame_queue>>& qs)
+{
+  uint64_t nframes = 0;
+  auto keep = [](const uint8_t *p, size_t len) {
+    return (len >= sizeof(as_header)) && ((p[1] == 3) || (p[1] == 4) || ((p[1] == 1) && g_cfg.info));
+  };
+
+  unique_ptr<capture_reader> cr;
+  if (g_cfg.input != "-") {
+    try {
+      cr.reset (new capture_reader (g_cfg.input));
+    } catch (const exception&) {
+      // Not a capture; read it as hex lines.
+    }
+  }
+
+  if (cr) {
+    if (!cr->complete ())
+      fprintf (stderr, "%s: no index, capture was cut short\n", g_cfg.input.c_str ());
+    uint64_t ts0 = UINT64_MAX;
+    for (const auto& b : cr->blocks ())
+      ts0 = min (ts0, b.first_ts);
+    unordered_map<uint64_t,size_t> conn_map;
+    cap_frame f;
+    while (g_running.load () && cr->next (f)) {
+      if ((f.dir != 0) || !keep (f.data, f.len))
+	continue;
+      auto it = conn_map.emplace (f.conn_id, conn_map.size () % qs.size ()).first;
+      uint64_t due = g_cfg.original ? (uint64_t)((f.ts_ns - min (f.ts_ns, ts0)) / g_cfg.speed) : 0;
+      if (qs[it->second]->push ({ due, g_cfg.original, vector<uint8_t> (f.data, f.data + f.len) }))
+	nframes++;
+    }
+  } else {
+    ifstream ifs;
+    if (g_cfg.input != "-") {
+      ifs.open (g_cfg.input);
+      if (!ifs) {
+	fprintf (stderr, "%s: %s\n", g_cfg.input.c_str (), strerror (errno));
+	g_running.store (false);
+      }
+    }
+    istream& is = (g_cfg.input == "-") ? cin : ifs;
+    string hline;
+    uint64_t lineno = 0;
+    while (g_running.load () && getline (is, hline)) {
+      lineno++;
+      hline.erase (remove_if (hline.begin (), hline.end (), ::isspace), hline.end ());
+      if (hline.empty ())
+	continue;
+      if ((hline.size () % 2) || (hline.find_first_not_of ("0123456789abcdefABCDEF") != string::npos)) {
+	fprintf (stderr, "line %lu: not a hex frame\n", lineno);
+	continue;
+      }
+      vector<uint8_t> buf (hline.size () / 2);
+      from_hex (buf.data (), hline.c_str (), buf.size ());
+      if ((buf.size () < sizeof(as_header)) || (((as_header *)buf.data ())->size () + sizeof(as_header) != buf.size ())) {
+	fprintf (stderr, "line %lu: frame length does not match its header\n", lineno);
+	continue;
+      }
+      if (!keep (buf.data (), buf.size ()))
+	continue;
+      if (qs[nframes % qs.size ()]->push ({ 0, false, std::move (buf) }))
+	nframes++;
+    }
+  }
+
+  for (auto& q : qs)
+    q->close ();
+  return nframes;
+}
+
+config make_config (void)
+{
+  using t = config_opt::type;
+  return config ("REPLAY_", {
+    { "ASDB",		t::t_string,	"localhost:3000",	"target node host:port" },
+    { "CONNS",		t::t_int,	"8",			"replay connections", 1, 4096 },
+    { "HLOG",		t::t_string,	"",			"tagged HdrHistogram interval log path" },
+    { "INFO",		t::t_bool,	"0",			"replay info requests too" },
+    { "INPUT",		t::t_string,	"-",			"capture file or hex lines, - for stdin" },
+    { "INTERVAL",	t::t_int,	"1",			"seconds per report line", 1 },
+    { "QUEUE_MB",	t::t_int,	"16",			"frames read ahead per connection, MB", 1 },
+    { "SPEED",		t::t_float,	"1",			"time scale for original timing, 2 is twice as fast", 0.001 },
+    { "TIMING",		t::t_string,	"original",		"send at captured offsets, or as fast as the window allows", 0, 0, { "original", "max" } },
+    { "WINDOW",		t::t_int,	"1",			"requests outstanding per connection", 1, 1024 },
+  });
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  config cfg = make_config ();
+  config_load_or_die (cfg, argc, argv, envp);
+  g_cfg.asdb = cfg.s ("ASDB");
+  g_cfg.input = cfg.s ("INPUT");
+  g_cfg.hlog = cfg.s ("HLOG");
+  g_cfg.original = (cfg.s ("TIMING") == "original");
+  g_cfg.speed = cfg.f ("SPEED");
+  g_cfg.conns = cfg.i ("CONNS");
+  g_cfg.window = cfg.i ("WINDOW");
+  g_cfg.interval = cfg.i ("INTERVAL");
+  g_cfg.info = cfg.b ("INFO");
+  g_cfg.queue_bytes = (size_t)cfg.i ("QUEUE_MB") << 20;
+
+  unique_ptr<hist_log> hlog;
+  if (!g_cfg.hlog.empty ()) {
+    if (!(hlog = hist_log::open (g_cfg.hlog))) {
+      fprintf (stderr, "%s: %s\n", g_cfg.hlog.c_str (), strerror (errno));
+      return 1;
+    }
+    hlog->header ("replay", usec_now () * 1000);
+  }
+
+  signal (SIGINT, sigint_handler);
+  signal (SIGTERM, sigint_handler);
+  signal (SIGPIPE, SIG_IGN);
+  g_running.store (true);
+
+  printf ("%s\n", json ({ { "config", cfg.to_json () } }).dump ().c_str ());
+  fflush (stdout);
+
+  proxy_stats stats (g_cfg.conns);
+  vector<unique_ptr<frame_queue>> qs;
+  vector<conn_result> results (g_cfg.conns);
+  vector<thread> threads;
+  atomic<int> live (g_cfg.conns);
+  uint64_t t0_ns = now_ns ();
+  for (int ii = 0; ii < g_cfg.conns; ii++)
+    qs.emplace_back (new frame_queue);
+  for (int ii = 0; ii < g_cfg.conns; ii++)
+    threads.emplace_back ([&, ii] {
+      conn_entry (ii, *qs[ii], stats, t0_ns, results[ii]);
+      live--;
+    });
+  uint64_t nframes = 0;
+  thread reader ([&] { nframes = reader_entry (qs); });
+
+  // Interval reports, aligned to the wall clock, until every connection
+  // has drained its queue.
+  uint64_t ivl = g_cfg.interval * 1000000ull, t0 = usec_now ();
+  while (g_running.load () && live.load ()) {
+    uint64_t tnext = (usec_now () / ivl + 1) * ivl;
+    while (g_running.load () && live.load () && (usec_now () < tnext))
+      this_thread::sleep_for (chrono::milliseconds (10));
+    if (usec_now () < tnext)
+      break;
+    printf ("%s\n", stats.interval (hlog.get (), t0, tnext).dump ().c_str ());
+    fflush (stdout);
+    t0 = tnext;
+  }
+  g_running.store (false);
+  reader.join ();
+  for (auto& th : threads)
+    th.join ();
+
+  printf ("%s\n", stats.interval (hlog.get (), t0, usec_now ()).dump ().c_str ());
+  json js = stats.summary ();
+  conn_result tot;
+  json errs = json::array ();
+  for (size_t ii = 0; ii < results.size (); ii++) {
+    const auto& r = results[ii];
+    tot.sent += r.sent;
+    tot.done += r.done;
+    tot.late += r.late;
+    tot.max_lag_ns = max (tot.max_lag_ns, r.max_lag_ns);
+    if (!r.error.empty ())
+      errs.push_back ({ { "conn", ii }, { "error", r.error } });
+  }
+  js["frames"] = nframes;
+  js["sent"] = tot.sent;
+  js["completed"] = tot.done;
+  js["late"] = tot.late;
+  js["max_lag_us"] = tot.max_lag_ns / 1000;
+  js["secs"] = (now_ns () - t0_ns) / 1e9;
+  if (!errs.empty ())
+    js["conn_errors"] = errs;
+  printf ("%s\n", js.dump ().c_str ());
+  hlog.reset ();
+  return errs.empty () ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include "server_latency.hpp"
+#include "as_proto.hpp"
+#include "info_parse.hpp"
+#include "recorder.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+hdr_histogram* to_hdr (const info_latency& sh, double secs)
+{
+    hdr_histogram *h = new_latency_hist ();
+    double ops = sh.ops_per_sec * secs;
+    int64_t unit = sh.usec ? 1000 : 1000000;
+    // Bucket k holds ops in (2^(k-1), 2^k] units; the last is open ended.
+    double above = 100.0;
+    for (size_t k = 0; k <= sh.pct_over.size (); k++) {
+	double over = (k < sh.pct_over.size ()) ? sh.pct_over[k] : 0.0;
+	auto n = (int64_t)std::llround (ops * std::max (0.0, above - over) / 100.0);
+	if (n > 0)
+	    hdr_record_values (h, std::min<int64_t> (unit << k, LATENCY_HIST_MAX_NS), n);
+	above = over;
+    }
+    return h;
+}
+
+server_latency_log::server_latency_log (const std::vector<std::string>& nodes, FILE *log) : log (log)
+{
+    for (const auto& hp : nodes)
+	this->nodes.push_back ({ hp, addr_resolve (hp) });
+    this->th = std::thread (&server_latency_log::run, this);
+}
+
+server_latency_log::~server_latency_log ()
+{
+    {
+	std::lock_guard<std::mutex> lg (this->mtx);
+	this->stop = true;
+    }
+    this->cv.notify_one ();
+    this->th.join ();
+    for (auto& n : this->nodes)
+	if (n.fd >= 0)	close (n.fd);
+}
+
+void server_latency_log::write_header (uint64_t start_usec)
+{
+    hdr_log_writer writer;
+    hdr_timespec ts = { (time_t)(start_usec / 1000000), (long)(start_usec % 1000000) * 1000 };
+    hdr_log_writer_init (&writer);
+    hdr_log_write_header (&writer, this->log, "server latencies", &ts);
+    fflush (this->log);
+}
+
+void server_latency_log::sample (uint64_t t0_usec, uint64_t t1_usec)
+{
+    {
+	std::lock_guard<std::mutex> lg (this->mtx);
+	// A stuck node must not let intervals pile up.
+	if (this->todo.size () >= 4)
+	    this->todo.pop_front ();
+	this->todo.push_back ({ t0_usec, t1_usec });
+    }
+    this->cv.notify_one ();
+}
+
+void server_latency_log::run (void)
+{
+    std::unique_lock<std::mutex> lk (this->mtx);
+    for (;;) {
+	this->cv.wait (lk, [this] { return this->stop || !this->todo.empty (); });
+	// Intervals already queued are still written on the way out.
+	if (this->todo.empty ())
+	    return;
+	auto iv = this->todo.front ();
+	this->todo.pop_front ();
+	lk.unlock ();
+	this->poll (iv.first, iv.second);
+	lk.lock ();
+    }
+}
+
+void server_latency_log::poll (uint64_t t0_usec, uint64_t t1_usec)
+{
+    for (auto& n : this->nodes) {
+	if (n.fd < 0) {
+	    timeval tv = { 2, 0 };
+	    n.fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	    setsockopt (n.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	    setsockopt (n.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	    if ((n.fd >= 0) && connect (n.fd, (sockaddr *)n.addr.data (), n.addr.size ())) {
+		close (n.fd);
+		n.fd = -1;
+	    }
+	}
+	std::string resp;
+	bool ok = (n.fd >= 0) && call_info (n.fd, resp, "latencies:\n");
+	if (!ok && (n.fd >= 0)) {
+	    close (n.fd);
+	    n.fd = -1;
+	}
+	if (ok != n.up)
+	    fprintf (stderr, "server latencies from %s: %s\n", n.hostport.c_str (), ok ? "resumed" : "unavailable");
+	n.up = ok;
+	if (!ok)
+	    continue;
+
+	auto val = info_split (info_list (resp, '\n').at (0).value_or (""), '\t').value;
+	for (const auto& sh : info_latencies (val)) {
+	    auto h = to_hdr (sh, (t1_usec - t0_usec) / 1e6);
+	    char *enc = nullptr;
+	    if (h->total_count && (hdr_log_encode (h, &enc) == 0)) {
+		auto tag = "server/" + n.hostport + "/" + (sh.ns.empty () ? "" : sh.ns + "/") + sh.name;
+		fprintf (this->log, "Tag=%s,%.3f,%.3f,%.3f,%s\n", tag.c_str (), t0_usec / 1e6, (t1_usec - t0_usec) / 1e6,
+			 (double)hdr_max (h), enc);
+		free (enc);
+	    }
+	    hdr_close (h);
+	}
+    }
+    fflush (this->log);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "info_parse.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct hdr_histogram;
+
+// Server side latency from the info command latencies:, written as an
+// HdrHistogram interval log next to the client's, so the two can be read
+// and subtracted interval by interval.
+//
+// The server reports, per histogram, ops/sec and the percentage of ops
+// over 2^k ms (or us) thresholds.  A bucket's ops are recorded at its
+// upper bound, so the log's percentiles are upper bounds on the server's,
+// at power of two resolution.  The server refreshes these figures every
+// ticker-interval; set that to the client's reporting interval for the
+// intervals to mean the same thing.
+
+// Spreads ops_per_sec * secs ops over the buckets, in ns like the
+// workload's histograms.  Caller closes.
+hdr_histogram* to_hdr (const info_latency& sh, double secs);
+
+// Polls latencies: on every node from a background thread, whenever the
+// owner closes an interval, and writes one line per node and histogram
+// tagged "server/<node>/<ns>/<name>" with the owner's interval bounds.
+class server_latency_log
+{
+public:
+    server_latency_log (const std::vector<std::string>& nodes, FILE *log);
+    ~server_latency_log ();
+    void write_header (uint64_t start_usec);
+    // Queues a poll for [t0_usec, t1_usec); never blocks on the network.
+    void sample (uint64_t t0_usec, uint64_t t1_usec);
+
+private:
+    void run (void);
+    void poll (uint64_t t0_usec, uint64_t t1_usec);
+
+    struct node
+    {
+	std::string hostport;
+	std::vector<uint8_t> addr;
+	int fd = -1;
+	bool up = true;
+    };
+    std::vector<node> nodes;
+    FILE *log;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::pair<uint64_t,uint64_t>> todo;
+    bool stop = false;
+    std::thread th;
+};
@@ -0,0 +1,41 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <cmath>
+
+uint64_t percentile (std::vector<uint64_t>& v, double pct)
+{
+    if (v.empty ())	return 0;
+    size_t rank = (size_t)std::ceil ((pct / 100.0) * v.size ());
+    rank = std::clamp<size_t> (rank, 1, v.size ()) - 1;
+    std::nth_element (v.begin (), v.begin () + rank, v.end ());
+    return v[rank];
+}
+
+double coeff_var (const std::deque<double>& v)
+{
+    if (v.size () < 2)	return 0.0;
+    double sum = 0.0, sq = 0.0;
+    for (auto x : v)	sum += x;
+    double mean = sum / v.size ();
+    if (mean == 0.0)	return HUGE_VAL;
+    for (auto x : v)	sq += (x - mean) * (x - mean);
+    return std::sqrt (sq / (v.size () - 1)) / mean;
+}
+
+steady_detector::steady_detector (size_t _window, double _max_cv) :
+    window (std::max<size_t> (_window, 2)),
+    max_cv (_max_cv) {}
+
+bool steady_detector::add (double _tput, double _p99)
+{
+    this->tput.push_back (_tput);
+    this->p99.push_back (_p99);
+    if (this->tput.size () > this->window) {
+	this->tput.pop_front ();
+	this->p99.pop_front ();
+    }
+    return (this->tput.size () == this->window)
+	&& std::none_of (this->tput.begin (), this->tput.end (), [](double t) { return t <= 0.0; })
+	&& (this->cv_tput () <= this->max_cv)
+	&& (this->cv_p99 () <= this->max_cv);
+}
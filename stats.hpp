@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Small summary statistics shared by the workload reporters.
+
+// Value at percentile pct (0-100) of v; reorders v.  0 if v is empty.
+uint64_t percentile (std::vector<uint64_t>& v, double pct);
+// Sample standard deviation over mean, 0 for fewer than two samples and
+// +inf for a zero mean, which no bound accepts as steady.
+double coeff_var (const std::deque<double>& v);
+
+// Declares steady state once the last `window` intervals have both a
+// throughput and a p99 coefficient of variation at or below `max_cv`.
+// A window holding an interval without throughput, a stall, never is.
+class steady_detector
+{
+public:
+    steady_detector (size_t window, double max_cv);
+    bool add (double tput, double p99);
+    double cv_tput (void) const	{ return coeff_var (this->tput); }
+    double cv_p99 (void) const	{ return coeff_var (this->p99); }
+
+private:
+    size_t window;
+    double max_cv;
+    std::deque<double> tput;
+    std::deque<double> p99;
+};
@@ -1,185 +1,812 @@
 // TCP proxy that captures wire protocol bytes between client and Aerospike server
-// Usage: ./tcp_proxy <listen_port> <target_host:port>
-// Example: ./tcp_proxy 7000 localhost:3000
-
+// Usage: ./tcp_proxy <listen_port> <target_host:port> [key=value ...]
+// Example: ./tcp_proxy 7000 localhost:3000 cpus=2-5 dump=0
+//
+// Each worker thread owns an epoll loop and its own SO_REUSEPORT listener, so
+// the kernel spreads new connections across workers and a connection never
+// leaves the worker that accepted it.  Sockets are non-blocking; bytes a slow
+// peer cannot take yet are queued, and reading from the other side stops once
+// the queue passes the high watermark (resuming below the low watermark).
+//
+// Connections that are neither dumped nor captured (or fall outside the
+// SAMPLE fraction) never touch user space: each direction is splice()d
+// socket -> pipe -> socket, and the pipe doubles as that direction's queue.
+// Sampled connections take the recv()/send() path since the bytes are needed
+// anyway; their frames go to the hex dump and/or to CAPTURE, a binary file
+// written from its own thread (see capture.hpp).  With STATS on, requests
+// are matched to responses per connection for passive latency histograms
+// (see proxy_stats.hpp).
+//
+// FAULT_DIR turns on fault injection (see fault.hpp): frames in that
+// direction are parked in an ordered per-connection hold queue and released
+// by a per-worker timer wheel, driven by a timerfd in the same epoll set, so
+// a delayed or throttled connection never stalls its neighbours.
+
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <vector>
 #include <thread>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <string>
 #include <cstring>
+#include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <arpa/inet.h>
+#include <signal.h>
+#include <time.h>
+#include "affinity.hpp"
+#include "capture.hpp"
+#include "config.hpp"
+#include "fault.hpp"
+#include "frame.hpp"
+#include "proxy_stats.hpp"
+#include "timer_wheel.hpp"
 #include "util.hpp"
 
+using json = nlohmann::json;
 using namespace std;
 
+struct proxy_opts {
+    vector<uint8_t> target;	// resolved sockaddr
+    string target_name;
+    size_t hiwat;
+    size_t lowat;
+    bool dump;
+    size_t max_frame;
+    double sample;		// fraction of connections dumped
+    bool splice;
+    capture_writer* cap;	// nullptr unless CAPTURE is set
+    proxy_stats* stats;		// nullptr unless STATS is set
+    const fault_opts* faults;	// nullptr unless FAULT_DIR is set
+};
+
+static mutex g_out_mtx;
+static atomic<uint64_t> g_conn_id{0};
+static atomic<bool> g_stop{false};
+
+static void stop_handler(int) { g_stop.store(true); }
+
+static void out_line(const string& str) {
+    lock_guard<mutex> lg(g_out_mtx);
+    cout << str;
+    cout.flush();
+}
+
+// Dump one whole frame, header included, as handed out by frame_reassembler.
 void hex_dump(const string& label, const uint8_t* data, size_t len) {
     // Skip info protocol messages (type 0x01), only show database protocol (type 0x03)
-    if (len >= 2 && data[0] == 0x02 && data[1] == 0x01) {
+    if (data[1] == 0x01) {
         return; // Skip info messages
     }
 
-    cout << "\n========== " << label << " (" << len << " bytes) ==========\n";
+    // Format off to the side so workers do not interleave their dumps
+    ostringstream os;
+    os << "\n========== " << label << " (" << len << " bytes) ==========\n";
     for (size_t i = 0; i < len; i++) {
-        cout << hex << setw(2) << setfill('0') << (int)data[i] << " ";
-        if ((i + 1) % 16 == 0) cout << "\n";
+        os << hex << setw(2) << setfill('0') << (int)data[i] << " ";
+        if ((i + 1) % 16 == 0) os << "\n";
     }
-    if (len % 16 != 0) cout << "\n";
-    cout << dec;
-	cout << to_json((as_msg*)(data + 8)).dump() << "\n";
-    cout.flush();
-
+    if (len % 16 != 0) os << "\n";
+    os << dec;
+    if (data[1] == 0x03 && len >= sizeof(as_header) + sizeof(as_msg)) {
+        string js;
+        to_json(js, (const as_msg*)(data + 8), len - 8);
+        os << js << "\n";
+    }
+    out_line(os.str());
 }
 
-void proxy_connection(int client_fd, const string& target) {
-    // Connect to target server
-    int server_fd, one = 1;
-    auto ab = addr_resolve(target);
+// Bytes read from one side and not yet written to the other.
+struct dir_buf {
+    vector<uint8_t> data;
+    size_t head = 0;
+
+    size_t size() const { return data.size() - head; }
+    const uint8_t* ptr() const { return data.data() + head; }
+    void append(const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); }
+    void consume(size_t n) {
+        head += n;
+        if (head == data.size()) {
+            data.clear();
+            head = 0;
+        } else if (head > 65536 && head * 2 > data.size()) {
+            data.erase(data.begin(), data.begin() + head);
+            head = 0;
+        }
+    }
+};
+
+enum { CLIENT = 0, SERVER = 1 };
+
+struct proxy_conn;
+
+// epoll_event.data.ptr for one socket of a connection; nullptr is the
+// listener and &timer_ep the fault timerfd.
+struct endpoint {
+    proxy_conn* conn;
+    int side;
+};
+static endpoint timer_ep = {nullptr, -1};
+
+// A frame parked by fault injection until release_ns (monotonic).
+struct held_frame {
+    uint64_t release_ns;
+    vector<uint8_t> bytes;
+};
+
+struct proxy_conn {
+    uint64_t id;
+    int fd[2] = {-1, -1};
+    endpoint ep[2];
+    dir_buf out[2];		// out[i] is pending for fd[i]
+    frame_reassembler frames[2];	// frames[i] splits what fd[i] sends
+    inflight_reqs inflight;	// requests awaiting a response
+    uint32_t events[2] = {0, 0};	// current epoll interest
+    bool connected = false;	// server connect() finished
+    bool rd_eof[2] = {false, false};
+    bool wr_shut[2] = {false, false};
+    bool paused[2] = {false, false};	// reading fd[i] held back by backpressure
+    bool dead = false;
+    bool sampled = false;	// dumped/captured, so forwarded through user space
+    bool spliced = false;	// forwarded through the pipes below
+    int pipe_rd[2] = {-1, -1};	// pipe i feeds fd[i]
+    int pipe_wr[2] = {-1, -1};
+    size_t in_pipe[2] = {0, 0};
+    bool pipe_full[2] = {false, false};
+    size_t pipe_cap = 0;
+    bool faulty = false;	// frames pass through the hold queues below
+    deque<held_frame> held[2];	// held[i] is parked for fd[i], in order
+    size_t held_bytes[2] = {0, 0};
+    uint64_t last_release[2] = {0, 0};
+    double tokens[2] = {0, 0};	// bandwidth bucket, may go negative
+    uint64_t refill_ns[2] = {0, 0};
+    bool timer_set[2] = {false, false};
+
+    size_t queued(int i) const { return out[i].size() + in_pipe[i] + held_bytes[i]; }
+    bool finished() const { return rd_eof[CLIENT] && rd_eof[SERVER] && !queued(CLIENT) && !queued(SERVER); }
+};
+
+class proxy_worker {
+public:
+    proxy_worker(int idx, int listen_fd, int cpu, const proxy_opts& opts) :
+        idx(idx), listen_fd(listen_fd), cpu(cpu), opts(opts) {}
+    void run();
+
+private:
+    void accept_all();
+    void handle(proxy_conn* c, int side, uint32_t ev);
+    bool open_pipes(proxy_conn* c);
+    bool read_side(proxy_conn* c, int side);
+    bool splice_in(proxy_conn* c, int side);
+    bool flush_side(proxy_conn* c, int side);
+    void on_frame(proxy_conn* c, int side, uint64_t ts, const uint8_t* f, size_t len);
+    void update(proxy_conn* c);
+    void close_conn(proxy_conn* c, const char* why);
+    void reset_conn(proxy_conn* c);
+    void release(proxy_conn* c, int side);
+    void on_timer();
+    void arm_timer();
+
+    int idx;
+    int listen_fd;
+    int cpu;
+    const proxy_opts& opts;
+    int epfd = -1;
+    vector<uint8_t> rbuf;
+    vector<proxy_conn*> graveyard;
+    mt19937_64 rng;
+    uniform_real_distribution<double> unif{0.0, 1.0};
+    // Fault injection, set up only when opts.faults is
+    unique_ptr<fault_plan> plan;
+    unique_ptr<timer_wheel<pair<proxy_conn*, int>>> wheel;
+    int tfd = -1;
+    uint64_t armed_ns = UINT64_MAX;
+};
+
+void proxy_worker::run() {
+    // Pin first so the read buffer below is faulted in on the local node
+    if (cpu >= 0 && !pin_thread(cpu)) {
+        cerr << "Failed to pin to cpu " << cpu << "\n";
+    }
+    rbuf.resize(65536);
+    rng.seed(random_device{}() + idx);
+
+    dieunless((epfd = epoll_create1(EPOLL_CLOEXEC)) >= 0);
+    epoll_event lev = {};
+    lev.events = EPOLLIN;
+    lev.data.ptr = nullptr;
+    dieunless(epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &lev) == 0);
+
+    if (opts.faults) {
+        // 50us ticks, ~400ms per revolution
+        plan.reset(new fault_plan(*opts.faults, rng()));
+        wheel.reset(new timer_wheel<pair<proxy_conn*, int>>(50000, 8192, mono_ns()));
+        dieunless((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0);
+        epoll_event tev = {};
+        tev.events = EPOLLIN;
+        tev.data.ptr = &timer_ep;
+        dieunless(epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &tev) == 0);
+    }
 
-    server_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
-    if (server_fd < 0) {
-        cerr << "Failed to create socket to server\n";
-        close(client_fd);
-        return;
+    vector<epoll_event> evs(256);
+    while (true) {
+        // Wake periodically so a SIGINT/SIGTERM can shut the capture down cleanly
+        int n = epoll_wait(epfd, evs.data(), evs.size(), 200);
+        if (g_stop.load()) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            cerr << "epoll_wait: " << strerror(errno) << "\n";
+            break;
+        }
+        for (int ii = 0; ii < n; ii++) {
+            auto ep = (endpoint*)evs[ii].data.ptr;
+            if (!ep) {
+                accept_all();
+            } else if (ep == &timer_ep) {
+                on_timer();
+            } else if (!ep->conn->dead) {
+                handle(ep->conn, ep->side, evs[ii].events);
+            }
+        }
+        if (wheel) arm_timer();
+        // Events later in the batch may still point at a closed connection
+        for (auto c : graveyard) delete c;
+        graveyard.clear();
     }
+    if (tfd >= 0) close(tfd);
+    close(epfd);
+}
 
-    ::setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+void proxy_worker::accept_all() {
+    while (true) {
+        int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                cerr << "Failed to accept connection: " << strerror(errno) << "\n";
+            if (errno == EINTR) continue;
+            return;
+        }
 
-    if (::connect(server_fd, (sockaddr *)ab.data(), ab.size()) != 0) {
-        cerr << "Failed to connect to " << target << "\n";
-        close(server_fd);
-        close(client_fd);
-        return;
-    }
+        int one = 1;
+        ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-    cout << "Proxying connection to " << target << "\n";
+        int server_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (server_fd < 0) {
+            cerr << "Failed to create socket to server\n";
+            close(client_fd);
+            continue;
+        }
+        ::setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(server_fd, (sockaddr *)opts.target.data(), opts.target.size()) != 0 && errno != EINPROGRESS) {
+            cerr << "Failed to connect to " << opts.target_name << ": " << strerror(errno) << "\n";
+            close(server_fd);
+            close(client_fd);
+            continue;
+        }
+
+        auto c = new proxy_conn;
+        c->id = ++g_conn_id;
+        c->fd[CLIENT] = client_fd;
+        c->fd[SERVER] = server_fd;
+        c->sampled = (opts.dump || opts.cap || opts.stats || opts.faults) && (opts.sample >= 1.0 || unif(rng) < opts.sample);
+        if ((c->faulty = c->sampled && opts.faults)) {
+            c->tokens[CLIENT] = c->tokens[SERVER] = opts.faults->burst;
+            c->refill_ns[CLIENT] = c->refill_ns[SERVER] = mono_ns();
+        }
+        c->frames[CLIENT] = c->frames[SERVER] = frame_reassembler(opts.max_frame);
+        if (opts.splice && !c->sampled) c->spliced = open_pipes(c);
+        for (int s : {CLIENT, SERVER}) {
+            c->ep[s] = {c, s};
+            epoll_event ev = {};
+            ev.data.ptr = &c->ep[s];
+            dieunless(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd[s], &ev) == 0);
+        }
+        update(c);
 
-    // Set non-blocking mode for select()
-    fd_set readfds;
-    uint8_t buffer[8192];
-    int max_fd = max(client_fd, server_fd);
+        out_line("\n=================================\n"
+                 "New connection " + to_string(c->id) + " on worker " + to_string(idx) +
+                 ", proxying to " + opts.target_name +
+                 (c->spliced ? " (splice)" : c->sampled ? " (sampled)" : "") + "\n"
+                 "=================================\n");
+    }
+}
 
-    while (true) {
-        FD_ZERO(&readfds);
-        FD_SET(client_fd, &readfds);
-        FD_SET(server_fd, &readfds);
+void proxy_worker::handle(proxy_conn* c, int side, uint32_t ev) {
+    if (side == SERVER && !c->connected && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd[SERVER], SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+            close_conn(c, ("Failed to connect to " + opts.target_name + ": " + strerror(err)).c_str());
+            return;
+        }
+        c->connected = true;
+    }
+    if (ev & EPOLLOUT) {
+        if (!flush_side(c, side)) return;
+    }
+    if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        if (!read_side(c, side)) return;
+    }
+    if (c->finished()) {
+        close_conn(c, "Connection closed");
+        return;
+    }
+    update(c);
+}
 
-        struct timeval timeout = {30, 0}; // 30 second timeout
-        int activity = select(max_fd + 1, &readfds, nullptr, nullptr, &timeout);
+// One pipe per direction, sized to the BUF watermark where the pipe-max-size
+// limit allows.  Running out of descriptors falls back to copying.
+bool proxy_worker::open_pipes(proxy_conn* c) {
+    for (int s : {CLIENT, SERVER}) {
+        int p[2];
+        if (pipe2(p, O_NONBLOCK | O_CLOEXEC) != 0) {
+            for (int t : {CLIENT, SERVER}) {
+                if (c->pipe_rd[t] >= 0) close(c->pipe_rd[t]);
+                if (c->pipe_wr[t] >= 0) close(c->pipe_wr[t]);
+                c->pipe_rd[t] = c->pipe_wr[t] = -1;
+            }
+            return false;
+        }
+        c->pipe_rd[s] = p[0];
+        c->pipe_wr[s] = p[1];
+        fcntl(p[1], F_SETPIPE_SZ, (int)opts.hiwat);
+        c->pipe_cap = fcntl(p[1], F_GETPIPE_SZ);
+    }
+    return true;
+}
 
-        if (activity < 0) {
-            cerr << "Select error\n";
+// Drain fd[side] into the peer, writing straight through while the peer's
+// queue is empty and queueing only what it will not take.
+bool proxy_worker::read_side(proxy_conn* c, int side) {
+    if (c->spliced) return splice_in(c, side);
+    int peer = 1 - side;
+    // Faulted directions forward whole frames via the hold queue, not raw reads
+    bool hold = c->faulty && opts.faults->dir[side];
+    while (!c->rd_eof[side] && c->queued(peer) < opts.hiwat) {
+        ssize_t n = recv(c->fd[side], rbuf.data(), rbuf.size(), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            close_conn(c, side == CLIENT ? "Client error" : "Server error");
+            return false;
+        }
+        if (n == 0) {
+            c->rd_eof[side] = true;
             break;
         }
 
-        if (activity == 0) {
-            // Timeout - just continue
-            continue;
+        if (c->sampled) {
+            auto& fr = c->frames[side];
+            bool was_ok = fr.error() == frame_reassembler::status::ok;
+            uint64_t ts = epoch_ns();
+            fr.feed(rbuf.data(), n, [&](const uint8_t* f, size_t len) { on_frame(c, side, ts, f, len); });
+            // Bytes keep flowing; only the inspection gives up on a desynced stream
+            if (was_ok && fr.error() != frame_reassembler::status::ok) {
+                out_line(string(side == CLIENT ? "CLIENT -> SERVER" : "SERVER -> CLIENT") + ": " + fr.error_str() +
+                         " after " + to_string(fr.frames()) + " frames, no longer inspecting connection " +
+                         to_string(c->id) + "\n");
+                if (hold) {
+                    close_conn(c, "Unframed stream under fault injection");
+                    return false;
+                }
+            }
+            if (c->dead) return false;	// a fault closed it
         }
-
-        // Data from client to server
-        if (FD_ISSET(client_fd, &readfds)) {
-            ssize_t n = recv(client_fd, buffer, sizeof(buffer), 0);
-            if (n <= 0) {
-                cout << "Client disconnected\n";
-                break;
+        if (hold) continue;
+
+        size_t off = 0;
+        if (!c->out[peer].size() && (peer == CLIENT || c->connected)) {
+            ssize_t sent = send(c->fd[peer], rbuf.data(), n, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_conn(c, peer == SERVER ? "Failed to forward to server" : "Failed to forward to client");
+                return false;
             }
+            if (sent > 0) off = sent;
+        }
+        if (off < (size_t)n) c->out[peer].append(rbuf.data() + off, n - off);
+    }
+    if (hold) release(c, peer);
+    return flush_side(c, peer);
+}
 
-            hex_dump("CLIENT -> SERVER", buffer, n);
+// A whole frame read from fd[side], stamped with the time of its last recv().
+// The capture ring never blocks; a full ring drops the frame.
+void proxy_worker::on_frame(proxy_conn* c, int side, uint64_t ts, const uint8_t* f, size_t len) {
+    if (opts.dump) hex_dump(side == CLIENT ? "CLIENT -> SERVER" : "SERVER -> CLIENT", f, len);
+    if (opts.cap) opts.cap->ring(idx).push(ts, c->id, side, f, len);
+    if (!opts.stats && !c->faulty) return;
+
+    // Responses are matched to requests for the stats and for fault targeting
+    bool targeted = true;
+    int rc;
+    bool done;
+    if (side == CLIENT) {
+        auto& req = c->inflight.request(f, len, ts);
+        if (c->faulty) targeted = opts.faults->targeted(req);
+    } else if (auto req = c->inflight.response(f, len, rc, done)) {
+        if (c->faulty) targeted = opts.faults->targeted(*req);
+        if (done && opts.stats) opts.stats->record(idx, *req, rc, ts > req->ts_ns ? ts - req->ts_ns : 0);
+    } else if (c->faulty) {
+        targeted = !opts.faults->targeting();
+    }
+    if (!c->faulty || !opts.faults->dir[side]) return;
+
+    uint64_t delay = 0;
+    if (targeted) {
+        switch (plan->action()) {
+        case fault_action::drop:
+            // A dropped request is never answered; don't match a response to it
+            if (side == CLIENT) c->inflight.unrequest();
+            return;
+        case fault_action::close: close_conn(c, "Fault: connection closed"); return;
+        case fault_action::reset: reset_conn(c); return;
+        case fault_action::pass: break;
+        }
+        delay = plan->delay_ns();
+    }
+    // Never overtake an earlier frame; TCP order is preserved
+    int peer = 1 - side;
+    uint64_t rel = max(mono_ns() + delay, c->last_release[peer]);
+    c->last_release[peer] = rel;
+    c->held[peer].push_back({rel, vector<uint8_t>(f, f + len)});
+    c->held_bytes[peer] += len;
+}
 
-            ssize_t sent = send(server_fd, buffer, n, 0);
-            if (sent != n) {
-                cerr << "Failed to forward to server\n";
-                break;
+// Move held frames that are due, and within the bandwidth budget, to the
+// send queue for fd[side]; otherwise wait on the wheel for the head frame.
+void proxy_worker::release(proxy_conn* c, int side) {
+    auto& q = c->held[side];
+    uint64_t now = mono_ns();
+    double bps = opts.faults->bw_bps;
+    while (!q.empty()) {
+        uint64_t due = q.front().release_ns;
+        if (bps > 0) {
+            c->tokens[side] = min(opts.faults->burst, c->tokens[side] + (now - c->refill_ns[side]) * bps / 1e9);
+            c->refill_ns[side] = now;
+            if (c->tokens[side] < 0) due = max(due, now + (uint64_t)(-c->tokens[side] / bps * 1e9));
+        }
+        if (due > now) {
+            if (!c->timer_set[side]) {
+                wheel->add({c, side}, due);
+                c->timer_set[side] = true;
             }
+            return;
         }
+        // Whole frames go out at once; a frame larger than the bucket
+        // runs it into debt and the next one waits that off
+        c->tokens[side] -= q.front().bytes.size();
+        c->held_bytes[side] -= q.front().bytes.size();
+        c->out[side].append(q.front().bytes.data(), q.front().bytes.size());
+        q.pop_front();
+    }
+}
 
-        // Data from server to client
-        if (FD_ISSET(server_fd, &readfds)) {
-            ssize_t n = recv(server_fd, buffer, sizeof(buffer), 0);
-            if (n <= 0) {
-                cout << "Server disconnected\n";
-                break;
-            }
+void proxy_worker::on_timer() {
+    uint64_t expirations;
+    if (read(tfd, &expirations, sizeof(expirations)) < 0) {}
+    armed_ns = UINT64_MAX;
+    wheel->advance(mono_ns(), [this](const pair<proxy_conn*, int>& it) {
+        auto c = it.first;
+        int side = it.second;
+        if (c->dead) return;
+        c->timer_set[side] = false;
+        release(c, side);
+        if (!flush_side(c, side)) return;
+        if (c->finished()) {
+            close_conn(c, "Connection closed");
+            return;
+        }
+        update(c);
+    });
+}
 
-            hex_dump("SERVER -> CLIENT", buffer, n);
+// Point the timerfd at the wheel's next deadline.
+void proxy_worker::arm_timer() {
+    uint64_t next = wheel->next_deadline_ns();
+    if (next == armed_ns) return;
+    itimerspec its = {};
+    if (next != UINT64_MAX) {
+        its.it_value.tv_sec = next / 1000000000;
+        its.it_value.tv_nsec = next % 1000000000;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+    armed_ns = next;
+}
 
-            ssize_t sent = send(client_fd, buffer, n, 0);
-            if (sent != n) {
-                cerr << "Failed to forward to client\n";
+// Move fd[side] into the peer's pipe.  EAGAIN with bytes already in the
+// pipe may mean the pipe ran out of slots rather than the socket running
+// dry, so reading pauses until the pipe drains either way.
+bool proxy_worker::splice_in(proxy_conn* c, int side) {
+    int peer = 1 - side;
+    while (!c->rd_eof[side] && !c->pipe_full[peer] && c->in_pipe[peer] < c->pipe_cap) {
+        ssize_t n = splice(c->fd[side], nullptr, c->pipe_wr[peer], nullptr, c->pipe_cap - c->in_pipe[peer],
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (c->in_pipe[peer]) c->pipe_full[peer] = true;
                 break;
             }
+            close_conn(c, side == CLIENT ? "Client error" : "Server error");
+            return false;
         }
+        if (n == 0) {
+            c->rd_eof[side] = true;
+            break;
+        }
+        c->in_pipe[peer] += n;
     }
+    return flush_side(c, peer);
+}
 
-    close(server_fd);
-    close(client_fd);
-    cout << "Connection closed\n";
+// Write what is queued for fd[side]; half-close it once its source hit EOF.
+bool proxy_worker::flush_side(proxy_conn* c, int side) {
+    if (side == SERVER && !c->connected) return true;
+    while (c->in_pipe[side]) {
+        ssize_t n = splice(c->pipe_rd[side], nullptr, c->fd[side], nullptr, c->in_pipe[side],
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            close_conn(c, side == SERVER ? "Failed to forward to server" : "Failed to forward to client");
+            return false;
+        }
+        c->in_pipe[side] -= n;
+    }
+    if (!c->in_pipe[side]) c->pipe_full[side] = false;
+
+    auto& q = c->out[side];
+    while (q.size()) {
+        ssize_t sent = send(c->fd[side], q.ptr(), q.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            close_conn(c, side == SERVER ? "Failed to forward to server" : "Failed to forward to client");
+            return false;
+        }
+        q.consume(sent);
+    }
+    if (!c->queued(side) && c->rd_eof[1 - side] && !c->wr_shut[side]) {
+        shutdown(c->fd[side], SHUT_WR);
+        c->wr_shut[side] = true;
+    }
+    return true;
 }
 
-int main(int argc, char** argv) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <listen_port> <target_host:port>\n";
-        cerr << "Example: " << argv[0] << " 7000 localhost:3000\n";
-        return 1;
+// Recompute epoll interest: read unless EOF or backpressured, write while
+// anything is queued (or the server connect is pending).
+void proxy_worker::update(proxy_conn* c) {
+    size_t hiwat = c->spliced ? c->pipe_cap : opts.hiwat;
+    size_t lowat = c->spliced ? c->pipe_cap / 4 : opts.lowat;
+    for (int s : {CLIENT, SERVER}) {
+        size_t qpeer = c->queued(1 - s);
+        if (qpeer >= hiwat || c->pipe_full[1 - s]) c->paused[s] = true;
+        else if (qpeer <= lowat) c->paused[s] = false;
+
+        uint32_t want = 0;
+        if (!c->rd_eof[s] && !c->paused[s]) want |= EPOLLIN;
+        if (c->queued(s) || (s == SERVER && !c->connected)) want |= EPOLLOUT;
+        if (want != c->events[s]) {
+            epoll_event ev = {};
+            ev.events = want;
+            ev.data.ptr = &c->ep[s];
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd[s], &ev);
+            c->events[s] = want;
+        }
     }
+}
 
-    int listen_port = atoi(argv[1]);
-    string target = argv[2];
+void proxy_worker::close_conn(proxy_conn* c, const char* why) {
+    for (int s : {CLIENT, SERVER}) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd[s], nullptr);
+        close(c->fd[s]);
+        if (c->pipe_rd[s] >= 0) close(c->pipe_rd[s]);
+        if (c->pipe_wr[s] >= 0) close(c->pipe_wr[s]);
+    }
+    c->dead = true;
+    if (c->timer_set[CLIENT] || c->timer_set[SERVER])
+        wheel->remove_if([c](const pair<proxy_conn*, int>& it) { return it.first == c; });
+    graveyard.push_back(c);
+    out_line(string(why) + " (connection " + to_string(c->id) + ")\n");
+}
+
+// Abort both sides with an RST rather than a FIN.
+void proxy_worker::reset_conn(proxy_conn* c) {
+    linger lg = {1, 0};
+    for (int s : {CLIENT, SERVER})
+        setsockopt(c->fd[s], SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close_conn(c, "Fault: connection reset");
+}
 
-    // Create listening socket
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+static int make_listener(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (listen_fd < 0) {
         cerr << "Failed to create listening socket\n";
-        return 1;
+        return -1;
     }
 
     int one = 1;
     setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(listen_port);
+    addr.sin_port = htons(port);
 
     if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        cerr << "Failed to bind to port " << listen_port << "\n";
-        return 1;
+        cerr << "Failed to bind to port " << port << "\n";
+        close(listen_fd);
+        return -1;
     }
 
-    if (listen(listen_fd, 5) < 0) {
+    if (listen(listen_fd, SOMAXCONN) < 0) {
         cerr << "Failed to listen\n";
-        return 1;
+        close(listen_fd);
+        return -1;
     }
+    return listen_fd;
+}
 
-    cout << "TCP Proxy listening on port " << listen_port << "\n";
-    cout << "Forwarding to " << target << "\n";
-    cout << "Point your Aerospike client at localhost:" << listen_port << "\n\n";
+int main(int argc, char** argv, char** envp) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <listen_port> <target_host:port> [key=value ...]\n";
+        cerr << "Example: " << argv[0] << " 7000 localhost:3000\n";
+        return 1;
+    }
 
-    while (true) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    int listen_port = atoi(argv[1]);
+    string target = argv[2];
 
-        int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_len);
-        if (client_fd < 0) {
-            cerr << "Failed to accept connection\n";
-            continue;
+    vector<config_opt> schema = {
+        {"BUF", config_opt::type::t_int, "1048576", "per-direction queue high watermark in bytes", 4096},
+        {"CAPTURE", config_opt::type::t_string, "", "binary capture file, empty for none"},
+        {"CAPTURE_RING", config_opt::type::t_int, "16777216", "per-worker capture ring bytes; frames are dropped when full", 65536},
+        {"CAPTURE_ZLIB", config_opt::type::t_bool, "0", "zlib-compress capture blocks"},
+        {"CPUS", config_opt::type::t_string, "", "worker core list, e.g. 2-5"},
+        {"DUMP", config_opt::type::t_bool, "1", "hex dump and decode traffic to stdout"},
+        {"MAX_FRAME", config_opt::type::t_int, "134217728", "largest frame accepted when dumping", 8},
+        {"SAMPLE", config_opt::type::t_float, "1", "fraction of connections dumped/captured", 0, 1},
+        {"SPLICE", config_opt::type::t_bool, "1", "forward undumped connections with splice(2)"},
+        {"STATS", config_opt::type::t_bool, "0", "match requests to responses and report latency histograms"},
+        {"STATS_INTERVAL", config_opt::type::t_int, "1", "seconds per stats interval", 1},
+        {"STATS_LOG", config_opt::type::t_string, "", "tagged hdr interval log for STATS, empty for none"},
+        {"WORKERS", config_opt::type::t_int, "0", "event loop threads, 0 for one per CPUS entry or online core", 0, 1024}
+    };
+    for (auto& o : fault_schema()) schema.push_back(o);
+    sort(schema.begin(), schema.end(), [](const config_opt& a, const config_opt& b) { return a.name < b.name; });
+    config cfg("TCP_PROXY_", schema);
+    // Options follow the two positional arguments; usage and errors still
+    // go out under the program's own name.
+    vector<char*> args = {argv[0]};
+    args.insert(args.end(), argv + 3, argv + argc);
+    args.push_back(nullptr);
+    config_load_or_die(cfg, (int)args.size() - 1, args.data(), envp);
+
+    auto cpus = parse_cpulist(cfg.s("CPUS"));
+    if (!cfg.s("CPUS").empty() && cpus.empty()) {
+        cerr << "CPUS '" << cfg.s("CPUS") << "' is not a core list\n";
+        return 1;
+    }
+    auto online = online_cpus();
+    for (auto cpu : cpus)
+        if (find(online.begin(), online.end(), cpu) == online.end()) {
+            cerr << "CPUS core " << cpu << " is not online\n";
+            return 1;
+        }
+    int nworkers = cfg.i("WORKERS");
+    if (nworkers == 0) nworkers = cpus.empty() ? online_cpus().size() : cpus.size();
+
+    proxy_opts opts;
+    opts.target = addr_resolve(target);
+    opts.target_name = target;
+    opts.hiwat = cfg.i("BUF");
+    opts.lowat = opts.hiwat / 4;
+    opts.dump = cfg.b("DUMP");
+    opts.max_frame = cfg.i("MAX_FRAME");
+    opts.sample = cfg.f("SAMPLE");
+    opts.splice = cfg.b("SPLICE");
+
+    unique_ptr<capture_writer> cap;
+    if (!cfg.s("CAPTURE").empty()) {
+        try {
+            cap.reset(new capture_writer(cfg.s("CAPTURE"), nworkers, cfg.i("CAPTURE_RING"), cfg.b("CAPTURE_ZLIB")));
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+    opts.cap = cap.get();
+
+    unique_ptr<proxy_stats> stats;
+    unique_ptr<hist_log> stats_log;
+    if (cfg.b("STATS")) {
+        stats.reset(new proxy_stats(nworkers));
+        if (!cfg.s("STATS_LOG").empty()) {
+            if (!(stats_log = hist_log::open(cfg.s("STATS_LOG")))) {
+                cerr << "Failed to open " << cfg.s("STATS_LOG") << "\n";
+                return 1;
+            }
+            stats_log->header("tcp_proxy", usec_now() * 1000);
         }
+    }
+    opts.stats = stats.get();
+
+    fault_opts fopts;
+    string ferr;
+    if (!fault_load(cfg, fopts, ferr)) {
+        cerr << ferr << "\n";
+        return 1;
+    }
+    opts.faults = fopts.enabled() ? &fopts : nullptr;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    // One listener per worker; bind them all before starting so a port
+    // conflict is reported up front.
+    vector<int> lfds;
+    for (int ii = 0; ii < nworkers; ii++) {
+        int fd = make_listener(listen_port);
+        if (fd < 0) return 1;
+        lfds.push_back(fd);
+    }
 
-        cout << "\n=================================\n";
-        cout << "New connection accepted\n";
-        cout << "=================================\n";
+    cout << "TCP Proxy listening on port " << listen_port << " with " << nworkers << " workers\n";
+    cout << "Forwarding to " << target << "\n";
+    cout << "Point your Aerospike client at localhost:" << listen_port << "\n";
+    cout << "Topology: " << json({{"config", cfg.to_json()}, {"topology", topology_json()}}).dump() << "\n\n";
+    cout.flush();
+
+    vector<unique_ptr<proxy_worker>> workers;
+    vector<thread> threads;
+    for (int ii = 0; ii < nworkers; ii++) {
+        int cpu = cpus.empty() ? -1 : cpus[ii % cpus.size()];
+        workers.emplace_back(new proxy_worker(ii, lfds[ii], cpu, opts));
+        threads.emplace_back(&proxy_worker::run, workers.back().get());
+    }
 
-        // Handle each connection in a separate thread
-        thread proxy_thread(proxy_connection, client_fd, target);
-        proxy_thread.detach();
+    // Interval reports on the main thread, aligned to the wall clock.
+    uint64_t ivl = cfg.i("STATS_INTERVAL") * 1000000ull, t0 = usec_now();
+    while (stats && !g_stop.load()) {
+        uint64_t tnext = (usec_now() / ivl + 1) * ivl;
+        while (!g_stop.load() && usec_now() < tnext)
+            this_thread::sleep_for(chrono::milliseconds(min<uint64_t>(100, (tnext - usec_now()) / 1000 + 1)));
+        if (g_stop.load()) break;
+        out_line(stats->interval(stats_log.get(), t0, tnext).dump() + "\n");
+        t0 = tnext;
     }
+    for (auto& th : threads) th.join();
 
-    close(listen_fd);
+    if (stats) {
+        // The partial last interval, once the workers have stopped recording
+        out_line(stats->interval(stats_log.get(), t0, usec_now()).dump() + "\n");
+        out_line(stats->summary().dump() + "\n");
+        stats_log.reset();
+    }
+
+    if (cap) {
+        uint64_t dropped = 0;
+        for (int ii = 0; ii < nworkers; ii++) dropped += cap->ring(ii).dropped();
+        cap->close();
+        cout << "Capture written to " << cfg.s("CAPTURE") << ", " << dropped << " frames dropped\n";
+    }
+    for (auto fd : lfds) close(fd);
     return 0;
 }
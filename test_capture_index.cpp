@@ -0,0 +1,166 @@
+// Offline checks for the capture query index: build it over a synthetic
+// capture, then compare indexed queries with brute force.
+#include "capture_index.hpp"
+#include "as_proto.hpp"
+#include "capture.hpp"
+#include "proxy_stats.hpp"
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+const size_t nreqs = 50000, nconns = 37, nrings = 4;
+const uint64_t t0 = 1700000000000000000ull;
+
+struct expect {
+    uint64_t conn;
+    uint32_t latency_us;
+    bool write;
+    uint8_t digest[20];
+};
+
+void make_digest(uint64_t ii, uint8_t *d) {
+    uint64_t x = ii * 0x9E3779B97F4A7C15ull + 1;
+    for (int jj = 0; jj < 20; jj++, x = x * 6364136223846793005ull + 1442695040888963407ull) d[jj] = x >> 56;
+}
+
+vector<uint8_t> request(bool write, const uint8_t *digest) {
+    vector<uint8_t> buf(256);
+    auto msg = (as_msg *)(buf.data() + sizeof(as_header));
+    msg->clear();
+    msg->flags = write ? AS_MSG_FLAG_WRITE : AS_MSG_FLAG_READ;
+    msg->add(as_field::type::t_digest_ripe, 20, digest);
+    msg->add(write ? as_op::type::t_write : as_op::type::t_read, "b", 0);
+    ((as_header *)buf.data())->init(msg);
+    buf.resize(sizeof(as_header) + ((as_header *)buf.data())->size());
+    return buf;
+}
+
+vector<uint8_t> response(int rc) {
+    vector<uint8_t> buf(sizeof(as_header) + sizeof(as_msg));
+    auto msg = (as_msg *)(buf.data() + sizeof(as_header));
+    msg->clear();
+    msg->result_code = rc;
+    ((as_header *)buf.data())->init(msg);
+    return buf;
+}
+
+int main() {
+    string path = "/tmp/test_capture_index." + to_string(getpid()), ipath = path + ".qidx";
+    map<uint64_t, expect> want;
+    {
+        capture_writer w(path, nrings, 1 << 20, true, 64 * 1024);
+        auto push = [&](uint64_t ts, uint64_t conn, uint8_t dir, const vector<uint8_t>& f) {
+            while (!w.ring(conn % nrings).push(ts, conn, dir, f.data(), f.size())) usleep(100);
+        };
+        for (uint64_t ii = 0; ii < nreqs + 5; ii++) {
+            expect e;
+            e.conn = ii < nreqs ? ii % nconns : ii - nreqs;
+            e.write = ii & 1;
+            make_digest(ii, e.digest);
+            uint64_t ts = t0 + ii * 1000;
+            push(ts, e.conn, 0, request(e.write, e.digest));
+            // The last request on the first five connections goes unanswered.
+            e.latency_us = ii < nreqs ? (ii * 7919) % 20000 : CAPX_NO_RESPONSE;
+            if (ii < nreqs) push(ts + e.latency_us * 1000ull, e.conn, 1, response(ii % 3 ? 0 : 2));
+            want[ts] = e;
+        }
+    }
+
+    capx_build_stats bs;
+    try {
+        bs = capx_build(path, ipath, 3);
+        check("builds", bs.reqs == nreqs + 5 && bs.unanswered == 5 && bs.orphans == 0,
+              to_string(bs.reqs) + " reqs, " + to_string(bs.unanswered) + " unanswered");
+    } catch (const exception& e) {
+        check("builds", false, e.what());
+        return 1;
+    }
+    capx_index idx(ipath);
+    check("chunks", idx.hdr().nchunks == (nreqs + 5 + CAPX_CHUNK - 1) / CAPX_CHUNK);
+
+    {
+        size_t n = 0, bad = 0;
+        idx.scan(capx_query(), 4, [&](const capx_req& r) {
+            auto it = want.find(r.ts_ns);
+            n++;
+            if (it == want.end() || it->second.conn != r.conn_id || it->second.latency_us != r.latency_us ||
+                memcmp(it->second.digest, r.digest, 20) || r.cls != (uint8_t)(it->second.write ? req_class::write : req_class::read))
+                bad++;
+            return true;
+        });
+        check("every request matched to its response", n == nreqs + 5 && !bad, to_string(n) + " seen, " + to_string(bad) + " wrong");
+    }
+
+    // Digest lookups touch only the chunks whose bloom filter admits them.
+    for (uint64_t ii : { 0ul, 12345ul, nreqs + 2 }) {
+        capx_query q;
+        q.has_digest = true;
+        make_digest(ii, q.digest);
+        vector<uint64_t> hits;
+        auto ss = idx.scan(q, 4, [&](const capx_req& r) { hits.push_back(r.ts_ns); return true; });
+        check("digest " + to_string(ii), hits == vector<uint64_t>{ t0 + ii * 1000 } && ss.scanned < ss.chunks,
+              to_string(hits.size()) + " hits, " + to_string(ss.scanned) + " of " + to_string(ss.chunks) + " chunks scanned");
+    }
+
+    {
+        capx_query q;
+        q.from_ns = t0 + 20000 * 1000ull;
+        q.to_ns = t0 + 30000 * 1000ull;
+        q.min_latency_us = 15000;
+        q.op_mask = 1u << (int)as_op::type::t_write;
+        size_t expected = 0, n = 0;
+        for (const auto& kv : want)
+            expected += kv.first >= q.from_ns && kv.first <= q.to_ns && kv.second.latency_us >= 15000 && kv.second.write;
+        auto ss = idx.scan(q, 2, [&](const capx_req&) { n++; return true; });
+        check("time range, latency and op filters", n == expected && ss.chunks < idx.hdr().nchunks,
+              to_string(n) + " vs " + to_string(expected));
+    }
+
+    {
+        capx_query q;
+        q.rc = 2;
+        q.any_conn = false;
+        q.conn_id = 5;
+        size_t expected = 0, n = 0;
+        for (uint64_t ii = 0; ii < nreqs; ii++) expected += ii % nconns == 5 && !(ii % 3);
+        idx.scan(q, 3, [&](const capx_req&) { n++; return true; });
+        check("result code and connection filters", n == expected, to_string(n) + " vs " + to_string(expected));
+    }
+
+    {
+        size_t n = 0;
+        auto ss = idx.scan(capx_query(), 4, [&](const capx_req&) { return ++n < 10; });
+        check("stops early", n == 10 && ss.matches == 10);
+    }
+
+    try {
+        capx_index bad(path);
+        check("rejects a non-index file", false);
+    } catch (const exception&) {
+        check("rejects a non-index file", true);
+    }
+
+    unlink(path.c_str());
+    unlink(ipath.c_str());
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+// Offline checks for frame_reassembler: every way of chopping up or
+// coalescing a stream must yield the same frames, and bad headers must stop it.
+#include "frame.hpp"
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+// Header plus payload, payload bytes tagged so misaligned splits show up.
+vector<uint8_t> make_frame(uint8_t type, size_t payload, uint8_t tag) {
+    vector<uint8_t> ret(sizeof(as_header) + payload);
+    as_header h(type, payload);
+    memcpy(ret.data(), &h, sizeof(h));
+    for (size_t ii = 0; ii < payload; ii++) ret[sizeof(h) + ii] = (uint8_t)(tag + ii);
+    return ret;
+}
+
+// Feed stream in the given chunk sizes (cycled), collect emitted frames.
+vector<vector<uint8_t>> run(frame_reassembler& fr, const vector<uint8_t>& stream, const vector<size_t>& chunks) {
+    vector<vector<uint8_t>> ret;
+    size_t off = 0, ci = 0;
+    while (off < stream.size()) {
+        size_t n = min(chunks[ci++ % chunks.size()], stream.size() - off);
+        if (!fr.feed(stream.data() + off, n, [&](const uint8_t* f, size_t len) { ret.emplace_back(f, f + len); }))
+            break;
+        off += n;
+    }
+    return ret;
+}
+
+int main() {
+    vector<vector<uint8_t>> frames;
+    vector<uint8_t> stream;
+    size_t sizes[] = {0, 1, 22, 100, 7, 65536, 500000, 30, 8, 4096};
+    for (size_t ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++) {
+        frames.push_back(make_frame(ii % 3 ? 3 : 1, sizes[ii], (uint8_t)ii));
+        stream.insert(stream.end(), frames.back().begin(), frames.back().end());
+    }
+
+    {
+        frame_reassembler fr;
+        auto got = run(fr, stream, {stream.size()});
+        check("coalesced stream in one feed", got == frames && !fr.pending());
+    }
+    {
+        frame_reassembler fr;
+        auto got = run(fr, stream, {1});
+        check("one byte at a time", got == frames && !fr.pending());
+    }
+    {
+        frame_reassembler fr;
+        auto got = run(fr, stream, {3, 5, 7, 8, 9});
+        check("header split across feeds", got == frames && fr.frames() == frames.size());
+    }
+    {
+        mt19937 rng(42);
+        bool ok = true;
+        for (int round = 0; round < 200 && ok; round++) {
+            vector<size_t> chunks;
+            for (int ii = 0; ii < 64; ii++) chunks.push_back(1 + rng() % 70000);
+            frame_reassembler fr;
+            ok = run(fr, stream, chunks) == frames && !fr.pending();
+        }
+        check("random chunkings", ok);
+    }
+    {
+        frame_reassembler fr;
+        size_t whole = frames[0].size() + frames[1].size();
+        auto part = vector<uint8_t>(stream.begin(), stream.begin() + whole + sizeof(as_header) + 10);
+        auto got = run(fr, part, {part.size()});
+        check("partial frame is held back", got.size() == 2 && fr.pending() == part.size() - whole);
+    }
+    {
+        frame_reassembler fr;
+        auto bad = stream;
+        bad[frames[0].size() + frames[1].size()] = 9;	// version of the third frame
+        auto got = run(fr, bad, {13});
+        check("bad version stops the stream", got.size() == 2 && fr.error() == frame_reassembler::status::bad_version,
+              fr.error_str());
+        check("no frames after an error",
+              !fr.feed(stream.data(), stream.size(), [](const uint8_t*, size_t) {}) && fr.frames() == 2);
+    }
+    {
+        frame_reassembler fr;
+        auto bad = make_frame(7, 10, 0);
+        run(fr, bad, {bad.size()});
+        check("bad type", fr.error() == frame_reassembler::status::bad_type, fr.error_str());
+    }
+    {
+        frame_reassembler fr(1024);
+        auto big = make_frame(3, 2000, 0);
+        auto got = run(fr, big, {4});
+        check("frame over max_frame", got.empty() && fr.error() == frame_reassembler::status::too_large,
+              fr.error_str());
+        fr.reset();
+        auto small = make_frame(3, 100, 0);
+        check("reset after an error", run(fr, small, {10}).size() == 1);
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
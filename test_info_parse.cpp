@@ -0,0 +1,121 @@
+// Offline checks for the zero-copy info response views.
+#include "info_parse.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+vector<string> pieces(string_view s, char sep) {
+    vector<string> ret;
+    for (auto p : info_list(s, sep)) ret.emplace_back(p);
+    return ret;
+}
+
+bool inside(string_view outer, string_view v) {
+    return v.data() >= outer.data() && v.data() + v.size() <= outer.data() + outer.size();
+}
+
+int main() {
+    check("list", pieces("a;bb;c", ';') == vector<string>{ "a", "bb", "c" });
+    check("list skips empty pieces", pieces(";a;;b;", ';') == vector<string>{ "a", "b" });
+    check("empty list", info_list("", ';').empty() && info_list(";;", ';').empty());
+    check("list size and at", info_list("x,y,z", ',').size() == 3 && info_list("x,y,z", ',').at(1) == "y" &&
+          !info_list("x,y,z", ',').at(3));
+
+    {
+        string resp = "objects=10;memory_used_bytes=1024;stop_writes=false;hwm_breached=true;ratio=0.25;name=test;";
+        info_pairs p(resp);
+        bool views = true;
+        for (auto kv : p) views = views && inside(resp, kv.key) && inside(resp, kv.value);
+        check("pairs are views into the response", views);
+        check("pair lookup", p.get("name") == "test" && !p.get("missing") && p.get("objects") == "10");
+        check("typed pair lookup", p.get<int64_t>("memory_used_bytes", -1) == 1024 && p.get<double>("ratio", 0) == 0.25 &&
+              p.get<int>("stop_writes", -1) == 0 && p.get<int>("hwm_breached", -1) == 1 && p.get<int>("name", -1) == -1);
+    }
+
+    check("numbers", info_number<int64_t>("-42") == -42 && info_number<uint64_t>("18446744073709551615") == UINT64_MAX &&
+          info_number<double>("1.5e3") == 1500.0 && !info_number<int>("12abc") && !info_number<int>("") &&
+          !info_number<int>("1.5"));
+
+    {
+        // sets: records separated by ';', fields by ':'.
+        string resp = "ns=test:set=demo:objects=5:tombstones=0;ns=test:set=other:objects=7:tombstones=1;";
+        int64_t total = 0;
+        vector<string> names;
+        for (auto rec : info_list(resp, ';')) {
+            info_pairs f(rec, ':');
+            names.emplace_back(f.get("set").value_or(""));
+            total += f.get<int64_t>("objects", 0);
+        }
+        check("nested records", names == vector<string>{ "demo", "other" } && total == 12);
+    }
+
+    {
+        string resp = "{test}-read:msec,120.5,0.50,0.10;{test}-write:usec,10.0,2.00;batch-index:msec,0.0,0.00";
+        vector<string> ns, hist;
+        double ops = 0;
+        for (auto ent : info_list(resp, ';')) {
+            auto nv = info_split(ent, ':');
+            auto sec = info_split_section(nv.key);
+            ns.emplace_back(sec.ns);
+            hist.emplace_back(sec.name);
+            ops += info_number<double>(info_list(nv.value, ',').at(1).value_or("")).value_or(0);
+        }
+        check("namespace sections", ns == vector<string>{ "test", "test", "" } &&
+              hist == vector<string>{ "read", "write", "batch-index" } && ops == 130.5);
+    }
+
+    {
+        string resp = "build\t7.1.0.0\nnode\tBB9\nbogus\n\nstatistics\tuptime=5;objects=2\n";
+        vector<string> names;
+        string stats;
+        for (auto line : info_list(resp, '\n')) {
+            auto kv = info_split(line, '\t');
+            names.emplace_back(kv.key);
+            if (kv.key == "statistics") stats = kv.value;
+        }
+        check("batched response lines", names == vector<string>{ "build", "node", "bogus", "statistics" } &&
+              info_pairs(stats).get<int>("objects", 0) == 2);
+    }
+
+    {
+        // A per-partition dump of the size that used to be slow to parse.
+        string resp;
+        for (int ii = 0; ii < 4096; ii++)
+            resp += "test:" + to_string(ii) + ":S:BB9:0:0:" + to_string(ii * 3) + ":0:0;";
+        size_t n = 0;
+        uint64_t sum = 0;
+        for (auto rec : info_list(resp, ';')) {
+            n++;
+            sum += info_number<uint64_t>(info_list(rec, ':').at(6).value_or("")).value_or(0);
+        }
+        check("partition dump", n == 4096 && sum == 3ull * 4095 * 4096 / 2);
+    }
+
+    {
+        auto lats = info_latencies("{test}-read:msec,1250.5,2.50,0.75,0.00;batch-index:usec,10,1.00;"
+                                   "{test}-write:msec,bogus,1.00;{test}-udf:");
+        check("latencies", lats.size() == 2 && lats[0].ns == "test" && lats[0].name == "read" && !lats[0].usec &&
+              lats[0].ops_per_sec == 1250.5 && lats[0].pct_over == vector<double>{ 2.5, 0.75, 0.0 } &&
+              lats[1].ns.empty() && lats[1].name == "batch-index" && lats[1].usec && lats[1].pct_over.size() == 1,
+              to_string(lats.size()) + " histograms");
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+// Checks for string values in to_json: well-formed UTF-8 passes through,
+// and every byte of an ill-formed sequence (overlong, surrogate, past
+// U+10FFFF, truncated) comes out as its own escaped code point, so the
+// line always parses.
+#include "util.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+// What a byte escaped as \u00XX reads back as.
+string latin1(const string& bytes) {
+    string out;
+    for (uint8_t c : bytes) {
+        if (c < 0x80) {
+            out += (char)c;
+        } else {
+            out += (char)(0xC0 | (c >> 6));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+// Writes val as a string bin and returns the value to_json parses back.
+string round_trip(const string& val, string& err) {
+    vector<uint8_t> buf(256);
+    auto msg = (as_msg *)buf.data();
+    msg->clear();
+    msg->add(as_op::type::t_write, "b", val);
+    try {
+        return to_json(msg)["ops"][0]["value"].get<string>();
+    } catch (const exception& e) {
+        err = e.what();
+        return "";
+    }
+}
+
+int main() {
+    struct { const char *name; string in; bool valid; } cases[] = {
+        { "2 byte sequence passes", "x\xC3\xA9y", true },
+        { "3 byte sequence passes", "\xE2\x82\xAC", true },
+        { "last code point before the surrogates passes", "\xED\x9F\xBF", true },
+        { "4 byte sequence passes", "\xF0\x9F\x98\x80", true },
+        { "U+10FFFF passes", "\xF4\x8F\xBF\xBF", true },
+        { "overlong 2 byte lead is escaped", "\xC0\xAF", false },
+        { "overlong 3 byte sequence is escaped", "\xE0\x80\xAF", false },
+        { "surrogate is escaped", "\xED\xA0\x80", false },
+        { "overlong 4 byte sequence is escaped", "\xF0\x80\x80\xAF", false },
+        { "code point past U+10FFFF is escaped", "\xF4\x90\x80\x80", false },
+        { "F5 lead is escaped", "\xF5\x80\x80\x80", false },
+        { "FF is escaped", "a\xFF" "b", false },
+        { "stray continuation byte is escaped", "\x80", false },
+        { "truncated sequence is escaped", "ab\xE2\x82", false },
+    };
+    for (const auto& c : cases) {
+        string err;
+        string got = round_trip(c.in, err);
+        string want = c.valid ? c.in : latin1(c.in);
+        check(c.name, err.empty() && (got == want), err.empty() ? "got " + got : err);
+    }
+
+    {
+        // A bad lead must not swallow the well-formed sequence after it.
+        string err;
+        string got = round_trip("\xE0\xC3\xA9", err);
+        check("an escaped byte leaves the next sequence intact", err.empty() && (got == latin1("\xE0") + "\xC3\xA9"),
+              err.empty() ? "got " + got : err);
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
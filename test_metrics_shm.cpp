@@ -0,0 +1,86 @@
+// Checks for the workload metrics segment: the log-linear buckets cover
+// every value within 12.5%, and a reader never sees a torn slot while the
+// worker keeps writing.
+#include "metrics_shm.hpp"
+#include "tsc_clock.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+int main() {
+    {
+        bool ok = true;
+        string bad;
+        for (uint64_t v = 0; v < (1ull << 40) && ok; v = v < 64 ? v + 1 : v + v / 7) {
+            uint32_t b = wlm_bucket(v);
+            uint64_t hi = wlm_bucket_max(b), lo = b ? wlm_bucket_max(b - 1) + 1 : 0;
+            ok = (v >= lo) && (v <= hi) && (hi - lo <= v / 8);
+            if (!ok) bad = to_string(v) + " in bucket " + to_string(b) + " [" + to_string(lo) + "," + to_string(hi) + "]";
+        }
+        check("buckets hold their values within 12.5%", ok, bad);
+        check("huge values land in the last bucket", wlm_bucket(UINT64_MAX) == WLM_BUCKETS - 1);
+    }
+
+    {
+        string name = "/test_metrics_shm." + to_string(getpid());
+        wlm_writer w(name, 2, "test", "read", 3600000000000ull);
+        wlm_reader r(name);
+        check("reader accepts the segment", r.hdr().nslots == 2 && r.nthreads() == 0);
+        wlm_slot *s = w.claim(5);
+        check("claim hands out slots in order", s && r.nthreads() == 1 && w.claim(-1) && !w.claim(-1));
+
+        // Every write records one read and one error-free write, so a
+        // consistent copy always has equal counts.
+        const uint64_t n = 200000;
+        atomic<bool> done{false};
+        thread writer([&] {
+            for (uint64_t ii = 0; ii < n; ii++) {
+                uint64_t t = now_ns();
+                w.record(s, WLM_READ, t, 1000 + ii % 5000, ii % 10 == 0);
+                w.record(s, WLM_WRITE, t, 1000 + ii % 5000, false);
+            }
+            done = true;
+        });
+        wlm_snapshot snap;
+        uint64_t reads = 0, torn = 0;
+        uint64_t iv = r.interval(mono_ns());
+        while (!done.load()) {
+            r.read(0, iv, snap);
+            uint64_t h = 0;
+            for (auto c : snap.iv_hist[WLM_READ]) h += c;
+            if (snap.ops[WLM_WRITE] > snap.ops[WLM_READ] || snap.ops[WLM_READ] - snap.ops[WLM_WRITE] > 1 ||
+                h != snap.iv_ops[WLM_READ])
+                torn++;
+            reads++;
+        }
+        writer.join();
+        check("no torn snapshots under a live writer", torn == 0, to_string(torn) + " of " + to_string(reads));
+        r.read(0, iv, snap);
+        check("counts add up", snap.cpu == 5 && snap.ops[WLM_READ] == n && snap.iv_ops[WLM_WRITE] == n &&
+              snap.errors[WLM_READ] == n / 10 && snap.iv_max_ns[WLM_READ] == 5999,
+              to_string(snap.ops[WLM_READ]) + " ops, " + to_string(snap.errors[WLM_READ]) + " errors");
+        r.read(0, iv + 1, snap);
+        check("other intervals read empty", snap.iv_ops[WLM_READ] == 0 && snap.ops[WLM_READ] == n);
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
@@ -2,6 +2,7 @@
 // Based on working nested examples from cdt_test.cpp
 
 #include "as_proto.hpp"
+#include "config.hpp"
 #include "util.hpp"
 #include <iostream>
 #include <iomanip>
@@ -84,7 +85,7 @@ bool test_nesting_depth(int fd, int depth, int record_id) {
     visit(req, record_id, AS_MSG_FLAG_WRITE);
     dieunless(req->add(as_op::type::t_cdt_modify, "nested", operation));
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     if (res == nullptr) {
@@ -94,7 +95,7 @@ bool test_nesting_depth(int fd, int depth, int record_id) {
 
     bool write_success = (res->result_code == 0);
     uint8_t write_error = res->result_code;
-    uint32_t write_dur = dur;
+    double write_dur = dur / 1e3;
 
     free(res);
     res = nullptr;
@@ -145,7 +146,7 @@ bool test_nesting_depth(int fd, int depth, int record_id) {
 
     bool read_success = (res->result_code == 0);
     uint8_t read_error = res->result_code;
-    uint32_t read_dur = dur;
+    double read_dur = dur / 1e3;
 
     // Verify the value
     bool value_correct = false;
@@ -178,22 +179,13 @@ bool test_nesting_depth(int fd, int depth, int record_id) {
 
 int main(int argc, char **argv, char **envp)
 {
-    // Setup defaults
-    p = {
-        {"ASDB", "localhost:3000"},
-        {"NS", "test"},
-        {"SN", "nest_depth_test"}
-    };
-
-    // Override from environment
-    for (auto ep = *envp; ep; ep = *(++envp)) {
-        const char* prefix = "JP_INFO_";
-        if (!strncmp(prefix, ep, 8)) {
-            auto vs = strchr(ep, '=');
-            auto ks = string(ep).substr(8, (vs - ep) - 8);
-            if (ks.length()) p[ks] = string(vs + 1);
-        }
-    }
+    config cfg("JP_INFO_", {
+        {"ASDB", config_opt::type::t_string, "localhost:3000", "server host:port"},
+        {"NS", config_opt::type::t_string, "test", "namespace"},
+        {"SN", config_opt::type::t_string, "nest_depth_test", "set name"}
+    });
+    config_load_or_die(cfg, argc, argv, envp);
+    p = cfg.strings();
 
     cout << "========================================================" << endl;
     cout << "CDT NESTING DEPTH PROBE TEST" << endl;
@@ -1,4 +1,5 @@
 #include "as_proto.hpp"
+#include "config.hpp"
 #include "util.hpp"
 #include <iostream>
 #include <cstring>
@@ -85,22 +86,13 @@ as_msg *visit(as_msg *msg, int ri, int flags)
 
 int main(int argc, char** argv, char** envp)
 {
-    // Setup defaults
-    p = {
-        {"ASDB", "localhost:3000"},
-        {"NS", "test"},
-        {"SN", ""}
-    };
-
-    // Override from environment
-    for (auto ep = *envp; ep; ep = *(++envp)) {
-        const char* prefix = "JP_INFO_";
-        if (!strncmp(prefix, ep, 8)) {
-            auto vs = strchr(ep, '=');
-            auto ks = string(ep).substr(8, (vs - ep) - 8);
-            if (ks.length()) p[ks] = string(vs + 1);
-        }
-    }
+    config cfg("JP_INFO_", {
+        {"ASDB", config_opt::type::t_string, "localhost:3000", "server host:port"},
+        {"NS", config_opt::type::t_string, "test", "namespace"},
+        {"SN", config_opt::type::t_string, "", "set name"}
+    });
+    config_load_or_die(cfg, argc, argv, envp);
+    p = cfg.strings();
 
     cout << "Connecting to " << p["ASDB"] << " (ns=" << p["NS"] << ", set=" << p["SN"] << ")" << endl;
 
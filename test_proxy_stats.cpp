@@ -0,0 +1,103 @@
+// Checks for matching responses to requests on a proxied connection: a
+// request a fault dropped is never answered, and a streamed response ends
+// on the LAST msg even when records precede it in the same frame.
+#include "proxy_stats.hpp"
+#include "as_proto.hpp"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+vector<uint8_t> request(uint8_t key, bool batch = false) {
+    vector<uint8_t> buf(256);
+    uint8_t digest[20] = {key};
+    auto msg = (as_msg *)(buf.data() + sizeof(as_header));
+    msg->clear();
+    msg->flags = AS_MSG_FLAG_READ | (batch ? AS_MSG_FLAG_BATCH : 0);
+    msg->add(as_field::type::t_digest_ripe, 20, digest);
+    msg->add(as_op::type::t_read, "b", 0);
+    ((as_header *)buf.data())->init(msg);
+    buf.resize(sizeof(as_header) + ((as_header *)buf.data())->size());
+    return buf;
+}
+
+// One frame holding a msg per entry of rcs, each record carrying a bin;
+// the last msg is flagged LAST when last is set.
+vector<uint8_t> response(const vector<int>& rcs, bool last) {
+    vector<uint8_t> buf(sizeof(as_header));
+    for (size_t ii = 0; ii < rcs.size(); ii++) {
+        vector<uint8_t> m(256);
+        auto msg = (as_msg *)m.data();
+        msg->clear();
+        msg->result_code = rcs[ii];
+        if (last && (ii + 1 == rcs.size()))
+            msg->flags = AS_MSG_FLAG_LAST;
+        else
+            msg->add(as_op::type::t_read, "b", string("v"));
+        m.resize(msg->end() - m.data());
+        buf.insert(buf.end(), m.begin(), m.end());
+    }
+    as_header h(3, buf.size() - sizeof(as_header));
+    memcpy(buf.data(), &h, sizeof(h));
+    return buf;
+}
+
+int main() {
+    {
+        // Requests 1 and 2 go out, 2 is dropped on its way to the server, 3
+        // follows; the two responses belong to 1 and 3.
+        inflight_reqs q;
+        auto r1 = request(1), r2 = request(2), r3 = request(3), resp = response({0}, false);
+        q.request(r1.data(), r1.size(), 100);
+        q.request(r2.data(), r2.size(), 200);
+        q.unrequest();
+        q.request(r3.data(), r3.size(), 300);
+        int rc;
+        bool done;
+        auto a = q.response(resp.data(), resp.size(), rc, done);
+        bool first_ok = a && done && (a->ts_ns == 100) && (a->digest[0] == 1);
+        auto b = q.response(resp.data(), resp.size(), rc, done);
+        check("response after a dropped request matches the next one sent",
+              first_ok && b && done && (b->ts_ns == 300) && (b->digest[0] == 3) && (q.size() == 0),
+              b ? "matched request sent at " + to_string(b->ts_ns) : "no match");
+        check("a response with nothing outstanding matches nothing", !q.response(resp.data(), resp.size(), rc, done));
+    }
+
+    {
+        // A batch answered by a frame of records, then a frame of records
+        // ending in LAST, then a plain read.
+        inflight_reqs q;
+        auto rb = request(1, true), rr = request(2);
+        q.request(rb.data(), rb.size(), 100);
+        q.request(rr.data(), rr.size(), 200);
+        auto f1 = response({0, 0, 0}, false), f2 = response({0, 0, 2}, true), f3 = response({0}, false);
+        int rc;
+        bool done;
+        auto a = q.response(f1.data(), f1.size(), rc, done);
+        bool open = a && !done && (a->ts_ns == 100);
+        auto b = q.response(f2.data(), f2.size(), rc, done);
+        check("LAST after records in the same frame ends the batch", open && b && done && (b->ts_ns == 100) && (rc == 2),
+              "rc " + to_string(rc));
+        auto c = q.response(f3.data(), f3.size(), rc, done);
+        check("the next response matches the next request", c && done && (c->ts_ns == 200));
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Checks for the recording library: no value is lost or counted twice
+// while intervals are sampled under concurrent writers, and the log
+// writes what hdr_decoder reads.
+#include "recorder.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <hdr/hdr_histogram_log.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+int main() {
+    {
+        // now_ns () runs on the CLOCK_MONOTONIC timeline, whatever its source.
+        clock_init();
+        int64_t worst = 0;
+        bool ordered = true;
+        uint64_t last = 0;
+        for (int ii = 0; ii < 1000; ii++) {
+            uint64_t m0 = mono_ns(), n = now_ns(), m1 = mono_ns();
+            worst = max(worst, max((int64_t)(m0 - n), (int64_t)(n - m1)));
+            ordered = ordered && n >= last;
+            last = n;
+        }
+        int64_t skew = (int64_t)epoch_ns() - (int64_t)realtime_ns();
+        check(string("clock (") + clock_source() + ")", ordered && worst < 50000 && skew > -50000 && skew < 50000,
+              to_string(worst) + "ns off monotonic, " + to_string(skew) + "ns off realtime");
+    }
+
+    {
+        // One recorder per writer, as the tools use them, plus one shared.
+        const int nwriters = 4, per_writer = 200000;
+        vector<unique_ptr<interval_recorder>> recs;
+        for (int ii = 0; ii < nwriters; ii++) recs.emplace_back(new interval_recorder);
+        interval_recorder shared;
+        atomic<int> done{0};
+        vector<thread> th;
+        for (int ii = 0; ii < nwriters; ii++)
+            th.emplace_back([&, ii] {
+                for (int jj = 0; jj < per_writer; jj++) {
+                    recs[ii]->record(1 + jj % 1000);
+                    shared.record_atomic(1 + jj % 1000);
+                }
+                done++;
+            });
+        int64_t seen = 0, seen_shared = 0;
+        int intervals = 0;
+        auto drain = [&] {
+            for (auto& r : recs) seen += r->sample()->total_count;
+            seen_shared += shared.sample()->total_count;
+            intervals++;
+        };
+        while (done.load() < nwriters) {
+            drain();
+            usleep(200);
+        }
+        for (auto& t : th) t.join();
+        drain();
+        check("per-thread recorders lose nothing", seen == (int64_t)nwriters * per_writer,
+              to_string(seen) + " over " + to_string(intervals) + " intervals");
+        check("shared recorder loses nothing", seen_shared == (int64_t)nwriters * per_writer, to_string(seen_shared));
+        check("sample after sample is empty", recs[0]->sample()->total_count == 0);
+    }
+
+    {
+        string path = "/tmp/test_recorder." + to_string(getpid());
+        hdr_histogram *h = new_latency_hist();
+        for (int ii = 1; ii <= 100; ii++) hdr_record_value(h, ii * 10);
+        {
+            auto log = hist_log::open(path);
+            log->header("test", 1700000000000000000ull);
+            log->write("", 1700000000000000000ull, 1700000001000000000ull, h);
+            log->write("op:read", 1700000000000000000ull, 1700000001000000000ull, h);
+            log->flush();
+            ifstream ifs(path);
+            string all((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+            check("flush writes everything queued", all.find("Tag=op:read,1700000000.000,1.000,1000.000,") != string::npos);
+        }
+        ifstream ifs(path);
+        string line;
+        int data = 0, decoded = 0;
+        while (getline(ifs, line)) {
+            if (line.empty() || line[0] == '#' || line[0] == '"') continue;
+            data++;
+            auto enc = line.substr(line.rfind(',') + 1);
+            hdr_histogram *d = nullptr;
+            if (!hdr_log_decode(&d, enc.data(), enc.size()) && d && d->total_count == 100 && hdr_max(d) == hdr_max(h))
+                decoded++;
+            hdr_close(d);
+        }
+        check("log lines decode", data == 2 && decoded == 2, to_string(decoded) + " of " + to_string(data));
+        hdr_close(h);
+        unlink(path.c_str());
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
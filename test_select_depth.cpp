@@ -82,7 +82,7 @@ bool test_select_depth(int fd, int depth, int record_id) {
         dieunless(req->add(as_op::type::t_cdt_modify, bin_key, cdt::map::put("level0", structure)));
     }
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     if (!res || res->result_code != 0) {
@@ -91,7 +91,7 @@ bool test_select_depth(int fd, int depth, int record_id) {
         if (res) free(res);
         return false;
     }
-    uint32_t write_dur = dur;
+    double write_dur = dur / 1e3;
     free(res);
     res = nullptr;
 
@@ -156,7 +156,7 @@ bool test_select_depth(int fd, int depth, int record_id) {
 
     bool read_success = (res->result_code == 0);
     uint8_t read_error = res->result_code;
-    uint32_t read_dur = dur;
+    double read_dur = dur / 1e3;
 
     // Verify the result
     bool value_correct = false;
@@ -69,7 +69,7 @@ bool test_select_map_depth(int fd, int depth, int record_id) {
         memcpy(op->data(), msgpack.data(), msgpack.size());
     }
 
-    uint32_t dur = 0;
+    uint64_t dur = 0;
     call(fd, (void**)&res, req, &dur);
 
     if (!res || res->result_code != 0) {
@@ -78,7 +78,7 @@ bool test_select_map_depth(int fd, int depth, int record_id) {
         if (res) free(res);
         return false;
     }
-    uint32_t write_dur = dur;
+    double write_dur = dur / 1e3;
     free(res);
     res = nullptr;
 
@@ -114,7 +114,7 @@ bool test_select_map_depth(int fd, int depth, int record_id) {
 
     bool read_success = (res->result_code == 0);
     uint8_t read_error = res->result_code;
-    uint32_t read_dur = dur;
+    double read_dur = dur / 1e3;
 
     bool value_correct = false;
     if (read_success) {
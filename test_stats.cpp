@@ -0,0 +1,54 @@
+// Checks for the workload's summary statistics: percentiles, and a steady
+// state only over intervals that actually ran.
+#include "stats.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int tests_passed = 0;
+int tests_failed = 0;
+
+void check(const string& name, bool ok, const string& details = "") {
+    cout << name;
+    if (ok) {
+        tests_passed++;
+        cout << " | PASS\n";
+    } else {
+        tests_failed++;
+        cout << " | FAIL: " << details << "\n";
+    }
+}
+
+int main() {
+    {
+        vector<uint64_t> v = { 5, 1, 4, 2, 3 }, none;
+        check("percentile", percentile(v, 50.0) == 3 && percentile(v, 100.0) == 5 && percentile(none, 99.0) == 0);
+    }
+
+    {
+        check("cv of a constant series is 0", coeff_var({ 7.0, 7.0, 7.0 }) == 0.0);
+        check("cv of an all-zero series is +inf", isinf(coeff_var({ 0.0, 0.0, 0.0 })));
+    }
+
+    {
+        // A stalled server: no samples, so zero throughput and p99.
+        steady_detector sd(3, 0.05);
+        bool steady = false;
+        for (int ii = 0; ii < 10; ii++)
+            steady = steady || sd.add(0.0, 0.0);
+        check("an all-zero window is not steady", !steady);
+    }
+
+    {
+        steady_detector sd(3, 0.05);
+        bool a = sd.add(1000.0, 500.0), b = sd.add(0.0, 0.0), c = sd.add(1000.0, 500.0), d = sd.add(1000.0, 500.0);
+        bool e = sd.add(1000.0, 500.0);
+        check("a stall in the window holds off steady state", !a && !b && !c && !d && e);
+    }
+
+    cout << "\nPassed: " << tests_passed << "\nFailed: " << tests_failed << "\n";
+    return tests_failed ? 1 : 0;
+}
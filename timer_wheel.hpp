@@ -0,0 +1,94 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hashed timer wheel for an event loop: O(1) add, deadlines rounded up to
+// the tick.  Entries further out than one revolution stay in their slot
+// until the wheel comes round to the right lap.  Not thread safe; one wheel
+// per event loop.
+
+template <typename T>
+class timer_wheel
+{
+public:
+    timer_wheel (uint64_t tick_ns, size_t nslots, uint64_t now_ns) :
+	tick_ns (tick_ns),
+	slots (nslots),
+	cur (now_ns / tick_ns) {}
+
+    void add (const T& item, uint64_t deadline_ns)
+    {
+	uint64_t t = std::max ((deadline_ns + this->tick_ns - 1) / this->tick_ns, this->cur);
+	this->slots[t % this->slots.size ()].push_back ({ item, t });
+	this->count++;
+	this->next = std::min (this->next, t);
+    }
+
+    // Drop every entry for item.
+    template <typename P> void remove_if (const P& pred)
+    {
+	for (auto& s : this->slots) {
+	    auto e = std::remove_if (s.begin (), s.end (), [&](const entry& en) { return pred (en.item); });
+	    this->count -= s.end () - e;
+	    s.erase (e, s.end ());
+	}
+    }
+
+    // Fire everything due at now_ns, in tick order.  fn may add() again.
+    template <typename F> void advance (uint64_t now_ns, const F& fn)
+    {
+	uint64_t now = now_ns / this->tick_ns;
+	std::vector<entry> due;
+	for (; this->count && this->cur <= now; this->cur++) {
+	    auto& s = this->slots[this->cur % this->slots.size ()];
+	    for (size_t ii = 0; ii < s.size (); ) {
+		if (s[ii].tick <= this->cur) {
+		    due.push_back (s[ii]);
+		    s[ii] = s.back ();
+		    s.pop_back ();
+		    this->count--;
+		} else {
+		    ii++;
+		}
+	    }
+	    for (auto& en : due)	fn (en.item);
+	    due.clear ();
+	}
+	this->cur = std::max (this->cur, now);
+	this->next = this->count ? this->cur : UINT64_MAX;
+    }
+
+    // Earliest deadline worth waking for, UINT64_MAX when empty.  Exact
+    // within one revolution; beyond that it is a safe lower bound.
+    uint64_t next_deadline_ns (void)
+    {
+	if (!this->count)	return UINT64_MAX;
+	uint64_t t = std::max (this->next, this->cur);
+	for (size_t ii = 0; ii < this->slots.size (); ii++, t++) {
+	    for (auto& en : this->slots[t % this->slots.size ()])
+		if (en.tick <= t) {
+		    this->next = t;
+		    return t * this->tick_ns;
+		}
+	}
+	this->next = t;
+	return t * this->tick_ns;
+    }
+
+    size_t size (void) const	{ return this->count; }
+
+private:
+    struct entry
+    {
+	T item;
+	uint64_t tick;
+    };
+
+    uint64_t tick_ns;
+    std::vector<std::vector<entry>> slots;
+    uint64_t cur;
+    size_t count = 0;
+    uint64_t next = UINT64_MAX;	// no entry is due before this tick
+};
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+// Clocks for the tools, all in nanoseconds.
+//
+// now_ns () is the one to time things with.  On x86 with an invariant TSC
+// (constant rate across P-states and C-states, CPUID 0x80000007 EDX bit 8)
+// it is a TSC read scaled against CLOCK_MONOTONIC, about 10ns on the hot
+// path with no system call; elsewhere it falls back to CLOCK_MONOTONIC.
+// Either way it runs on the CLOCK_MONOTONIC timeline, so readings compare
+// with mono_ns () and with timers armed on it.
+//
+// Calibration happens on first use and takes about 20ms; long lived tools
+// call clock_init () at startup to keep it off the first timed request.
+// A rate taken over 20ms is only good to a few ppm, and NTP keeps slewing
+// CLOCK_MONOTONIC besides, so the scale alone would drift microseconds
+// off it within a minute.  Instead, once a second the first caller past
+// the deadline re-anchors: it takes a fresh (tsc, mono) pair and sets the
+// rate so the clock meets CLOCK_MONOTONIC one second later, measured over
+// everything since calibration.  now_ns () so stays monotonic and within
+// a microsecond or so of mono_ns () however long the run, at the cost of
+// one extra microsecond on one reading a second.
+
+struct tsc_calibration
+{
+    bool tsc = false;		// false: now_ns () is CLOCK_MONOTONIC
+    bool rdtscp = false;
+    uint64_t tsc0 = 0;		// the first pair, the baseline for re-anchoring
+    uint64_t ns0 = 0;
+    uint64_t mult = 0;		// ns per tick, 32.32 fixed point
+    uint64_t reanchor_ticks = 0;	// about a second
+    double ghz = 0;
+    int64_t epoch_off = 0;	// CLOCK_REALTIME - CLOCK_MONOTONIC at calibration
+};
+
+// The line now_ns () follows from tsc0 on, under a seqlock: seq is odd
+// while a re-anchor rewrites it.
+struct tsc_anchor
+{
+    std::atomic<uint32_t> seq{0};
+    std::atomic<uint64_t> tsc0{0};
+    std::atomic<uint64_t> ns0{0};
+    std::atomic<uint64_t> mult{0};
+};
+
+inline uint64_t mono_ns (void)
+{
+    timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline uint64_t realtime_ns (void)
+{
+    timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline uint64_t tsc_read (bool rdtscp)
+{
+    if (rdtscp) {
+	unsigned aux;
+	return __rdtscp (&aux);
+    }
+    _mm_lfence ();
+    return __rdtsc ();
+}
+
+// One (tsc, mono) pair, from the tightest of a few bracketed reads so a
+// preemption between the reads doesn't skew it.
+inline void tsc_pair (bool rdtscp, uint64_t& tsc, uint64_t& ns)
+{
+    uint64_t best = UINT64_MAX;
+    for (int ii = 0; ii < 16; ii++) {
+	uint64_t a = tsc_read (rdtscp), m = mono_ns (), b = tsc_read (rdtscp);
+	if (b - a < best) {
+	    best = b - a;
+	    tsc = a + (b - a) / 2;
+	    ns = m;
+	}
+    }
+}
+#endif
+
+inline tsc_calibration tsc_calibrate (void)
+{
+    tsc_calibration c;
+    c.epoch_off = (int64_t)realtime_ns () - (int64_t)mono_ns ();
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, cx, d;
+    if (!__get_cpuid (0x80000000, &a, &b, &cx, &d) || (a < 0x80000007))
+	return c;
+    __get_cpuid (0x80000001, &a, &b, &cx, &d);
+    c.rdtscp = d & (1u << 27);
+    __get_cpuid (0x80000007, &a, &b, &cx, &d);
+    if (!(d & (1u << 8)))
+	return c;
+
+    uint64_t t0, n0, t1, n1;
+    tsc_pair (c.rdtscp, t0, n0);
+    timespec nap = { 0, 20000000 };
+    nanosleep (&nap, nullptr);
+    tsc_pair (c.rdtscp, t1, n1);
+    if ((t1 <= t0) || (n1 <= n0))
+	return c;
+    double ghz = (double)(t1 - t0) / (n1 - n0);
+    // A hypervisor can advertise an invariant TSC it doesn't deliver.
+    if ((ghz < 0.1) || (ghz > 10.0))
+	return c;
+    c.tsc = true;
+    c.ghz = ghz;
+    c.tsc0 = t1;
+    c.ns0 = n1;
+    c.mult = (uint64_t)((double)(1ull << 32) / ghz);
+    c.reanchor_ticks = (uint64_t)(ghz * 1e9);
+#endif
+    return c;
+}
+
+inline tsc_anchor& clock_anchor (void)
+{
+    static tsc_anchor a;
+    return a;
+}
+
+inline const tsc_calibration& clock_calibration (void)
+{
+    static const tsc_calibration c = [] {
+	auto c = tsc_calibrate ();
+	auto& a = clock_anchor ();
+	a.tsc0.store (c.tsc0, std::memory_order_relaxed);
+	a.ns0.store (c.ns0, std::memory_order_relaxed);
+	a.mult.store (c.mult, std::memory_order_relaxed);
+	return c;
+    } ();
+    return c;
+}
+
+inline void clock_init (void)
+{
+    clock_calibration ();
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Starts the line over at a fresh (tsc, mono) pair, from where the old
+// line stands at that tick so readings never step back, and aims it at
+// CLOCK_MONOTONIC one second on.  Gives way if another thread is already at it.
+inline void tsc_reanchor (const tsc_calibration& c, tsc_anchor& a, uint32_t seq, uint64_t tsc0, uint64_t ns0, uint64_t mult)
+{
+    if (!a.seq.compare_exchange_strong (seq, seq + 1, std::memory_order_acquire))
+	return;
+    uint64_t tp, np;
+    tsc_pair (c.rdtscp, tp, np);
+    uint64_t cur = ns0 + (uint64_t)(((unsigned __int128)((tp > tsc0) ? tp - tsc0 : 0) * mult) >> 32);
+    // Ticks in the next second, by the rate since calibration.
+    double ghz = (double)(tp - c.tsc0) / (np - c.ns0);
+    uint64_t ticks = (uint64_t)(ghz * 1e9), target = np + 1000000000ull;
+    if ((ticks > c.reanchor_ticks / 2) && (target > cur))
+	mult = (uint64_t)(((unsigned __int128)(target - cur) << 32) / ticks);
+    a.tsc0.store (tp, std::memory_order_relaxed);
+    a.ns0.store (cur, std::memory_order_relaxed);
+    a.mult.store (mult, std::memory_order_relaxed);
+    a.seq.store (seq + 2, std::memory_order_release);
+}
+#endif
+
+inline uint64_t now_ns (void)
+{
+    const auto& c = clock_calibration ();
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_expect (c.tsc, 1)) {
+	auto& a = clock_anchor ();
+	uint64_t t = tsc_read (c.rdtscp);
+	for (;;) {
+	    uint32_t s = a.seq.load (std::memory_order_acquire);
+	    uint64_t tsc0 = a.tsc0.load (std::memory_order_relaxed);
+	    uint64_t ns0 = a.ns0.load (std::memory_order_relaxed);
+	    uint64_t mult = a.mult.load (std::memory_order_relaxed);
+	    std::atomic_thread_fence (std::memory_order_acquire);
+	    if ((s & 1) || (a.seq.load (std::memory_order_relaxed) != s))
+		continue;
+	    // Reads on another core, or from before a re-anchor, can trail
+	    // tsc0 by a few ticks.
+	    uint64_t dt = (t > tsc0) ? t - tsc0 : 0;
+	    if (__builtin_expect (dt > c.reanchor_ticks, 0))
+		tsc_reanchor (c, a, s, tsc0, ns0, mult);
+	    return ns0 + (uint64_t)(((unsigned __int128)dt * mult) >> 32);
+	}
+    }
+#endif
+    return mono_ns ();
+}
+
+// Wall clock time of a now_ns () or mono_ns () reading, by the offset
+// between the clocks at calibration; later steps of the wall clock don't
+// show, so ordering and differences survive them.
+inline uint64_t to_epoch_ns (uint64_t t)
+{
+    return t + clock_calibration ().epoch_off;
+}
+
+inline uint64_t epoch_ns (void)
+{
+    return to_epoch_ns (now_ns ());
+}
+
+inline const char *clock_source (void)
+{
+    return clock_calibration ().tsc ? "tsc" : "monotonic";
+}
@@ -4,26 +4,25 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <cmath>
 #include <cstring>
 #include "ripemd160.hpp"
 #include "as_proto.hpp"
+#include "info_parse.hpp"
 #include <time.h>
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using json = nlohmann::json;
 using namespace std;
 
 std::string get_labeled (const std::string& str, const std::string& l)
 {
-    size_t fp = str.find (l + "=");
-    if (fp == std::string::npos)	return "";
-    fp += l.length () + 1;
-    size_t lp = str.find (':', fp);
-    if (lp == std::string::npos)	lp = str.length ();
-
-    return str.substr (fp, (lp - fp));
+    return std::string (info_pairs (str, ':').get (l).value_or (std::string_view ()));
 }
 
 std::vector<uint8_t> addr_resolve (const std::string& hostport)
@@ -127,64 +126,654 @@ constexpr uint8_t hex2dec (char h) {
   }
 }
 
+#ifdef __SSE2__
+// 32 hex digits -> 16 bytes.  False, with nothing written, if any of them is
+// not a hex digit, so the caller can fall back to hex2dec's rules.
+static inline bool from_hex16 (uint8_t *dp, const char *sp)
+{
+    auto in_range = [](__m128i v, char lo, char hi) {
+	return _mm_and_si128 (_mm_cmpgt_epi8 (v, _mm_set1_epi8 (lo - 1)), _mm_cmplt_epi8 (v, _mm_set1_epi8 (hi + 1)));
+    };
+    __m128i nib[2];
+    for (int ii = 0; ii < 2; ii++) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *)(sp + 16 * ii));
+	__m128i ok = _mm_or_si128 (in_range (v, '0', '9'), in_range (_mm_or_si128 (v, _mm_set1_epi8 (0x20)), 'a', 'f'));
+	if (_mm_movemask_epi8 (ok) != 0xFFFF)	return false;
+	// Low nibble of the character, plus 9 for letters (bit 6 set).
+	__m128i alpha = _mm_and_si128 (_mm_srli_epi16 (v, 6), _mm_set1_epi8 (1));
+	nib[ii] = _mm_add_epi8 (_mm_and_si128 (v, _mm_set1_epi8 (0x0F)), _mm_add_epi8 (_mm_slli_epi16 (alpha, 3), alpha));
+    }
+    // Each 16-bit lane holds (low char, high char) = (hi nibble, lo nibble).
+    auto join = [](__m128i n) {
+	return _mm_or_si128 (_mm_slli_epi16 (_mm_and_si128 (n, _mm_set1_epi16 (0x00FF)), 4), _mm_srli_epi16 (n, 8));
+    };
+    _mm_storeu_si128 ((__m128i *)dp, _mm_packus_epi16 (join (nib[0]), join (nib[1])));
+    return true;
+}
+#endif
+
 void from_hex (void *dst, const void* src, size_t sz)
 {
     const char *sp = (const char *)src;
     uint8_t *dp = (uint8_t *)dst;
 
     const uint8_t *ep = dp + sz;
+#ifdef __SSE2__
+    while ((ep - dp >= 16) && from_hex16 (dp, sp)) {
+	dp += 16;
+	sp += 32;
+    }
+#endif
     while (dp != ep) {
-      *dp++ = (hex2dec(*sp++) << 4) + hex2dec(*sp++);
+      uint8_t hi = hex2dec(*sp++);
+      *dp++ = (hi << 4) + hex2dec(*sp++);
     }
 }
 
-// nlohmann::json to_json (const as_msg *msg)
-// {
+// Streaming JSON for wire messages.  Values are written straight from the
+// message bytes into the output string, so a large list or map payload
+// never becomes a json tree.  Anything that does not decode cleanly falls
+// back to the hex the tools have always shown.
 
+namespace {
 
-// }
+void put_escaped (std::string& out, const uint8_t *p, size_t n)
+{
+    static const char lut[] = "0123456789abcdef";
+    out += '"';
+    const uint8_t *end = p + n;
+    while (p < end) {
+	uint8_t c = *p;
+	if ((c >= 0x20) && (c < 0x80) && (c != '"') && (c != '\\')) {
+	    out += (char)c;
+	    p++;
+	    continue;
+	}
+	if ((c == '"') || (c == '\\')) {
+	    out += '\\';
+	    out += (char)c;
+	    p++;
+	    continue;
+	}
+	// Well-formed UTF-8 sequences pass through (RFC 3629: no overlongs,
+	// surrogates or code points past U+10FFFF, hence the narrower second
+	// byte after E0, ED, F0 and F4); anything else is escaped a byte at a
+	// time as a code point so the line stays valid JSON.
+	size_t len = (c >= 0xF0) && (c <= 0xF4) ? 4 : (c >= 0xE0) && (c < 0xF0) ? 3 : (c >= 0xC2) && (c < 0xE0) ? 2 : 0;
+	uint8_t lo = (c == 0xE0) ? 0xA0 : (c == 0xF0) ? 0x90 : 0x80;
+	uint8_t hi = (c == 0xED) ? 0x9F : (c == 0xF4) ? 0x8F : 0xBF;
+	bool ok = len && ((size_t)(end - p) >= len) && (p[1] >= lo) && (p[1] <= hi);
+	for (size_t ii = 2; ok && ii < len; ii++)
+	    ok = (p[ii] & 0xC0) == 0x80;
+	if (ok) {
+	    out.append ((const char *)p, len);
+	    p += len;
+	    continue;
+	}
+	switch (c) {
+	case('\n'):	out += "\\n"; break;
+	case('\r'):	out += "\\r"; break;
+	case('\t'):	out += "\\t"; break;
+	default:	out += "\\u00"; out += lut[c >> 4]; out += lut[c & 15]; break;
+	}
+	p++;
+    }
+    out += '"';
+}
 
-nlohmann::json to_json (const as_msg *msg) {
-    nlohmann::json ret = nlohmann::json::object ();
+void put_string (std::string& out, const std::string& s)
+{
+    put_escaped (out, (const uint8_t *)s.data (), s.size ());
+}
+
+void put_hex (std::string& out, const uint8_t *p, size_t n)
+{
+    size_t pos = out.size ();
+    out.resize (pos + 2 * n + 2);
+    out[pos] = '"';
+    to_hex (&out[pos + 1], p, n);
+    out.back () = '"';
+}
+
+void put_double (std::string& out, double v)
+{
+    if (!std::isfinite (v)) {
+	out += "null";
+	return;
+    }
+    char buf[32];
+    snprintf (buf, sizeof(buf), "%.17g", v);
+    out += buf;
+}
+
+// Name from a to_string () overload, or the bare number when it has none.
+template <typename E> void put_name (std::string& out, int64_t v)
+{
+    auto name = to_string ((E)v);
+    if (name == "unknown")	out += std::to_string (v);
+    else			put_string (out, name);
+}
+
+struct mp_reader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok = true;
+
+    bool need (size_t n)
+    {
+	if ((size_t)(this->end - this->p) < n)	this->ok = false;
+	return this->ok;
+    }
+    uint64_t be (size_t n)
+    {
+	uint64_t v = 0;
+	if (!this->need (n))	return 0;
+	for (size_t ii = 0; ii < n; ii++)	v = (v << 8) | *this->p++;
+	return v;
+    }
+};
 
-    ret["flags"] = msg->flags;
-    if (msg->result_code)		ret["result_code"] = msg->result_code;
-    if (msg->be_generation)		ret["generation"] = be32toh (msg->be_generation);
-    if (msg->be_record_ttl)		ret["record_ttl"] = be32toh (msg->be_record_ttl);
-    if (msg->be_transaction_ttl)	ret["transaction_ttl"] = be32toh (msg->be_transaction_ttl);
+enum class mp_kind : uint8_t { nil, boolean, sint, uint, dbl, str, bin, array, map, ext, bad };
+
+struct mp_item
+{
+    mp_kind kind;
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    const uint8_t *data = nullptr;
+    uint32_t n = 0;		// bytes for str/bin/ext, elements for array/map
+    int8_t ext = 0;
+};
+
+mp_item mp_next (mp_reader& r)
+{
+    mp_item it = { mp_kind::bad };
+    if (!r.need (1))	return it;
+    uint8_t c = *r.p++;
+    auto bytes = [&](mp_kind k, uint32_t n) {
+	it.kind = k;
+	it.n = n;
+	if (r.need (n)) {
+	    it.data = r.p;
+	    r.p += n;
+	} else {
+	    it.kind = mp_kind::bad;
+	}
+    };
+    auto ext = [&](uint32_t n) {
+	it.ext = (int8_t)r.be (1);
+	bytes (mp_kind::ext, n);
+    };
+    if (c <= 0x7F)		{ it.kind = mp_kind::sint; it.i = c; }
+    else if (c <= 0x8F)		{ it.kind = mp_kind::map; it.n = c & 15; }
+    else if (c <= 0x9F)		{ it.kind = mp_kind::array; it.n = c & 15; }
+    else if (c <= 0xBF)		bytes (mp_kind::str, c & 31);
+    else if (c >= 0xE0)		{ it.kind = mp_kind::sint; it.i = (int8_t)c; }
+    else switch (c) {
+    case(0xC0):	it.kind = mp_kind::nil; break;
+    case(0xC2):	case(0xC3):	it.kind = mp_kind::boolean; it.i = c & 1; break;
+    case(0xC4):	bytes (mp_kind::bin, r.be (1)); break;
+    case(0xC5):	bytes (mp_kind::bin, r.be (2)); break;
+    case(0xC6):	bytes (mp_kind::bin, r.be (4)); break;
+    case(0xC7):	{ uint32_t n = r.be (1); ext (n); break; }
+    case(0xC8):	{ uint32_t n = r.be (2); ext (n); break; }
+    case(0xC9):	{ uint32_t n = r.be (4); ext (n); break; }
+    case(0xCA):	{ uint32_t b = r.be (4); float f; memcpy (&f, &b, 4); it.kind = mp_kind::dbl; it.d = f; break; }
+    case(0xCB):	{ uint64_t b = r.be (8); memcpy (&it.d, &b, 8); it.kind = mp_kind::dbl; break; }
+    case(0xCC):	it.kind = mp_kind::uint; it.u = r.be (1); break;
+    case(0xCD):	it.kind = mp_kind::uint; it.u = r.be (2); break;
+    case(0xCE):	it.kind = mp_kind::uint; it.u = r.be (4); break;
+    case(0xCF):	it.kind = mp_kind::uint; it.u = r.be (8); break;
+    case(0xD0):	it.kind = mp_kind::sint; it.i = (int8_t)r.be (1); break;
+    case(0xD1):	it.kind = mp_kind::sint; it.i = (int16_t)r.be (2); break;
+    case(0xD2):	it.kind = mp_kind::sint; it.i = (int32_t)r.be (4); break;
+    case(0xD3):	it.kind = mp_kind::sint; it.i = (int64_t)r.be (8); break;
+    case(0xD4):	ext (1); break;
+    case(0xD5):	ext (2); break;
+    case(0xD6):	ext (4); break;
+    case(0xD7):	ext (8); break;
+    case(0xD8):	ext (16); break;
+    case(0xD9):	bytes (mp_kind::str, r.be (1)); break;
+    case(0xDA):	bytes (mp_kind::str, r.be (2)); break;
+    case(0xDB):	bytes (mp_kind::str, r.be (4)); break;
+    case(0xDC):	it.kind = mp_kind::array; it.n = r.be (2); break;
+    case(0xDD):	it.kind = mp_kind::array; it.n = r.be (4); break;
+    case(0xDE):	it.kind = mp_kind::map; it.n = r.be (2); break;
+    case(0xDF):	it.kind = mp_kind::map; it.n = r.be (4); break;
+    default:	break;
+    }
+    if (!r.ok)	it.kind = mp_kind::bad;
+    return it;
+}
+
+// Integer value of an item, false if it is not one.
+bool mp_int (const mp_item& it, int64_t& v)
+{
+    if (it.kind == mp_kind::sint)	v = it.i;
+    else if (it.kind == mp_kind::uint)	v = (int64_t)it.u;
+    else				return false;
+    return true;
+}
+
+// How a msgpack value is rendered.  Arrays inside an expression are
+// instructions ([opcode, args...]); CDT operations are [opcode, args...],
+// optionally wrapped in a context.
+enum class mp_mode : uint8_t { plain, exp, cdt };
+
+const int max_depth = 64;
+
+void mp_value (std::string& out, mp_reader& r, mp_mode mode, int depth);
+
+// Array elements after the first, which the caller has already written.
+void mp_rest (std::string& out, mp_reader& r, uint32_t n, mp_mode mode, int depth)
+{
+    for (uint32_t ii = 0; r.ok && ii < n; ii++) {
+	out += ',';
+	mp_value (out, r, mode, depth);
+    }
+}
+
+void mp_scalar (std::string& out, const mp_item& it)
+{
+    switch (it.kind) {
+    case(mp_kind::nil):		out += "null"; break;
+    case(mp_kind::boolean):	out += it.i ? "true" : "false"; break;
+    case(mp_kind::sint):	out += std::to_string (it.i); break;
+    case(mp_kind::uint):	out += std::to_string (it.u); break;
+    case(mp_kind::dbl):		put_double (out, it.d); break;
+    case(mp_kind::str):
+    case(mp_kind::bin):
+	// Server msgpack prefixes strings and blobs with their particle type.
+	if (it.n && (it.data[0] == (uint8_t)as_particle::type::t_string || it.data[0] == (uint8_t)as_particle::type::t_geojson)) {
+	    put_escaped (out, it.data + 1, it.n - 1);
+	} else if (it.n && (it.data[0] == (uint8_t)as_particle::type::t_blob)) {
+	    out += "{\"blob\":";
+	    put_hex (out, it.data + 1, it.n - 1);
+	    out += '}';
+	} else if (it.kind == mp_kind::str) {
+	    put_escaped (out, it.data, it.n);
+	} else {
+	    out += "{\"blob\":";
+	    put_hex (out, it.data, it.n);
+	    out += '}';
+	}
+	break;
+    case(mp_kind::ext):
+	out += "{\"ext\":" + std::to_string (it.ext) + ",\"data\":";
+	put_hex (out, it.data, it.n);
+	out += '}';
+	break;
+    default:
+	break;
+    }
+}
+
+// CDT opcode name: list ops below 64, map ops from 64, then the specials.
+void put_cdt_op (std::string& out, int64_t code)
+{
+    if (code == (int64_t)as_cdt::special_op::select)			put_string (out, "select");
+    else if (code == (int64_t)as_cdt::special_op::subcontext_eval)	put_string (out, "subcontext_eval");
+    else if (code < 64)							put_name<as_cdt::list_op> (out, code);
+    else								put_name<as_cdt::map_op> (out, code);
+}
+
+// A context is a flat [type, value, ...] list.
+void mp_ctx (std::string& out, mp_reader& r, int depth)
+{
+    auto it = mp_next (r);
+    if (it.kind != mp_kind::array) {
+	r.ok = false;
+	return;
+    }
+    out += '[';
+    for (uint32_t ii = 0; r.ok && ii < it.n; ii += 2) {
+	if (ii)	out += ',';
+	auto t = mp_next (r);
+	int64_t tv;
+	if (!mp_int (t, tv)) {
+	    r.ok = false;
+	    return;
+	}
+	// Creation flags ride in the top bits of the type.
+	put_name<as_cdt::ctx_type> (out, tv & 0x3F);
+	if (ii + 1 < it.n) {
+	    out += ',';
+	    mp_value (out, r, (tv & 0x3F) == (int64_t)as_cdt::ctx_type::exp ? mp_mode::exp : mp_mode::plain, depth + 1);
+	}
+    }
+    out += ']';
+}
+
+void mp_value (std::string& out, mp_reader& r, mp_mode mode, int depth)
+{
+    if (depth > max_depth) {
+	r.ok = false;
+	return;
+    }
+    auto it = mp_next (r);
+    if (it.kind == mp_kind::bad) {
+	r.ok = false;
+	return;
+    }
+    if (it.kind == mp_kind::map) {
+	out += '{';
+	for (uint32_t ii = 0; r.ok && ii < it.n; ii++) {
+	    if (ii)	out += ',';
+	    // Keys that are not strings are quoted as their JSON text.
+	    std::string key;
+	    mp_value (key, r, mp_mode::plain, depth + 1);
+	    if (!key.empty () && key[0] == '"')	out += key;
+	    else				put_string (out, key);
+	    out += ':';
+	    mp_value (out, r, mp_mode::plain, depth + 1);
+	}
+	out += '}';
+	return;
+    }
+    if (it.kind != mp_kind::array) {
+	mp_scalar (out, it);
+	return;
+    }
+    if (!it.n || (mode == mp_mode::plain)) {
+	out += '[';
+	for (uint32_t ii = 0; r.ok && ii < it.n; ii++) {
+	    if (ii)	out += ',';
+	    mp_value (out, r, mode, depth + 1);
+	}
+	out += ']';
+	return;
+    }
+
+    auto head = mp_next (r);
+    int64_t code;
+    if (!mp_int (head, code)) {
+	// Not an instruction after all
+	out += '[';
+	mp_scalar (out, head);
+	mp_rest (out, r, it.n - 1, mp_mode::plain, depth + 1);
+	out += ']';
+	return;
+    }
+
+    if (mode == mp_mode::cdt) {
+	if ((code == (int64_t)as_cdt::special_op::subcontext_eval) && (it.n == 3)) {
+	    out += "{\"ctx\":";
+	    mp_ctx (out, r, depth + 1);
+	    out += ",\"op\":";
+	    mp_value (out, r, mp_mode::cdt, depth + 1);
+	    out += '}';
+	    return;
+	}
+	out += "{\"op\":";
+	put_cdt_op (out, code);
+	out += ",\"args\":[";
+	for (uint32_t ii = 1; r.ok && ii < it.n; ii++) {
+	    if (ii > 1)	out += ',';
+	    mp_value (out, r, mp_mode::plain, depth + 1);
+	}
+	out += "]}";
+	return;
+    }
+
+    // Expression instruction
+    out += '[';
+    put_name<as_exp::op> (out, code);
+    if (code == (int64_t)as_exp::op::quote) {
+	mp_rest (out, r, it.n - 1, mp_mode::plain, depth + 1);
+    } else if ((code == (int64_t)as_exp::op::bin) || (code == (int64_t)as_exp::op::call)) {
+	// [bin, result_type, name] and [call, result_type, flags, op, bin_exp]
+	for (uint32_t ii = 1; r.ok && ii < it.n; ii++) {
+	    out += ',';
+	    int64_t v;
+	    auto save = r;
+	    auto arg = mp_next (r);
+	    if ((ii == 1) && mp_int (arg, v)) {
+		put_name<as_exp::result_type> (out, v);
+	    } else if ((code == (int64_t)as_exp::op::call) && (ii == 3)) {
+		r = save;
+		mp_value (out, r, mp_mode::cdt, depth + 1);
+	    } else {
+		r = save;
+		mp_value (out, r, (code == (int64_t)as_exp::op::bin) ? mp_mode::plain : mp_mode::exp, depth + 1);
+	    }
+	}
+    } else {
+	mp_rest (out, r, it.n - 1, mp_mode::exp, depth + 1);
+    }
+    out += ']';
+}
+
+// Writes one msgpack value; false, with out unchanged, if it does not
+// decode or does not use exactly n bytes.
+bool put_msgpack (std::string& out, const uint8_t *p, size_t n, mp_mode mode)
+{
+    size_t mark = out.size ();
+    mp_reader r = { p, p + n };
+    mp_value (out, r, mode, 0);
+    if (r.ok && (r.p == r.end))	return true;
+    out.resize (mark);
+    return false;
+}
+
+// A particle as its natural JSON type; false if it has none.
+bool put_particle (std::string& out, as_particle::type t, const uint8_t *p, size_t n)
+{
+    switch (t) {
+    case(as_particle::type::t_null):
+	if (n)	return false;
+	out += "null";
+	return true;
+    case(as_particle::type::t_integer): {
+	if (n != 8)	return false;
+	uint64_t v;
+	memcpy (&v, p, 8);
+	out += std::to_string ((int64_t)be64toh (v));
+	return true;
+    }
+    case(as_particle::type::t_float): {
+	if (n != 8)	return false;
+	uint64_t b;
+	double d;
+	memcpy (&b, p, 8);
+	b = be64toh (b);
+	memcpy (&d, &b, 8);
+	put_double (out, d);
+	return true;
+    }
+    case(as_particle::type::t_string):
+	put_escaped (out, p, n);
+	return true;
+    case(as_particle::type::t_boolean):
+	if (n != 1)	return false;
+	out += *p ? "true" : "false";
+	return true;
+    case(as_particle::type::t_list):
+    case(as_particle::type::t_map):
+	return put_msgpack (out, p, n, mp_mode::plain);
+    default:
+	return false;
+    }
+}
+
+void put_field (std::string& out, as_field *f)
+{
+    const uint8_t *p = f->data;
+    size_t n = f->data_sz ();
+    size_t mark = out.size ();
+    auto put_be = [&](size_t w) {
+	if (n != w)	return false;
+	uint64_t v = 0;
+	for (size_t ii = 0; ii < w; ii++)	v = (v << 8) | p[ii];
+	out += std::to_string (v);
+	return true;
+    };
+    auto put_le = [&](size_t w) {
+	if (n != w)	return false;
+	uint64_t v = 0;
+	for (size_t ii = w; ii--; )	v = (v << 8) | p[ii];
+	out += std::to_string (v);
+	return true;
+    };
+    bool ok = false;
+    switch (f->t) {
+    case(as_field::type::t_namespace):
+    case(as_field::type::t_set):
+    case(as_field::type::t_index_name):
+    case(as_field::type::t_udf_filename):
+    case(as_field::type::t_udf_function):
+	put_escaped (out, p, n);
+	ok = true;
+	break;
+    case(as_field::type::t_key):
+	// Particle type, then the value
+	ok = n && put_particle (out, (as_particle::type)p[0], p + 1, n - 1);
+	break;
+    case(as_field::type::t_trid):
+    case(as_field::type::t_sample_max):		ok = put_be (8); break;
+    case(as_field::type::t_socket_timeout):
+    case(as_field::type::t_recs_per_sec):	ok = put_be (4); break;
+    case(as_field::type::t_udf_op):		ok = put_be (1); break;
+    case(as_field::type::t_mrtid):		ok = put_le (8); break;
+    case(as_field::type::t_mrt_deadline):	ok = put_le (4); break;
+    case(as_field::type::t_predexp):		ok = put_msgpack (out, p, n, mp_mode::exp); break;
+    case(as_field::type::t_udf_arglist):	ok = put_msgpack (out, p, n, mp_mode::plain); break;
+    default:					break;
+    }
+    if (!ok) {
+	out.resize (mark);
+	put_hex (out, p, n);
+    }
+}
+
+void put_op (std::string& out, as_op *o)
+{
+    out += "{\"type\":";
+    put_string (out, to_string (o->op_type));
+    if (o->name_sz) {
+	out += ",\"name\":";
+	put_escaped (out, o->name, o->name_sz);
+    }
+    const uint8_t *p = o->data ();
+    size_t n = o->data_sz ();
+    if (!n) {
+	out += '}';
+	return;
+    }
+
+    size_t mark = out.size ();
+    bool ok = false;
+    // Request payloads for these op types are msgpack whatever the
+    // particle type says; results come back as ordinary particles.
+    bool blob = (o->data_type == as_particle::type::t_blob);
+    switch (o->op_type) {
+    case(as_op::type::t_cdt_read):
+    case(as_op::type::t_cdt_modify):
+	if (blob) {
+	    out += ",\"cdt\":";
+	    ok = put_msgpack (out, p, n, mp_mode::cdt);
+	}
+	break;
+    case(as_op::type::t_exp_read):
+    case(as_op::type::t_exp_modify):
+	if (blob) {
+	    // [expression, flags]
+	    mp_reader r = { p, p + n };
+	    auto it = mp_next (r);
+	    if ((it.kind == mp_kind::array) && (it.n == 2)) {
+		out += ",\"exp\":";
+		mp_value (out, r, mp_mode::exp, 1);
+		out += ",\"exp_flags\":";
+		mp_value (out, r, mp_mode::plain, 1);
+		ok = r.ok && (r.p == r.end);
+	    }
+	}
+	break;
+    case(as_op::type::t_bits_read):
+    case(as_op::type::t_bits_modify):
+    case(as_op::type::t_hll_read):
+    case(as_op::type::t_hll_modify):
+	if (blob) {
+	    out += ",\"args\":";
+	    ok = put_msgpack (out, p, n, mp_mode::plain);
+	}
+	break;
+    default:
+	break;
+    }
+    if (!ok) {
+	out.resize (mark);
+	out += ",\"value\":";
+	ok = put_particle (out, o->data_type, p, n);
+    }
+    if (!ok) {
+	out.resize (mark);
+	out += ",\"data\":";
+	put_hex (out, p, n);
+    }
+    out += '}';
+}
+
+}
+
+void to_json (std::string& out, const as_msg *msg, size_t sz)
+{
+    out += "{\"flags\":" + std::to_string (msg->flags);
+    if (msg->result_code)		out += ",\"result_code\":" + std::to_string (msg->result_code);
+    if (msg->be_generation)		out += ",\"generation\":" + std::to_string (be32toh (msg->be_generation));
+    if (msg->be_record_ttl)		out += ",\"record_ttl\":" + std::to_string (be32toh (msg->be_record_ttl));
+    if (msg->be_transaction_ttl)	out += ",\"transaction_ttl\":" + std::to_string (be32toh (msg->be_transaction_ttl));
+
+    // Sizes come off the wire; stop at the first one that overruns sz.
+    const uint8_t *end = (sz == SIZE_MAX) ? (const uint8_t *)UINTPTR_MAX : (const uint8_t *)msg + sz;
+    const uint8_t *p = msg->data;
+    bool truncated = false;
+    auto fits = [&](const uint8_t *q, size_t hdr) {
+	if ((size_t)(end - q) < hdr)	return false;
+	uint32_t len;
+	memcpy (&len, q, 4);
+	return (len = be32toh (len)) && ((size_t)(end - q - 4) >= len);
+    };
 
     if (msg->be_fields) {
-	ret["fields"] = nlohmann::json::object ();
-	as_field *f = (as_field *)msg->data;
+	out += ",\"fields\":{";
+	as_field *f = (as_field *)p;
 	for (auto ii = msg->n_fields (); ii--; f = f->next ()) {
-	    const std::string fname = to_string (f->t);
-	    std::string val;
-	    val.resize (2 * f->data_sz ());
-	    to_hex (&(val[0]), f->data, f->data_sz ());
-	    ret["fields"][fname] = val;
+	    if (!fits ((const uint8_t *)f, sizeof(as_field))) {
+		truncated = true;
+		break;
+	    }
+	    if (out.back () != '{')	out += ',';
+	    put_string (out, to_string (f->t));
+	    out += ':';
+	    put_field (out, f);
+	    p = (const uint8_t *)f->next ();
 	}
+	out += '}';
     }
 
-    if (msg->be_ops) {
-	ret["ops"] = nlohmann::json::array ();
-	as_op *o = msg->ops_begin ();
+    if (msg->be_ops && !truncated) {
+	out += ",\"ops\":[";
+	as_op *o = (as_op *)p;
 	for (auto ii = msg->n_ops (); ii--; o = o->next ()) {
-	    nlohmann::json jop;
-	    jop["type"] = to_string (o->op_type);
-	    if (o->name_sz) {
-		jop["name"] = std::string ((const char *)&(o->name[0]), o->name_sz);
-	    }
-	    if (o->data_sz ()) {
-		std::string val;
-		val.resize (2 * o->data_sz ());
-		to_hex (&(val[0]), o->data (), o->data_sz ());
-		jop["data"] = val;
+	    if (!fits ((const uint8_t *)o, sizeof(as_op)) || (be32toh (o->be_sz) < 4u + o->name_sz)) {
+		truncated = true;
+		break;
 	    }
-	    ret["ops"].push_back (jop);
+	    if (out.back () != '[')	out += ',';
+	    put_op (out, o);
 	}
+	out += ']';
     }
+    if (truncated)	out += ",\"truncated\":true";
+    out += '}';
+}
 
-    return ret;
+nlohmann::json to_json (const as_msg *msg) {
+    std::string out;
+    to_json (out, msg);
+    return nlohmann::json::parse (out);
 }
 
 // Helper function to manually pack msgpack for expressions
@@ -19,6 +19,10 @@ uint32_t secs_since_cfepoch (void);
 std::string get_labeled (const std::string& str, const std::string& l);
 void to_hex (void *dst, const void* src, size_t sz);
 void from_hex (void *dst, const void* src, size_t sz);
+// One JSON object per message: typed particles, msgpack payloads decoded
+// (CDT and expression opcodes by name), digests and anything else as hex.
+// The string form streams straight into out; sz bounds the walk when known.
+void to_json (std::string& out, const as_msg *msg, size_t sz = SIZE_MAX);
 nlohmann::json to_json (const as_msg *msg);
 std::vector<uint8_t> to_expr_msgpack(const nlohmann::json& expr);
 std::vector<uint8_t> to_expr_msgpack_wrapped(const nlohmann::json& expr, as_exp::flags flags = as_exp::flags::none);
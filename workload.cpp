@@ -1,20 +1,34 @@
+#include "affinity.hpp"
 #include "as_proto.hpp"
+#include "config.hpp"
+#include "info_parse.hpp"
+#include "metrics_shm.hpp"
+#include "recorder.hpp"
+#include "server_latency.hpp"
+#include "stats.hpp"
 #include "util.hpp"
+#include <arpa/inet.h>
+#include <hdr/hdr_histogram.h>
+#include <hdr/hdr_histogram_log.h>
 #include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <endian.h>
+#include <fcntl.h>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <netdb.h>
 #include <netinet/tcp.h>
 #include <nlohmann/json.hpp>
 #include <numeric>
+#include <poll.h>
 #include <queue>
 #include <random>
 #include <signal.h>
@@ -27,6 +41,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
@@ -36,22 +51,154 @@
 using json = nlohmann::json;
 
 using namespace std;
-unordered_map<string,string> p;
+
+struct workload_cfg
+{
+  string agent;
+  string asdb;
+  string mode;
+  string ns;
+  string sn;
+  int bidx;
+  int duration;
+  int keylb;
+  int keyub;
+  int nbins;
+  int rate;
+  int recsize;
+  int threads;
+  bool truncate;
+  vector<int> cpus;
+  int reporter_cpu;
+  int warmup;
+  uint64_t warmup_ops;
+  bool steady;
+  int steady_window;
+  double steady_cv;
+  bool search;
+  int search_start;
+  int search_max;
+  double search_step;
+  int search_bisect;
+  int search_secs;
+  double search_eff;
+  double search_max_err;
+  int slo_p99;
+  string hlog;
+  string server_hlog;
+  string server_nodes;
+  string timestamping;
+  bool trace;
+  string slow_log;
+  int slow_us;
+  string metrics_shm;
+  bool errors_fatal;
+  string role;
+  string agents;
+  int agent_port;
+  int local_agents;
+  int start_delay;
+} g_cfg;
+json g_run_meta;
+bool apply_config (const config& cfg, string& err);
 
 atomic<bool> g_running;
+atomic<bool> g_interrupted;
 auto g_rng = std::default_random_engine {};
-void sigint_handler (int signum) { g_running.store(false); }
+void sigint_handler (int signum) { g_interrupted.store(true); g_running.store(false); }
 atomic<uint32_t> g_idx;
-vector<uint32_t> g_buf;
+vector<uint64_t> g_buf;	// latencies in ns, two halves swapped per interval
+atomic<uint64_t> g_overflow;	// ops that found their half full
+atomic<uint64_t> g_errors;	// ops answered with a non-zero result code
+unique_ptr<wlm_writer> g_wlm;	// METRICS_SHM, for workload_top
+
+// TIMESTAMPING: each worker's op latency split at the host's edges, one
+// recorder per phase.  Workers register their set while they run.
+const char *phase_names[] = { "encode", "kernel_send", "wire", "kernel_recv", "read" };
+const size_t nphases = sizeof(phase_names) / sizeof(phase_names[0]);
+
+struct phase_set
+{
+  interval_recorder r[nphases];
+  atomic<uint64_t> missing[nphases] = {};
+  void record (uint64_t encode_ns, const call_stamps& st)
+  {
+    uint64_t v[nphases] = { encode_ns, st.kernel_send (), st.wire (), st.kernel_recv (), st.read_body () };
+    // A kernel phase needs the stamps at both its ends.  Ops short of one
+    // are counted, so a thin histogram shows for what it is; a phase that
+    // has its stamps is recorded even at 0.
+    bool have[nphases] = { true, st.tx != 0, (st.hw_tx && st.hw_rx) || (st.tx && st.rx), st.rx != 0, true };
+    for (size_t ii = 0; ii < nphases; ii++)
+      if (have[ii])
+	this->r[ii].record (v[ii]);
+      else
+	this->missing[ii].fetch_add (1, memory_order_relaxed);
+  }
+};
+mutex g_phase_mtx;
+vector<phase_set*> g_phase_sets;
+
+// The interval just ended, summed over the workers, as "phase:<name>",
+// with the ops that lacked a stamp for each phase in missing; caller
+// closes.
+void sample_phases (vector<pair<string, hdr_histogram*>>& out, uint64_t (&missing)[nphases])
+{
+  size_t base = out.size ();
+  for (size_t ii = 0; ii < nphases; ii++) {
+    out.emplace_back (string ("phase:") + phase_names[ii], new_latency_hist ());
+    missing[ii] = 0;
+  }
+  lock_guard<mutex> lg (g_phase_mtx);
+  for (auto ps : g_phase_sets)
+    for (size_t ii = 0; ii < nphases; ii++) {
+      hdr_add (out[base + ii].second, ps->r[ii].sample ());
+      missing[ii] += ps->missing[ii].exchange (0, memory_order_relaxed);
+    }
+}
+
+// TRACE: each op's client side phases from the workers' trace rings, as
+// "trace:<name>"; caller closes.  pace is the wait for the op's scheduled
+// time after encoding.  Slow calls go to SLOW_LOG, one JSON line each with
+// both messages.
+const char *trace_names[] = { "encode", "pace", "send", "wait", "read" };
+
+uint64_t sample_traces (vector<pair<string, hdr_histogram*>>& out, FILE *slow)
+{
+  size_t base = out.size ();
+  for (auto name : trace_names)
+    out.emplace_back (string ("trace:") + name, new_latency_hist ());
+  auto lost = call_trace_drain ([&](const call_trace& t) {
+    if (t.encode && t.encoded) {
+      hdr_record_value (out[base].second, t.encoded - t.encode);
+      hdr_record_value (out[base + 1].second, t.send - t.encoded);
+    }
+    hdr_record_value (out[base + 2].second, t.sent - t.send);
+    hdr_record_value (out[base + 3].second, t.first - t.sent);
+    hdr_record_value (out[base + 4].second, t.done - t.first);
+  });
+  for (auto& s : call_trace_slow_drain ()) {
+    if (!slow)
+      continue;
+    const auto& t = s.t;
+    json js = { { "at", to_epoch_ns (t.send) }, { "total", t.done - t.send },
+		{ "encode", t.encoded ? t.encoded - t.encode : 0 }, { "pace", t.encoded ? t.send - t.encoded : 0 }, { "send", t.sent - t.send },
+		{ "wait", t.first - t.sent }, { "read", t.done - t.first },
+		{ "req", to_json ((const as_msg *)s.req.data ()) }, { "res", to_json ((const as_msg *)s.res.data ()) } };
+    fprintf (slow, "%s\n", js.dump ().c_str ());
+  }
+  if (slow)
+    fflush (slow);
+  return lost;
+}
 
 as_msg *visit (as_msg *msg, int ri, int flags)
 {
   msg->clear ();
   msg->flags = flags;
   msg->be_transaction_ttl = htobe32 (1000);
-  dieunless (msg->add (as_field::type::t_namespace, p["NS"]));
-  dieunless (msg->add (as_field::type::t_set, p["SN"]));
-  add_integer_key_digest (msg->add (as_field::type::t_digest_ripe, 20)->data, p["SN"], ri);
+  dieunless (msg->add (as_field::type::t_namespace, g_cfg.ns));
+  dieunless (msg->add (as_field::type::t_set, g_cfg.sn));
+  add_integer_key_digest (msg->add (as_field::type::t_digest_ripe, 20)->data, g_cfg.sn, ri);
   return msg;
 }
 as_msg *set_bin (as_msg *msg, uint16_t bidx, int64_t val)
@@ -96,75 +243,193 @@ void record_init (as_msg *msg, int ri, size_t numBins, size_t padSize)
 void record_size (as_msg *msg, int ri)
 {
   visit (msg, ri, AS_MSG_FLAG_READ);
-  dieunless(msg->add(as_field::type::t_conndata, p["AGENT"] + "-" + "init"));
+  dieunless(msg->add(as_field::type::t_conndata, g_cfg.agent + "-" + "init"));
   auto pload = json::to_msgpack ({ { 74 }, 0 });
   dieunless (msg->add (as_op::type::t_exp_read, "size", pload.size (), pload.data ()));
 }
 
-void workload_entry (int rate, bool doWrite)
+void workload_entry (int rate, bool doWrite, int cpu)
 {
-  int fd = tcp_connect (p["ASDB"]);
-  auto nbins = stoi (p["NBINS"]);
-  auto id_lb = stoi (p["KEYLB"]);
-  auto id_ub = stoi (p["KEYUB"]);
+  // Pin before allocating so the buffer lands on this core's node.
+  if (cpu >= 0)
+    dieunless (pin_thread (cpu));
+  char *buf = (char *)numa_local_alloc (2048);
+  dieunless (buf);
+  int fd = tcp_connect (g_cfg.asdb);
 
   thread_local static std::random_device rd;
   thread_local static std::mt19937 gen(rd());
-  std::uniform_int_distribution<> distr(id_lb, id_ub); // define the range
-  std::uniform_int_distribution<> distb(1, nbins); // define the range
+  std::uniform_int_distribution<> distr(g_cfg.keylb, g_cfg.keyub); // define the range
+  std::uniform_int_distribution<> distb(1, g_cfg.nbins); // define the range
   std::uniform_int_distribution<> distv(0, std::numeric_limits<int32_t>::max ());
 
   std::uniform_real_distribution<double> distd (0, 1);
 
+  // Registered before the first call so the reporter sees every op.
+  unique_ptr<phase_set> ps;
+  if (g_cfg.timestamping != "off") {
+    dieunless (timestamping_enable (fd, g_cfg.timestamping == "hardware"));
+    ps = make_unique<phase_set> ();
+    lock_guard<mutex> lg (g_phase_mtx);
+    g_phase_sets.push_back (ps.get ());
+  }
+
+  wlm_slot *ws = g_wlm ? g_wlm->claim (cpu) : nullptr;
+
   string str = "Zm9vYmFyCg==";
   auto sret = call_info(fd, "user-agent-set:value=" + str + "\n");
-  uint64_t tnow = usec_now ();
-  uint64_t tnext;
+  uint64_t tnow = now_ns ();
+  uint64_t tnext = tnow;
   int64_t ri;
   int64_t val;
   size_t bidx;
-  char buf[2048];
   as_msg *res = (as_msg *)(buf + 64);
   as_msg *req = (as_msg *)(buf + 1024);
   uint64_t duration;
 
-  double idi = rate ? 1000000.0f / (double)rate : 0.0;
+  double idi = rate ? 1e9 / (double)rate : 0.0;
 
   while (g_running.load ()) {
-    tnext = tnow + -log (1.0f - distd (gen)) * idi;
+    // Advance from the previous schedule, not from now, so sleep overshoot
+    // and service time don't lower the offered rate.
+    tnext = tnext + -log (1.0f - distd (gen)) * idi;
     if (rate == 0)
       tnext = tnow;
-    uint16_t bidx = stoi (p["BIDX"]) < 0 ? distb (gen) : stoi (p["BIDX"]);
+    uint16_t bidx = g_cfg.bidx < 0 ? distb (gen) : g_cfg.bidx;
+    uint64_t tenc = ps ? now_ns () : 0;
+    call_trace_encode ();
     visit (req, distr (gen), doWrite ? AS_MSG_FLAG_WRITE : AS_MSG_FLAG_READ);
     if (doWrite) {
       set_bin (req, bidx, distv (gen));
     } else {
       get_bin (req, bidx);
     }
+    call_trace_encoded ();
+    uint64_t encode_ns = ps ? now_ns () - tenc : 0;
 
-    while (g_running.load () && ((tnow = usec_now ()) < tnext)) {
-      uint64_t td = tnext - tnow;
+    while (g_running.load () && ((tnow = now_ns ()) < tnext)) {
+      uint64_t td = (tnext - tnow) / 1000;
       usleep ((td>10) ? (td-10) : 1);
     }
     if (!g_running.load ()) {
       break;
     }
 
+    // How far the send slipped behind the schedule.
+    uint64_t lag = (rate && (tnow > tnext)) ? tnow - tnext : 0;
     auto idx = g_idx.fetch_add (2);
-    auto ii = (idx / 2) + ((idx & 1) * (g_buf.size () / 2));
-    dieunless ((1024-64) > call (fd, &res, req, g_buf.data () + ii));
-    dieunless (res->result_code == 0);
+    uint64_t dur;
+    if (ps) {
+      call_stamps st;
+      dieunless ((1024-64) > call (fd, &res, req, st));
+      dur = st.total ();
+      ps->record (encode_ns, st);
+    } else
+      dieunless ((1024-64) > call (fd, &res, req, &dur));
+    // A half holds one interval; ops beyond it are counted, not stored.
+    // A search times each op from its scheduled send, so a server that
+    // falls behind can't hide the queueing it causes from the SLO.
+    if ((idx / 2) < g_buf.size () / 2)
+      g_buf[(idx / 2) + ((idx & 1) * (g_buf.size () / 2))] = g_cfg.search ? dur + lag : dur;
+    else
+      g_overflow.fetch_add (1, memory_order_relaxed);
+    if (ws)
+      g_wlm->record (ws, doWrite ? WLM_WRITE : WLM_READ, tnow + dur, dur, res->result_code != 0);
+    if (res->result_code != 0)
+      g_errors.fetch_add (1, memory_order_relaxed);
+    if (g_cfg.errors_fatal)
+      dieunless (res->result_code == 0);
   }
 
+  if (ps) {
+    lock_guard<mutex> lg (g_phase_mtx);
+    g_phase_sets.erase (find (g_phase_sets.begin (), g_phase_sets.end (), ps.get ()));
+  }
+  if (ws)
+    g_wlm->release (ws);
   close (fd);
+  numa_local_free (buf, 2048);
+
+}
+
+// Interval histograms are in ns, as recorded by call ().
+hdr_histogram *interval_hist (const vector<uint64_t>& iv)
+{
+  hdr_histogram *h = new_latency_hist ();
+  dieunless (h != nullptr);
+  for (auto v : iv)
+    hdr_record_value (h, v);
+  return h;
+}
+
+// Swap the sample buffer halves and move the retired half into iv.
+// Returns the ops since the last call that didn't fit in a half.
+uint64_t drain_interval (vector<uint64_t>& iv)
+{
+  // Workers add 2 at a time, so the parity read here is still current.
+  auto nidx = !(g_idx.load () & 1); // ping pong
+  auto lidx = g_idx.exchange (nidx);
+  auto idxb = (lidx & 1) * (g_buf.size () / 2);
+  auto n = min<size_t> (lidx / 2, g_buf.size () / 2);
+  iv.assign (g_buf.begin () + idxb, g_buf.begin () + idxb + n);
+  std::fill_n (g_buf.begin () + idxb, n, 0);
+  return g_overflow.exchange (0);
+}
+
+// Two seconds of samples per half at the given total rate, at least 512K,
+// with the overflow and error counts cleared.
+void size_sample_buffer (uint64_t rate)
+{
+  g_buf.assign (2 * max<uint64_t> (512 * 1024, 2 * rate), 0);
+  g_overflow = 0;
+  g_errors = 0;
+}
 
+// Server latencies for SERVER_HLOG, polled as each interval is written.
+unique_ptr<server_latency_log> open_server_log (FILE*& fp)
+{
+  if (g_cfg.server_hlog.empty ())
+    return nullptr;
+  vector<string> nodes;
+  for (auto hp : info_list (g_cfg.server_nodes.empty () ? g_cfg.asdb : g_cfg.server_nodes, ','))
+    nodes.emplace_back (hp);
+  dieunless ((fp = fopen (g_cfg.server_hlog.c_str (), "w")) != nullptr);
+  return make_unique<server_latency_log> (nodes, fp);
 }
 
 void print_entry (int rate)
 {
+  if (g_cfg.reporter_cpu >= 0)
+    dieunless (pin_thread (g_cfg.reporter_cpu));
   uint64_t tlast = 0;
   uint64_t tnow = usec_now ();
+  uint64_t tstart = tnow;
+  uint64_t tmeasure = 0;
+  uint64_t warm_ops = 0;
+  bool measuring = (g_cfg.warmup == 0) && (g_cfg.warmup_ops == 0);
+  steady_detector steady (g_cfg.steady_window, g_cfg.steady_cv);
   json jo = { { "now", tnow } };
+  vector<uint64_t> iv;
+  unique_ptr<hist_log> hlog;
+  FILE *slog = nullptr;
+  auto srv = open_server_log (slog);
+  FILE *slow = nullptr;
+  if (g_cfg.trace && !g_cfg.slow_log.empty ())
+    dieunless ((slow = fopen (g_cfg.slow_log.c_str (), "w")) != nullptr);
+
+  if (!g_cfg.hlog.empty ())
+    dieunless ((hlog = hist_log::open (g_cfg.hlog)) != nullptr);
+  auto start_log = [&]() {
+    if (srv)
+      srv->write_header (tmeasure);
+    if (hlog)
+      hlog->header (g_cfg.agent.c_str (), tmeasure * 1000);
+  };
+
+  if (measuring) {
+    tmeasure = tnow;
+    start_log ();
+  }
 
   while (g_running.load()) {
     while (g_running.load() && ((tnow = usec_now ()) < (tlast + (1000000 / rate)))) {
@@ -173,36 +438,140 @@ void print_entry (int rate)
     }
     if (!g_running.load())	    break;
     tlast = tnow;
-    jo["now"] = tnow;
-    jo["data"] = json::array ();
-    auto nidx = !g_idx & 1; // ping pong
-    auto lidx = g_idx.exchange (nidx);
-    auto idxb = (lidx & 1) * (g_buf.size () / 2);
-    jo["data"].get_ptr<json::array_t*>()->reserve (lidx / 2);
-    for (auto ii = 0; ii < (lidx / 2); ii++) {
-      jo["data"][ii] = g_buf[idxb + ii];
-      g_buf[idxb + ii] = 0;
+    auto overflow = drain_interval (iv);
+    auto errors = g_errors.exchange (0);
+    vector<pair<string, hdr_histogram*>> phases;
+    uint64_t trace_lost = 0, phases_missing[nphases] = {};
+    if (g_cfg.timestamping != "off")
+      sample_phases (phases, phases_missing);
+    if (g_cfg.trace)
+      trace_lost = sample_traces (phases, measuring ? slow : nullptr);
+    auto close_phases = [&phases]() {
+      for (auto& p : phases)
+	hdr_close (p.second);
+    };
+
+    // Warmup intervals are drained but never reported.
+    if (!measuring) {
+      warm_ops += iv.size ();
+      if ((tnow - tstart < g_cfg.warmup * 1000000ul) || (warm_ops < g_cfg.warmup_ops))
+	continue;
+      measuring = true;
+      tmeasure = tnow;
+      start_log ();
+      json jw = { { "now", tnow }, { "event", "warmup_done" }, { "secs", (tnow - tstart) / 1e6 }, { "ops", warm_ops } };
+      printf ("%s\n", jw.dump ().c_str ());
+      fflush (stdout);
+      close_phases ();
+      continue;
     }
 
+    jo["now"] = tnow;
+    jo["data"] = iv;
+    jo["errors"] = errors;
+    if (overflow)
+      jo["overflow"] = overflow;
+    else
+      jo.erase ("overflow");
+    // "phase:wire" lands in jo["phases"]["wire"], "trace:wait" in jo["trace"]["wait"].
+    for (auto& [tag, h] : phases) {
+      auto colon = tag.find (':');
+      auto group = tag.substr (0, colon) == "phase" ? "phases" : tag.substr (0, colon);
+      jo[group][tag.substr (colon + 1)] = { { "count", h->total_count }, { "p50", hdr_value_at_percentile (h, 50.0) },
+					    { "p99", hdr_value_at_percentile (h, 99.0) }, { "p999", hdr_value_at_percentile (h, 99.9) },
+					    { "max", hdr_max (h) } };
+    }
+    if (g_cfg.timestamping != "off")
+      for (size_t ii = 0; ii < nphases; ii++)
+	jo["phases"][phase_names[ii]]["missing"] = phases_missing[ii];
+    if (g_cfg.trace)
+      jo["trace_lost"] = trace_lost;
     printf ("%s\n", jo.dump ().c_str ());
     fflush (stdout);
+    if (hlog) {
+      auto h = interval_hist (iv);
+      hlog->write ("", (tnow - 1000000 / rate) * 1000, tnow * 1000, h);
+      hdr_close (h);
+      for (auto& [tag, h] : phases)
+	hlog->write (tag, (tnow - 1000000 / rate) * 1000, tnow * 1000, h);
+    }
+    close_phases ();
+    if (srv)
+      srv->sample (tnow - 1000000 / rate, tnow);
+
+    if (g_cfg.steady && steady.add ((double)(iv.size () + overflow) * rate, percentile (iv, 99.0))) {
+      json js = { { "now", tnow }, { "event", "steady" }, { "secs", (tnow - tmeasure) / 1e6 },
+		  { "cv_tput", steady.cv_tput () }, { "cv_p99", steady.cv_p99 () } };
+      printf ("%s\n", js.dump ().c_str ());
+      fflush (stdout);
+      g_running.store (false);
+    }
+    if ((g_cfg.duration > 0) && (tnow - tmeasure >= g_cfg.duration * 1000000ul))
+      g_running.store (false);
   }
 
+  hlog.reset ();
+  srv.reset ();
+  if (slog)
+    fclose (slog);
+  if (slow)
+    fclose (slow);
+}
+
+// Identity of the server under test, in one info round trip.
+json server_info (void)
+{
+  int fd = tcp_connect (g_cfg.asdb);
+  auto kv = call_info_batch (fd, { "build", "edition", "node", "cluster-name" });
+  close (fd);
+  json ret = json::object ();
+  for (const auto& [k, v] : kv)
+    ret[k] = v;
+  return ret;
+}
+
+// Workers take the core list round robin; the reporter, which also ends
+// the run, gets the housekeeping core.  The placement and the server's
+// identity go out as the leading meta line.
+vector<int> place_workers (void)
+{
+  json jw = json::array ();
+  vector<int> wcpu (g_cfg.threads, -1);
+  for (int ii=0; ii < g_cfg.threads; ii++) {
+    if (!g_cfg.cpus.empty ())
+      wcpu[ii] = g_cfg.cpus[ii % g_cfg.cpus.size ()];
+    jw.push_back ({ { "thread", ii }, { "cpu", wcpu[ii] }, { "node", (wcpu[ii] < 0) ? -1 : cpu_node (wcpu[ii]) } });
+  }
+  g_run_meta["workers"] = jw;
+  g_run_meta["reporter"] = { { "cpu", g_cfg.reporter_cpu }, { "node", (g_cfg.reporter_cpu < 0) ? -1 : cpu_node (g_cfg.reporter_cpu) } };
+  g_run_meta["topology"] = topology_json ();
+  g_run_meta["server"] = server_info ();
+  g_run_meta["clock"] = { { "source", clock_source () }, { "tsc_ghz", clock_calibration ().ghz } };
+  printf ("%s\n", json ({ { "meta", g_run_meta } }).dump ().c_str ());
+  fflush (stdout);
+  return wcpu;
 }
 
 void update_entry (bool doWrite)
 {
-  int nth = stoi (p["THREADS"]);
   vector<thread> vth;
 
   g_idx = 0;
-  g_buf.resize (1024*1024);
-
-  if (stoi (p["DURATION"]) > 0)
-    vth.emplace_back ([&](){ sleep (stoi (p["DURATION"])); g_running.store(false); });
+  size_sample_buffer ((uint64_t)g_cfg.rate * g_cfg.threads);
+  if (g_cfg.trace)
+    call_trace_start (g_cfg.slow_log.empty () ? 0 : g_cfg.slow_us * 1000ull);
+  if (!g_cfg.metrics_shm.empty ()) {
+    try {
+      g_wlm = make_unique<wlm_writer> (g_cfg.metrics_shm, g_cfg.threads, g_cfg.agent, g_cfg.mode);
+    } catch (const exception& e) {
+      fprintf (stderr, "%s\n", e.what ());
+      exit (1);
+    }
+  }
 
-  for (int ii=0; ii < nth; ii++)
-    vth.emplace_back (workload_entry, stoi (p["RATE"]), doWrite);
+  auto wcpu = place_workers ();
+  for (int ii=0; ii < g_cfg.threads; ii++)
+    vth.emplace_back (workload_entry, g_cfg.rate, doWrite, wcpu[ii]);
 
   vth.emplace_back (print_entry, 1);
 
@@ -213,26 +582,140 @@ void update_entry (bool doWrite)
   for (auto& th : vth) {
     th.join ();
   }
+  g_wlm.reset ();
+}
 
+// Run the workers at a total offered rate for WARMUP + SEARCH_SECS and
+// summarize the measured part.
+json search_step (int rate, bool doWrite, const vector<int>& wcpu)
+{
+  vector<thread> vth;
+  vector<uint64_t> iv, samples;
+  int prate = max (1, rate / g_cfg.threads);
+  uint64_t overflow = 0, errors = 0;
+
+  size_sample_buffer (rate);
+  g_idx = 0;
+  g_running.store (true);
+  for (int ii=0; ii < g_cfg.threads; ii++)
+    vth.emplace_back (workload_entry, prate, doWrite, wcpu[ii]);
+
+  uint64_t tstart = usec_now ();
+  uint64_t tmeasure = tstart + g_cfg.warmup * 1000000ul;
+  uint64_t tend = tmeasure + g_cfg.search_secs * 1000000ul;
+  for (uint64_t tnext = tstart + 1000000; !g_interrupted.load (); tnext += 1000000) {
+    uint64_t tnow;
+    while (!g_interrupted.load () && ((tnow = usec_now ()) < tnext)) {
+      uint64_t td = tnext - tnow;
+      usleep ((td>50) ? (td-50) : 10);
+    }
+    auto o = drain_interval (iv);
+    auto e = g_errors.exchange (0);
+    if (tnext > tmeasure) {
+      samples.insert (samples.end (), iv.begin (), iv.end ());
+      overflow += o;
+      errors += e;
+    }
+    if (tnext >= tend)
+      break;
+  }
+  g_running.store (false);
+  for (auto& th : vth)
+    th.join ();
+  drain_interval (iv);
+
+  // Overflowed ops were served but not timed; a step with any fails.
+  // Latencies run from each op's scheduled send, not its actual one.
+  uint64_t nops = samples.size () + overflow;
+  double achieved = nops / (double)g_cfg.search_secs;
+  double err_pct = nops ? 100.0 * errors / nops : 0.0;
+  json ret = {
+    { "offered", prate * g_cfg.threads },
+    { "achieved", achieved },
+    { "count", samples.size () },
+    { "overflow", overflow },
+    { "errors", errors },
+    { "error_pct", err_pct },
+    { "p50", percentile (samples, 50.0) },
+    { "p90", percentile (samples, 90.0) },
+    { "p99", percentile (samples, 99.0) },
+    { "p999", percentile (samples, 99.9) },
+    { "max", percentile (samples, 100.0) },
+  };
+  ret["ok"] = !samples.empty () && !overflow
+    && (err_pct <= g_cfg.search_max_err)
+    && (ret["p99"].get<uint64_t> () <= g_cfg.slo_p99 * 1000ull)
+    && (achieved >= g_cfg.search_eff * ret["offered"].get<int> ());
+  return ret;
+}
+
+// Step the offered load geometrically until the p99 SLO, the error rate
+// or the achieved/offered ratio fails, then bisect between the last passing and
+// first failing rate.  The knee is the highest passing step.
+void search_entry (bool doWrite)
+{
+  auto wcpu = place_workers ();
+  json curve = json::array ();
+  json knee;
+  int lo = 0, hi = 0;
+
+  auto step = [&](int rate) {
+    auto js = search_step (rate, doWrite, wcpu);
+    if (g_interrupted.load ())
+      return false;
+    js["event"] = "search_step";
+    js["now"] = usec_now ();
+    printf ("%s\n", js.dump ().c_str ());
+    fflush (stdout);
+    curve.push_back (js);
+    if (js["ok"].get<bool> () && (knee.is_null () || (js["offered"] > knee["offered"])))
+      knee = js;
+    return js["ok"].get<bool> ();
+  };
+
+  for (double rate = g_cfg.search_start; !g_interrupted.load (); rate *= g_cfg.search_step) {
+    int ir = min ((int)rate, g_cfg.search_max);
+    if (!step (ir)) {
+      hi = ir;
+      break;
+    }
+    lo = ir;
+    if (ir >= g_cfg.search_max)
+      break;
+  }
+
+  for (int ii = 0; (hi > 0) && (ii < g_cfg.search_bisect) && !g_interrupted.load (); ii++) {
+    int mid = lo + (hi - lo) / 2;
+    if ((mid <= lo) || (mid >= hi))
+      break;
+    if (step (mid))	lo = mid;
+    else		hi = mid;
+  }
+
+  sort (curve.begin (), curve.end (), [](const json& a, const json& b) { return a["offered"] < b["offered"]; });
+  json jo = { { "now", usec_now () }, { "event", "search_done" }, { "slo_p99", g_cfg.slo_p99 },
+	      { "knee", knee }, { "curve", curve } };
+  printf ("%s\n", jo.dump ().c_str ());
+  fflush (stdout);
 }
 
 void init_entry (void)
 {
   uint64_t tb0 = usec_now ();
   printf ("%lu\n", tb0);
-  int fd = tcp_connect (p["ASDB"]);
-  auto recsize = stoi (p["RECSIZE"]);
-  auto nbins = stoi (p["NBINS"]);
-  auto id_lb = stoi (p["KEYLB"]);
-  auto id_ub = stoi (p["KEYUB"]);
+  int fd = tcp_connect (g_cfg.asdb);
+  auto recsize = g_cfg.recsize;
+  auto nbins = g_cfg.nbins;
+  auto id_lb = g_cfg.keylb;
+  auto id_ub = g_cfg.keyub;
   char *buf = (char *)malloc (2 * 1024 * 1024);
   as_msg *res = (as_msg *)(buf + 64);
   as_msg *req = (as_msg *)(buf + 1024);
-  uint32_t dur = 0;
+  uint64_t dur = 0;
   json jo = { { "type", "insert" }, { "id", 0 }, { "bins", nbins } };
 
-  if (stoi (p["TRUNCATE"])) {
-    auto sret = call_info (fd, "truncate:namespace=" + p["NS"] + ";set=" + p["SN"] + ";\n", &dur);
+  if (g_cfg.truncate) {
+    auto sret = call_info (fd, "truncate:namespace=" + g_cfg.ns + ";set=" + g_cfg.sn + ";\n", &dur);
     // sret == 'truncate:namespace=ns0;set=demo;\tok'
     json jt0 = { { "type", "truncate" }, { "dur", dur } };
     printf ("%s\n", jt0.dump ().c_str ());
@@ -265,54 +748,513 @@ void init_entry (void)
   free (buf);
 }
 
-const char g_ep_str[] = "WORKLOAD_";
-const size_t g_ep_str_sz = char_traits<char>::length (g_ep_str);
+// The agent/coordinator control channel is newline delimited json.
+bool send_line (int fd, const json& jo)
+{
+  auto str = jo.dump () + "\n";
+  return send (fd, str.data (), str.size (), MSG_NOSIGNAL) == (ssize_t)str.size ();
+}
 
-int main (int argc, char **argv, char **envp)
+bool recv_line (int fd, string& buf, json& jo)
 {
-  // srand ((unsigned int)clock ());
-  // Defaults for required variables.
-  p = {
-    { "AGENT",		"workload" },
-    { "ASDB",		"localhost:3000" },
-    { "BIDX",		"-1" },
-    { "DURATION",		"0" },
-    { "KEYLB",		"1" },
-    { "KEYUB",		"10" },
-    { "MODE",		"read"},
-    { "NBINS",		"20000" },
-    { "NS",			"ns0" },
-    { "RATE",		"100" },
-    { "RECSIZE",		"500000" },
-    { "SN",			"demo" },
-    { "THREADS",		"1" },
-    { "TRUNCATE",		"1" },
+  size_t pos;
+  while ((pos = buf.find ('\n')) == string::npos) {
+    char tmp[65536];
+    auto n = recv (fd, tmp, sizeof(tmp), 0);
+    if (n <= 0)
+      return false;
+    buf.append (tmp, n);
+  }
+  jo = json::parse (buf.substr (0, pos), nullptr, false);
+  buf.erase (0, pos + 1);
+  return !jo.is_discarded ();
+}
+
+// Run one job for the coordinator: start the workers at start_at (realtime
+// usec), then ship each measured 1s interval as an encoded histogram.
+// Intervals are numbered from start_at, so they line up across agents.
+void agent_job (int cfd, uint64_t start_at, bool doWrite)
+{
+  vector<thread> vth;
+  vector<uint64_t> iv;
+  uint64_t tnow;
+
+  // Placement asks the server for its identity; do it before the start,
+  // not after it.
+  auto wcpu = place_workers ();
+  // Anything from the coordinator before the start, a "cancel" or the
+  // connection closing, calls the job off.
+  while (!g_interrupted.load () && ((tnow = usec_now ()) < start_at)) {
+    uint64_t td = start_at - tnow;
+    pollfd pfd = { cfd, POLLIN, 0 };
+    if (poll (&pfd, 1, (td > 2000) ? (int)min<uint64_t> (td / 1000 - 1, 100) : 0) > 0) {
+      fprintf (stderr, "agent: job called off before the start\n");
+      return;
+    }
+    if (td <= 2000)
+      usleep ((td>50) ? (td-50) : 10);
+  }
+  if (g_interrupted.load ())
+    return;
+  g_idx = 0;
+  size_sample_buffer ((uint64_t)g_cfg.rate * g_cfg.threads);
+  g_running.store (true);
+  for (int ii=0; ii < g_cfg.threads; ii++)
+    vth.emplace_back (workload_entry, g_cfg.rate, doWrite, wcpu[ii]);
+
+  for (uint64_t k = 1; !g_interrupted.load (); k++) {
+    uint64_t tnext = start_at + k * 1000000;
+    while (!g_interrupted.load () && ((tnow = usec_now ()) < tnext)) {
+      uint64_t td = tnext - tnow;
+      usleep ((td>50) ? (td-50) : 10);
+    }
+    auto overflow = drain_interval (iv);
+    auto errors = g_errors.exchange (0);
+    if (k <= (uint64_t)g_cfg.warmup)
+      continue;
+    auto h = interval_hist (iv);
+    char *enc = nullptr;
+    dieunless (hdr_log_encode (h, &enc) == 0);
+    bool ok = send_line (cfd, { { "event", "interval" }, { "k", k - g_cfg.warmup }, { "t", tnext }, { "n", iv.size () + overflow }, { "errors", errors }, { "h", enc } });
+    free (enc);
+    hdr_close (h);
+    if (!ok || ((g_cfg.duration > 0) && (k - g_cfg.warmup >= (uint64_t)g_cfg.duration)))
+      break;
+  }
+  g_running.store (false);
+  for (auto& th : vth)
+    th.join ();
+  send_line (cfd, { { "event", "done" } });
+}
+
+// Serve coordinator jobs on AGENT_PORT until interrupted.  A job is
+// {"config": {...}, "start_at": usec}; the config overrides this agent's own
+// options, except for host-local ones like CPUS.
+void agent_entry (const config& base)
+{
+  int lfd, one = 1;
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons (g_cfg.agent_port);
+  dieunless ((lfd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) > 0);
+  dieunless (setsockopt (lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0);
+  dieunless (bind (lfd, (sockaddr *)&addr, sizeof(addr)) == 0);
+  dieunless (listen (lfd, 16) == 0);
+  // No SA_RESTART, so a SIGTERM from the coordinator breaks accept().
+  struct sigaction sa = {};
+  sa.sa_handler = sigint_handler;
+  sigaction (SIGINT, &sa, nullptr);
+  sigaction (SIGTERM, &sa, nullptr);
+  fprintf (stderr, "agent listening on %d\n", g_cfg.agent_port);
+
+  while (!g_interrupted.load ()) {
+    int cfd = accept (lfd, nullptr, nullptr);
+    if (cfd < 0)
+      continue;
+    setsockopt (cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    string buf, err;
+    json job;
+    config jc = base;
+    if (!recv_line (cfd, buf, job) || !job.contains ("config") || !job.contains ("start_at")) {
+      send_line (cfd, { { "event", "error" }, { "error", "bad job" } });
+    } else if (!jc.load_json (job["config"])) {
+      send_line (cfd, { { "event", "error" }, { "error", jc.error () } });
+    } else if (!apply_config (jc, err)) {
+      send_line (cfd, { { "event", "error" }, { "error", err } });
+    } else {
+      send_line (cfd, { { "event", "ready" }, { "threads", g_cfg.threads }, { "keylb", g_cfg.keylb }, { "keyub", g_cfg.keyub } });
+      agent_job (cfd, job["start_at"].get<uint64_t> (), g_cfg.mode == "update");
+    }
+    close (cfd);
+  }
+  close (lfd);
+}
+
+struct agent_conn
+{
+  string hostport;
+  int fd = -1;
+  pid_t pid = 0;
+  uint64_t count = 0;
+  bool done = false;
+};
+
+// Launch LOCAL_AGENTS copies of this binary and/or attach to AGENTS, split
+// the key range and total rate across them, start them together and merge
+// their interval histograms into one cluster-wide report (and HLOG).
+void coordinator_entry (const config& cfg, const char *argv0)
+{
+  vector<agent_conn> agents;
+  for (size_t pos = 0; pos < g_cfg.agents.size (); ) {
+    size_t cp = g_cfg.agents.find (',', pos);
+    if (cp == string::npos)	cp = g_cfg.agents.size ();
+    if (cp > pos)
+      agents.push_back ({ g_cfg.agents.substr (pos, cp - pos) });
+    pos = cp + 1;
+  }
+  // Every agent runs at least one thread and owns at least one key.
+  size_t na = agents.size () + g_cfg.local_agents;
+  int64_t nkeys = (int64_t)g_cfg.keyub - g_cfg.keylb + 1;
+  if ((size_t)g_cfg.threads < na) {
+    fprintf (stderr, "THREADS %d is fewer than the %zu agents\n", g_cfg.threads, na);
+    exit (1);
+  }
+  if (nkeys < (int64_t)na) {
+    fprintf (stderr, "KEYLB..KEYUB holds %ld keys, fewer than the %zu agents\n", nkeys, na);
+    exit (1);
+  }
+
+  // The logs open before any agent is launched, so failing to open them
+  // leaves nothing behind.
+  unique_ptr<hist_log> hlog;
+  if (!g_cfg.hlog.empty ())
+    dieunless ((hlog = hist_log::open (g_cfg.hlog)) != nullptr);
+  FILE *slog = nullptr;
+  auto srv = open_server_log (slog);
+
+  // Any failure from here until the run starts: call off the agents
+  // already waiting for it, then stop and reap the ones we launched.
+  auto fail = [&agents](const string& msg) {
+    fprintf (stderr, "%s\n", msg.c_str ());
+    for (auto& ac : agents) {
+      if (ac.fd >= 0) {
+	send_line (ac.fd, { { "event", "cancel" } });
+	close (ac.fd);
+      }
+      if (ac.pid > 0) {
+	kill (ac.pid, SIGTERM);
+	waitpid (ac.pid, nullptr, 0);
+      }
+    }
+    exit (1);
+  };
+
+  for (int ii = 0; ii < g_cfg.local_agents; ii++) {
+    agent_conn ac;
+    auto port = "AGENT_PORT=" + to_string (g_cfg.agent_port + ii);
+    ac.hostport = "127.0.0.1:" + to_string (g_cfg.agent_port + ii);
+    if ((ac.pid = fork ()) < 0)
+      fail (string ("fork: ") + strerror (errno));
+    if (ac.pid == 0) {
+      // The coordinator owns stdout; agents keep stderr.
+      int nfd = open ("/dev/null", O_WRONLY);
+      dup2 (nfd, 1);
+      execl ("/proc/self/exe", argv0, "ROLE=agent", port.c_str (), (char *)nullptr);
+      _exit (127);
+    }
+    agents.push_back (ac);
+  }
+
+  // Agents may still be binding; retry for a few seconds.
+  for (auto& ac : agents) {
+    auto ab = addr_resolve (ac.hostport);
+    for (int tries = 0; (ac.fd < 0) && (tries < 50); tries++) {
+      int fd, one = 1;
+      if ((fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+	fail (string ("socket: ") + strerror (errno));
+      setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (connect (fd, (sockaddr *)ab.data (), ab.size ()) == 0)
+	ac.fd = fd;
+      else {
+	close (fd);
+	usleep (100000);
+      }
+    }
+    if (ac.fd < 0)
+      fail ("agent " + ac.hostport + ": cannot connect");
+  }
+
+  // Contiguous key slices; threads split as evenly as they go, the first
+  // agents taking the remainder, each at the per-thread RATE.
+  uint64_t start_at = usec_now () + g_cfg.start_delay * 1000ul;
+  vector<string> bufs (na);
+  json jagents = json::array ();
+  for (size_t ii = 0; ii < na; ii++) {
+    json jc = cfg.to_json ();
+    for (auto k : { "AGENTS", "AGENT_PORT", "CPUS", "HLOG", "LOCAL_AGENTS", "REPORTER_CPU", "ROLE", "SERVER_HLOG" })
+      jc.erase (k);
+    jc["AGENT"] = g_cfg.agent + "-" + to_string (ii);
+    jc["KEYLB"] = g_cfg.keylb + (int64_t)(nkeys * ii / na);
+    jc["KEYUB"] = g_cfg.keylb + (int64_t)(nkeys * (ii + 1) / na) - 1;
+    jc["THREADS"] = g_cfg.threads / (int)na + ((int)ii < g_cfg.threads % (int)na);
+    jc["RATE"] = g_cfg.rate;
+    json jr;
+    if (!send_line (agents[ii].fd, { { "config", jc }, { "start_at", start_at } }) || !recv_line (agents[ii].fd, bufs[ii], jr))
+      fail ("agent " + agents[ii].hostport + ": connection lost");
+    if (jr["event"] != "ready")
+      fail ("agent " + agents[ii].hostport + ": " + jr.dump ());
+    jagents.push_back ({ { "agent", agents[ii].hostport }, { "pid", agents[ii].pid }, { "config", jc } });
+  }
+  g_run_meta["agents"] = jagents;
+  g_run_meta["start_at"] = start_at;
+  printf ("%s\n", json ({ { "meta", g_run_meta } }).dump ().c_str ());
+  fflush (stdout);
+
+  if (hlog)
+    hlog->header ("workload cluster", start_at * 1000);
+  if (srv)
+    srv->write_header (start_at);
+
+  // Intervals are emitted in order once every live agent has reported.
+  struct merged { hdr_histogram *h = nullptr; uint64_t t = 0; size_t n = 0; uint64_t errors = 0; };
+  map<uint64_t, merged> pending;
+  hdr_histogram *total = interval_hist ({});
+  mutex mtx;
+  uint64_t next_k = 1;
+  size_t live = na;
+
+  auto flush = [&](bool all) {
+    while (!pending.empty () && (pending.begin ()->first == next_k) && (all || (pending.begin ()->second.n >= live))) {
+      auto& m = pending.begin ()->second;
+      json jo = { { "now", m.t }, { "interval", next_k }, { "agents", m.n }, { "count", m.h->total_count }, { "errors", m.errors },
+		  { "p50", hdr_value_at_percentile (m.h, 50.0) }, { "p90", hdr_value_at_percentile (m.h, 90.0) },
+		  { "p99", hdr_value_at_percentile (m.h, 99.0) }, { "p999", hdr_value_at_percentile (m.h, 99.9) },
+		  { "max", hdr_max (m.h) } };
+      printf ("%s\n", jo.dump ().c_str ());
+      fflush (stdout);
+      if (hlog)
+	hlog->write ("", (m.t - 1000000) * 1000, m.t * 1000, m.h);
+      if (srv)
+	srv->sample (m.t - 1000000, m.t);
+      hdr_add (total, m.h);
+      hdr_close (m.h);
+      pending.erase (pending.begin ());
+      next_k++;
+    }
   };
-  // Override from environment
-  for (auto ep = *envp; ep; ep = *(++envp))
-    if (!strncmp (g_ep_str, ep, g_ep_str_sz)) {
-      auto vs = strchr (ep, '=');
-      auto ks = string (ep).substr (g_ep_str_sz, (vs - ep) - g_ep_str_sz);
-      if (ks.length ()) p[ks] = string (vs + 1);
+
+  vector<thread> vth;
+  for (size_t ii = 0; ii < na; ii++)
+    vth.emplace_back ([&, ii](){
+      json jo;
+      while (recv_line (agents[ii].fd, bufs[ii], jo) && (jo["event"] == "interval")) {
+	auto enc = jo["h"].get<string> ();
+	hdr_histogram *h = nullptr;
+	if (hdr_log_decode (&h, enc.data (), enc.size ()) != 0)
+	  continue;
+	lock_guard<mutex> lg (mtx);
+	auto& m = pending[jo["k"].get<uint64_t> ()];
+	if (!m.h)	m.h = interval_hist ({});
+	hdr_add (m.h, h);
+	hdr_close (h);
+	m.t = jo["t"].get<uint64_t> ();
+	m.n++;
+	m.errors += jo.value ("errors", (uint64_t)0);
+	agents[ii].count += jo["n"].get<uint64_t> ();
+	flush (false);
+      }
+      lock_guard<mutex> lg (mtx);
+      agents[ii].done = true;
+      live--;
+      flush (live == 0);
+    });
+
+  while (!g_interrupted.load () && any_of (agents.begin (), agents.end (), [&](const agent_conn& ac) { lock_guard<mutex> lg (mtx); return !ac.done; }))
+    usleep (10000);
+  // Closing the control connections stops the agents' send loops.
+  for (auto& ac : agents)
+    shutdown (ac.fd, SHUT_RDWR);
+  for (auto& th : vth)
+    th.join ();
+  flush (true);
+
+  json js = { { "now", usec_now () }, { "event", "cluster_summary" }, { "count", total->total_count },
+	      { "p50", hdr_value_at_percentile (total, 50.0) }, { "p90", hdr_value_at_percentile (total, 90.0) },
+	      { "p99", hdr_value_at_percentile (total, 99.0) }, { "p999", hdr_value_at_percentile (total, 99.9) },
+	      { "max", hdr_max (total) }, { "agents", json::array () } };
+  for (auto& ac : agents) {
+    js["agents"].push_back ({ { "agent", ac.hostport }, { "count", ac.count } });
+    close (ac.fd);
+    if (ac.pid > 0) {
+      kill (ac.pid, SIGTERM);
+      waitpid (ac.pid, nullptr, 0);
     }
+  }
+  printf ("%s\n", js.dump ().c_str ());
+  fflush (stdout);
+  hdr_close (total);
+  hlog.reset ();
+  srv.reset ();
+  if (slog)
+    fclose (slog);
+}
+
+config make_config (void)
+{
+  using t = config_opt::type;
+  return config ("WORKLOAD_", {
+    { "AGENT",		t::t_string,	"workload",		"client agent name" },
+    { "AGENTS",		t::t_string,	"",			"coordinator: agent host:port list to attach" },
+    { "AGENT_PORT",	t::t_int,	"3100",			"agent: control port; coordinator: first local agent port", 1, 65535 },
+    { "ASDB",		t::t_string,	"localhost:3000",	"server host:port" },
+    { "BIDX",		t::t_int,	"-1",			"bin index, -1 for random", -1, 65535 },
+    { "CPUS",		t::t_string,	"",			"worker core list, e.g. 0-3,8" },
+    { "DURATION",	t::t_int,	"0",			"measured run time in seconds after warmup, 0 for unlimited", 0 },
+    { "ERRORS",		t::t_string,	"count",		"ops answered with an error: count them per interval, or fatal on the first", {}, {}, { "count", "fatal" } },
+    { "HLOG",		t::t_string,	"",			"hdr interval log file, empty for none" },
+    { "KEYLB",		t::t_int,	"1",			"lowest key id" },
+    { "KEYUB",		t::t_int,	"10",			"highest key id" },
+    { "LOCAL_AGENTS",	t::t_int,	"0",			"coordinator: local agent processes to launch", 0, 1024 },
+    { "METRICS_SHM",	t::t_string,	"",			"shared memory segment of live metrics for workload_top, e.g. /workload; empty for none" },
+    { "MODE",		t::t_string,	"read",			"init, update or read", {}, {}, { "init", "update", "read" } },
+    { "NBINS",		t::t_int,	"20000",		"bins per record", 0, 65535 },
+    { "NS",		t::t_string,	"ns0",			"namespace" },
+    { "RATE",		t::t_int,	"100",			"ops/sec per thread, 0 for unthrottled", 0 },
+    { "RECSIZE",	t::t_int,	"500000",		"record size in bytes (init)", 0 },
+    { "REPORTER_CPU",	t::t_int,	"-1",			"housekeeping core for reporter, -1 for any", -1 },
+    { "ROLE",		t::t_string,	"standalone",		"standalone, agent or coordinator", {}, {}, { "standalone", "agent", "coordinator" } },
+    { "SEARCH",		t::t_bool,	"0",			"search for the max rate meeting SLO_P99" },
+    { "SEARCH_BISECT",	t::t_int,	"4",			"bisection steps after the first SLO miss", 0 },
+    { "SEARCH_EFF",	t::t_float,	"0.95",			"min achieved/offered ratio for a passing step", 0, 1 },
+    { "SEARCH_MAX",	t::t_int,	"200000",			"highest total ops/sec to offer", 1 },
+    { "SEARCH_MAX_ERR",	t::t_float,	"1",			"max % of ops answered with an error for a passing step", 0, 100 },
+    { "SEARCH_SECS",	t::t_int,	"10",			"measured seconds per search step", 1 },
+    { "SEARCH_START",	t::t_int,	"1000",			"first total ops/sec to offer", 1 },
+    { "SEARCH_STEP",	t::t_float,	"1.5",			"offered rate multiplier between steps", 1.01 },
+    { "SLOW_LOG",	t::t_string,	"",			"TRACE: JSON lines of calls slower than SLOW_US, with both messages; empty for none" },
+    { "SLOW_US",	t::t_int,	"10000",		"TRACE: usec from send to response for SLOW_LOG", 1 },
+    { "SLO_P99",	t::t_int,	"1000",			"p99 latency SLO in usec for SEARCH, timed from each op's scheduled send", 1 },
+    { "SERVER_HLOG",	t::t_string,	"",			"hdr interval log of server latencies: aligned with HLOG, empty for none" },
+    { "SERVER_NODES",	t::t_string,	"",			"host:port list for SERVER_HLOG, comma separated; ASDB when empty" },
+    { "SN",		t::t_string,	"demo",			"set name" },
+    { "START_DELAY",	t::t_int,	"2000",			"coordinator: msec from job send to synchronized start", 0 },
+    { "STEADY",		t::t_bool,	"0",			"end the run once throughput and p99 are stable" },
+    { "STEADY_CV",	t::t_float,	"0.05",			"max coefficient of variation for steady state", 0 },
+    { "STEADY_WINDOW",	t::t_int,	"10",			"intervals in the steady state window", 2 },
+    { "THREADS",	t::t_int,	"1",			"worker threads", 1, 4096 },
+    { "TIMESTAMPING",	t::t_string,	"off",			"split latency into phases with kernel timestamps: off, software or hardware", {}, {}, { "off", "software", "hardware" } },
+    { "TRACE",		t::t_bool,	"0",			"time each op's client side phases: encode, pace, send, wait and read" },
+    { "TRUNCATE",	t::t_bool,	"1",			"truncate the set before init" },
+    { "WARMUP",		t::t_int,	"0",			"unreported warmup seconds", 0 },
+    { "WARMUP_OPS",	t::t_int,	"0",			"unreported warmup ops, across threads", 0, CONFIG_INT_MAX },
+  });
+}
 
-  for (auto ii=1; ii<argc; ii++) {
-    auto ap = argv[ii];
-    auto vs = strchr (ap, '=');
-    dieunless (vs);
-    auto ks = string (ap).substr (0, vs - ap);
-    transform (ks.begin (), ks.end (), ks.begin (), ::toupper);
-    if (ks.length ()) p[ks] = string (vs + 1);
+// Copy the loaded options into g_cfg and check the ones that depend on
+// each other or on the host.
+bool apply_config (const config& cfg, string& err)
+{
+  auto fmt = [](const char *f, auto... args) {
+    char buf[256];
+    snprintf (buf, sizeof(buf), f, args...);
+    return string (buf);
+  };
+
+  g_cfg.agent = cfg.s ("AGENT");
+  g_cfg.asdb = cfg.s ("ASDB");
+  g_cfg.mode = cfg.s ("MODE");
+  g_cfg.ns = cfg.s ("NS");
+  g_cfg.sn = cfg.s ("SN");
+  g_cfg.bidx = cfg.i ("BIDX");
+  g_cfg.duration = cfg.i ("DURATION");
+  g_cfg.errors_fatal = cfg.s ("ERRORS") == "fatal";
+  g_cfg.keylb = cfg.i ("KEYLB");
+  g_cfg.keyub = cfg.i ("KEYUB");
+  g_cfg.nbins = cfg.i ("NBINS");
+  g_cfg.rate = cfg.i ("RATE");
+  g_cfg.recsize = cfg.i ("RECSIZE");
+  g_cfg.threads = cfg.i ("THREADS");
+  g_cfg.truncate = cfg.b ("TRUNCATE");
+  g_cfg.cpus = parse_cpulist (cfg.s ("CPUS"));
+  g_cfg.reporter_cpu = cfg.i ("REPORTER_CPU");
+  g_cfg.warmup = cfg.i ("WARMUP");
+  g_cfg.warmup_ops = cfg.i ("WARMUP_OPS");
+  g_cfg.steady = cfg.b ("STEADY");
+  g_cfg.steady_window = cfg.i ("STEADY_WINDOW");
+  g_cfg.steady_cv = cfg.f ("STEADY_CV");
+  g_cfg.search = cfg.b ("SEARCH");
+  g_cfg.search_bisect = cfg.i ("SEARCH_BISECT");
+  g_cfg.search_eff = cfg.f ("SEARCH_EFF");
+  g_cfg.search_max = cfg.i ("SEARCH_MAX");
+  g_cfg.search_max_err = cfg.f ("SEARCH_MAX_ERR");
+  g_cfg.search_secs = cfg.i ("SEARCH_SECS");
+  g_cfg.search_start = cfg.i ("SEARCH_START");
+  g_cfg.search_step = cfg.f ("SEARCH_STEP");
+  g_cfg.slo_p99 = cfg.i ("SLO_P99");
+  g_cfg.hlog = cfg.s ("HLOG");
+  g_cfg.server_hlog = cfg.s ("SERVER_HLOG");
+  g_cfg.server_nodes = cfg.s ("SERVER_NODES");
+  g_cfg.timestamping = cfg.s ("TIMESTAMPING");
+  g_cfg.trace = cfg.b ("TRACE");
+  g_cfg.slow_log = cfg.s ("SLOW_LOG");
+  g_cfg.slow_us = cfg.i ("SLOW_US");
+  g_cfg.metrics_shm = cfg.s ("METRICS_SHM");
+  g_cfg.role = cfg.s ("ROLE");
+  g_cfg.agents = cfg.s ("AGENTS");
+  g_cfg.agent_port = cfg.i ("AGENT_PORT");
+  g_cfg.local_agents = cfg.i ("LOCAL_AGENTS");
+  g_cfg.start_delay = cfg.i ("START_DELAY");
+  g_run_meta["config"] = cfg.to_json ();
+
+  auto online = online_cpus ();
+  auto is_online = [&](int cpu) { return find (online.begin (), online.end (), cpu) != online.end (); };
+  if (!cfg.s ("CPUS").empty () && g_cfg.cpus.empty ()) {
+    err = fmt ("CPUS '%s' is not a core list", cfg.s ("CPUS").c_str ());
+    return false;
+  }
+  for (auto cpu : g_cfg.cpus)
+    if (!is_online (cpu)) {
+      err = fmt ("CPUS core %d is not online", cpu);
+      return false;
+    }
+  if ((g_cfg.reporter_cpu >= 0) && !is_online (g_cfg.reporter_cpu)) {
+    err = fmt ("REPORTER_CPU %d is not online", g_cfg.reporter_cpu);
+    return false;
+  }
+
+  if (g_cfg.keylb > g_cfg.keyub) {
+    err = fmt ("KEYLB %d exceeds KEYUB %d", g_cfg.keylb, g_cfg.keyub);
+    return false;
+  }
+  if ((g_cfg.mode != "init") && (g_cfg.bidx < 0) && (g_cfg.nbins < 1)) {
+    err = "random BIDX needs NBINS >= 1";
+    return false;
+  }
+  if (g_cfg.bidx > g_cfg.nbins) {
+    err = fmt ("BIDX %d exceeds NBINS %d", g_cfg.bidx, g_cfg.nbins);
+    return false;
+  }
+  if ((g_cfg.role == "coordinator") && g_cfg.agents.empty () && (g_cfg.local_agents == 0)) {
+    err = "coordinator needs AGENTS or LOCAL_AGENTS";
+    return false;
+  }
+  if (g_cfg.trace && (g_cfg.timestamping != "off")) {
+    err = "TRACE and TIMESTAMPING each time the call; pick one";
+    return false;
+  }
+  if ((g_cfg.role == "coordinator") && ((g_cfg.mode == "init") || g_cfg.search)) {
+    err = "coordinator runs read or update, without SEARCH";
+    return false;
+  }
+
+  return true;
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  // srand ((unsigned int)clock ());
+  config cfg = make_config ();
+  config_load_or_die (cfg, argc, argv, envp);
+  clock_init ();
+  string err;
+  if (!apply_config (cfg, err)) {
+    fprintf (stderr, "%s: %s\n", argv[0], err.c_str ());
+    return 1;
   }
 
   signal (SIGINT, sigint_handler);
+  signal (SIGTERM, sigint_handler);
+  signal (SIGPIPE, SIG_IGN);
   g_running.store(true);
 
-  string cmd (p["MODE"]);
-
-  if (!cmd.compare ("init"))				init_entry ();
-  else if (!cmd.compare ("update"))			update_entry (true);
-  else if (!cmd.compare ("read"))			update_entry (false);
+  if (g_cfg.role == "agent")				agent_entry (cfg);
+  else if (g_cfg.role == "coordinator")			coordinator_entry (cfg, argv[0]);
+  else if (g_cfg.mode == "init")			init_entry ();
+  else if (g_cfg.search)				search_entry (g_cfg.mode == "update");
+  else if (g_cfg.mode == "update")			update_entry (true);
+  else if (g_cfg.mode == "read")			update_entry (false);
 
   return 0;
 }
@@ -0,0 +1,139 @@
+// Live view of a running workload from its METRICS_SHM segment: per
+// thread and per op type throughput, latency percentiles and errors over
+// the last complete interval, refreshed in place.  Only reads the
+// segment, so it can attach and detach at will without the workers
+// noticing.
+#include "config.hpp"
+#include "metrics_shm.hpp"
+#include "tsc_clock.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+volatile sig_atomic_t g_stop = 0;
+void sigint_handler (int) { g_stop = 1; }
+
+struct op_sum
+{
+  uint64_t ops = 0, errors = 0, total_ops = 0, total_errors = 0, max_ns = 0;
+  uint64_t hist[WLM_BUCKETS] = {};
+
+  void add (const wlm_snapshot& s, uint32_t op)
+  {
+    this->ops += s.iv_ops[op];
+    this->errors += s.iv_errors[op];
+    this->total_ops += s.ops[op];
+    this->total_errors += s.errors[op];
+    this->max_ns = max (this->max_ns, s.iv_max_ns[op]);
+    for (uint32_t ii = 0; ii < WLM_BUCKETS; ii++)
+      this->hist[ii] += s.iv_hist[op][ii];
+  }
+  // Upper bound of the bucket holding the pct'th value, capped at the max.
+  uint64_t percentile (double pct) const
+  {
+    uint64_t n = 0, total = 0;
+    for (auto c : this->hist)
+      total += c;
+    if (!total)
+      return 0;
+    uint64_t rank = (uint64_t)(pct / 100.0 * total + 0.5);
+    for (uint32_t ii = 0; ii < WLM_BUCKETS; ii++)
+      if ((n += this->hist[ii]) >= max (rank, (uint64_t)1))
+	return min (wlm_bucket_max (ii), this->max_ns);
+    return this->max_ns;
+  }
+};
+
+void print_row (string& out, const char *thr, const char *cpu, const char *op, const op_sum& s, double secs)
+{
+  char buf[256];
+  snprintf (buf, sizeof(buf), "%6s %5s %-6s %10.0f %8lu %10.1f %10.1f %10.1f %10.1f %12lu %8lu\n", thr, cpu, op,
+	    s.ops / secs, s.errors, s.percentile (50.0) / 1e3, s.percentile (99.0) / 1e3, s.percentile (99.9) / 1e3,
+	    s.max_ns / 1e3, s.total_ops, s.total_errors);
+  out += buf;
+}
+
+string render (const wlm_reader& rd, uint64_t iv, bool per_thread)
+{
+  const auto& h = rd.hdr ();
+  double secs = h.interval_ns / 1e9;
+  char buf[256];
+  string out;
+  snprintf (buf, sizeof(buf), "workload pid %d  agent %.64s  mode %.16s  up %.0fs  interval %lu (%.1fs)\n\n", h.pid, h.agent,
+	    h.mode, (iv + 1) * secs, iv, secs);
+  out += buf;
+  snprintf (buf, sizeof(buf), "%6s %5s %-6s %10s %8s %10s %10s %10s %10s %12s %8s\n", "thread", "cpu", "op", "ops/s", "errors",
+	    "p50 us", "p99 us", "p999 us", "max us", "total ops", "total err");
+  out += buf;
+
+  vector<op_sum> all (WLM_NOPS);
+  wlm_snapshot s;
+  bool finished = false;
+  for (uint32_t ii = 0; ii < rd.nthreads (); ii++) {
+    rd.read (ii, iv, s);
+    for (uint32_t op = 0; op < WLM_NOPS; op++) {
+      if (!s.ops[op])
+	continue;
+      all[op].add (s, op);
+      if (!per_thread)
+	continue;
+      op_sum one;
+      one.add (s, op);
+      finished = finished || !s.active;
+      string thr = to_string (ii) + (s.active ? "" : "*"), cpu = (s.cpu < 0) ? "-" : to_string (s.cpu);
+      print_row (out, thr.c_str (), cpu.c_str (), wlm_op_name (op), one, secs);
+    }
+  }
+  for (uint32_t op = 0; op < WLM_NOPS; op++)
+    if (all[op].total_ops)
+      print_row (out, "all", "", wlm_op_name (op), all[op], secs);
+  if (finished)
+    out += "\n* thread has finished\n";
+  return out;
+}
+
+int main (int argc, char **argv, char **envp)
+{
+  using t = config_opt::type;
+  config cfg ("WORKLOAD_TOP_", {
+    { "ONCE",		t::t_bool,	"false",	"print the last complete interval once and exit" },
+    { "PER_THREAD",	t::t_bool,	"true",		"a row per worker thread as well as the totals" },
+    { "REFRESH",	t::t_int,	"1000",		"msec between refreshes", 10 },
+    { "SHM",		t::t_string,	"/workload",	"segment named by the workload's METRICS_SHM" },
+  });
+  config_load_or_die (cfg, argc, argv, envp);
+
+  unique_ptr<wlm_reader> rd;
+  try {
+    rd = make_unique<wlm_reader> (cfg.s ("SHM"));
+  } catch (const exception& e) {
+    fprintf (stderr, "%s\n", e.what ());
+    return 1;
+  }
+  signal (SIGINT, sigint_handler);
+  signal (SIGTERM, sigint_handler);
+  bool once = cfg.b ("ONCE"), per_thread = cfg.b ("PER_THREAD");
+  while (!g_stop) {
+    // The interval in progress is still filling; show the one before it.
+    uint64_t iv = rd->interval (mono_ns ());
+    auto out = render (*rd, iv ? iv - 1 : 0, per_thread);
+    if (!once)
+      out = "\033[H\033[2J" + out;
+    fwrite (out.data (), 1, out.size (), stdout);
+    fflush (stdout);
+    // The workload unlinks the segment on exit; our mapping stays valid.
+    if (once || (kill (rd->hdr ().pid, 0) && (errno == ESRCH)))
+      break;
+    usleep (cfg.i ("REFRESH") * 1000);
+  }
+  return 0;
+}